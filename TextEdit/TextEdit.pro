@@ -1,23 +1,9 @@
-#-------------------------------------------------
-#
-# Project created by QtCreator 2016-07-01T19:02:16
-#
-#-------------------------------------------------
+# The editor, and the QtTest benchmarks of its hot paths.
 
-QT += core gui
-QT += printsupport
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+TEMPLATE = subdirs
 
+SUBDIRS += \
+    app \
+    benchmarks
 
-TARGET = TextEdit
-TEMPLATE = app
-
-SOURCES += main.cpp\
-        textedit.cpp
-
-HEADERS  += textedit.h
-
-FORMS    += textedit.ui
-
-RESOURCES += \
-    image.qrc
+app.file = app.pro
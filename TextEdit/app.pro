@@ -0,0 +1,12 @@
+#-------------------------------------------------
+#
+# Project created by QtCreator 2016-07-01T19:02:16
+#
+#-------------------------------------------------
+
+TARGET = TextEdit
+TEMPLATE = app
+
+include(textedit.pri)
+
+SOURCES += main.cpp
@@ -0,0 +1,203 @@
+#include "batchconverter.h"
+#include "documentsaver.h"
+#include "pagerenderer.h"
+#include "textdecoder.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QFontDatabase>
+#include <QHash>
+#include <QPainter>
+#include <QPdfWriter>
+#include <QTextDocument>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+#include <QUrl>
+#include <QVector>
+#include <QtConcurrent>
+
+namespace {
+bool writePdf(const QString &fileName, QTextDocument *document)
+{
+    // Pages are laid out and numbered like the editor's PDF export.
+    // QPdfWriter is used instead of QPrinter, which looks up the system
+    // printers and is not safe to create on a worker thread.
+    QPdfWriter writer(fileName);
+    writer.setCreator(QCoreApplication::applicationName());
+    const PageSetup setup = PageSetup::forDevice(&writer, document->defaultFont());
+    PageRenderer::prepare(document, setup);
+
+    QPainter painter;
+    if (!painter.begin(&writer))
+        return false;
+    const int pages = document->pageCount();
+    for (int page = 0; page < pages; ++page) {
+        if (page > 0)
+            writer.newPage();
+        PageRenderer::paint(&painter, setup, PageRenderer::render(document, setup, page), page + 1);
+    }
+    return painter.end();
+}
+}
+
+ConversionResult DocumentConverter::operator()(const ConversionJob &job) const
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    ConversionResult result;
+    result.input = job.input;
+    result.output = job.output;
+    if (QFileInfo(job.output).absoluteFilePath() == QFileInfo(job.input).absoluteFilePath()) {
+        result.error = QStringLiteral("the output would overwrite the input");
+        return result;
+    }
+
+    QFile in(job.input);
+    if (!in.open(QFile::ReadOnly)) {
+        result.error = in.errorString();
+        return result;
+    }
+    const QByteArray data = in.readAll();
+    result.bytes = data.size();
+
+    bool rich = false;
+    const QString text = TextDecoder::decode(data, &rich);
+    QTextDocument document;
+    document.setBaseUrl(QUrl::fromLocalFile(QFileInfo(job.input).absolutePath() + QLatin1Char('/')));
+    if (rich)
+        document.setHtml(text);
+    else
+        document.setPlainText(text);
+
+    if (QFileInfo(job.output).suffix().compare(QLatin1String("pdf"), Qt::CaseInsensitive) == 0)
+        result.ok = writePdf(job.output, &document);
+    else
+        result.ok = DocumentSaver::writeDocument(job.output, &document);
+    if (!result.ok)
+        result.error = QStringLiteral("could not write %1").arg(job.output);
+    result.elapsed = timer.elapsed();
+    return result;
+}
+
+bool BatchConverter::isRequested(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        if (qstrcmp(argv[i], "--convert") == 0 || qstrncmp(argv[i], "--convert=", 10) == 0)
+            return true;
+    }
+    return false;
+}
+
+int BatchConverter::run(const QStringList &arguments)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Converts documents without opening a window."));
+    parser.addHelpOption();
+    const QCommandLineOption convertOption(QStringLiteral("convert"),
+            QStringLiteral("Convert the files to <format>: pdf, odt, html or txt."), QStringLiteral("format"));
+    const QCommandLineOption outputOption(QStringLiteral("output-dir"),
+            QStringLiteral("Write the converted files to <dir> instead of next to the input."), QStringLiteral("dir"));
+    const QCommandLineOption jobsOption(QStringLiteral("jobs"),
+            QStringLiteral("Convert <n> files at a time; defaults to the number of cores."), QStringLiteral("n"));
+    parser.addOption(convertOption);
+    parser.addOption(outputOption);
+    parser.addOption(jobsOption);
+    parser.addPositionalArgument(QStringLiteral("files"), QStringLiteral("Files to convert."),
+                                 QStringLiteral("FILE..."));
+    parser.process(arguments);
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+    const QString format = parser.value(convertOption).toLower();
+    const QStringList formats = QStringList() << "pdf" << "odt" << "html" << "txt";
+    if (!formats.contains(format)) {
+        err << "Unknown format \"" << format << "\"; use one of " << formats.join(", ") << endl;
+        return 2;
+    }
+    const QStringList files = parser.positionalArguments();
+    if (files.isEmpty()) {
+        err << "No files to convert" << endl;
+        return 2;
+    }
+    int threads = QThread::idealThreadCount();
+    if (parser.isSet(jobsOption)) {
+        bool ok = false;
+        threads = parser.value(jobsOption).toInt(&ok);
+        if (!ok || threads < 1) {
+            err << "Invalid number of jobs \"" << parser.value(jobsOption) << "\"" << endl;
+            return 2;
+        }
+    }
+    QDir outputDir;
+    if (parser.isSet(outputOption)) {
+        outputDir.setPath(parser.value(outputOption));
+        if (!outputDir.mkpath(QStringLiteral("."))) {
+            err << "Could not create " << QDir::toNativeSeparators(outputDir.path()) << endl;
+            return 2;
+        }
+    }
+
+    // Inputs that would be written to the same file, such as a/x.html and
+    // b/x.html with --output-dir, are not converted after the first one.
+    QVector<ConversionJob> jobs;
+    jobs.reserve(files.size());
+    QHash<QString, QString> outputs;
+    int failed = 0;
+    foreach (const QString &file, files) {
+        const QFileInfo info(file);
+        const QString name = info.completeBaseName() + QLatin1Char('.') + format;
+        ConversionJob job;
+        job.input = file;
+        job.output = parser.isSet(outputOption) ? outputDir.filePath(name) : info.dir().filePath(name);
+        QString key = QDir::cleanPath(QFileInfo(job.output).absoluteFilePath());
+#if defined(Q_OS_WIN) || defined(Q_OS_MAC)
+        key = key.toLower();
+#endif
+        if (outputs.contains(key)) {
+            ++failed;
+            err << QDir::toNativeSeparators(file) << ": would be written to "
+                << QDir::toNativeSeparators(job.output) << " as well as "
+                << QDir::toNativeSeparators(outputs.value(key)) << endl;
+            continue;
+        }
+        outputs.insert(key, file);
+        jobs.append(job);
+    }
+
+    // Without threaded font rendering, text can only be laid out on this
+    // thread, which PDF needs.
+    if (format == QLatin1String("pdf") && !QFontDatabase::supportsThreadedFontRendering())
+        threads = 1;
+    QThreadPool::globalInstance()->setMaxThreadCount(threads);
+
+    QElapsedTimer timer;
+    timer.start();
+    QFuture<ConversionResult> future;
+    if (threads > 1)
+        future = QtConcurrent::mapped(jobs, DocumentConverter());
+
+    qint64 bytes = 0;
+    for (int i = 0; i < jobs.size(); ++i) {
+        const ConversionResult result = threads > 1 ? future.resultAt(i) : DocumentConverter()(jobs.at(i));
+        bytes += result.bytes;
+        if (result.ok) {
+            out << QDir::toNativeSeparators(result.input) << " -> " << QDir::toNativeSeparators(result.output)
+                << ": " << result.elapsed << " ms" << endl;
+        } else {
+            ++failed;
+            err << QDir::toNativeSeparators(result.input) << ": " << result.error << endl;
+        }
+    }
+
+    const qint64 elapsed = qMax<qint64>(1, timer.elapsed());
+    const double megabytes = bytes / 1048576.0;
+    out << "Converted " << files.size() - failed << " of " << files.size() << " files ("
+        << megabytes << " MB) in " << elapsed << " ms on " << threads << " threads: "
+        << jobs.size() * 1000.0 / elapsed << " files/s, " << megabytes * 1000 / elapsed << " MB/s" << endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,46 @@
+#ifndef BATCHCONVERTER_H
+#define BATCHCONVERTER_H
+
+#include <QString>
+#include <QStringList>
+
+struct ConversionJob
+{
+    QString input;
+    QString output;
+};
+
+struct ConversionResult
+{
+    ConversionResult() : ok(false), bytes(0), elapsed(0) {}
+
+    QString input;
+    QString output;
+    bool ok;
+    QString error;
+    qint64 bytes;
+    qint64 elapsed;
+};
+
+struct DocumentConverter
+{
+    typedef ConversionResult result_type;
+
+    ConversionResult operator()(const ConversionJob &job) const;
+};
+
+// Headless conversion of many files, started with
+//   TextEdit --convert pdf|odt|html|txt [--output-dir DIR] [--jobs N] FILE...
+// Every file is read, converted and written on its own document on the
+// thread pool. Timings are printed per file, in input order, followed by
+// the total throughput.
+class BatchConverter
+{
+public:
+    // True if the command line asks for a conversion; checked before the
+    // application object exists so the offscreen platform can be chosen.
+    static bool isRequested(int argc, char *argv[]);
+    static int run(const QStringList &arguments);
+};
+
+#endif // BATCHCONVERTER_H
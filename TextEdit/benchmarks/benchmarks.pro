@@ -0,0 +1,11 @@
+# QtTest benchmarks of the editor's hot paths; see tst_bench_textedit.cpp.
+
+QT += testlib
+
+TARGET = tst_bench_textedit
+TEMPLATE = app
+CONFIG += testcase
+
+include(../textedit.pri)
+
+SOURCES += tst_bench_textedit.cpp
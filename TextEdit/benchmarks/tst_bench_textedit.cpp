@@ -0,0 +1,601 @@
+#include "documentlimits.h"
+#include "documentloader.h"
+#include "documentsaver.h"
+#include "formatbatcher.h"
+#include "listformatter.h"
+#include "mappedfile.h"
+#include "odtwriter.h"
+#include "pdfexporter.h"
+#include "piecetable.h"
+#include "textdecoder.h"
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QPlainTextDocumentLayout>
+#include <QScopedPointer>
+#include <QTemporaryDir>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <QTextEdit>
+#include <QtTest>
+#include <climits>
+#include <functional>
+
+// Times the editor's hot paths on synthetic documents. Plain text is
+// generated, HTML is example.html scaled up to each size. The sizes come
+// from TEXTEDIT_BENCH_SIZES, comma separated with K, M or G suffixes, up
+// to 1G. Sizes whose documents do not fit in a QString or, roughly, in
+// the memory that is free are skipped. QtTest writes the results in
+// machine-readable form, e.g.
+//   QT_QPA_PLATFORM=offscreen ./tst_bench_textedit -o results.xml,xml -o -,txt
+
+namespace {
+const char *const kDefaultSizes = "1K,64K,1M,16M,128M,1G";
+const int kWriteBlock = 1024 * 1024;
+// Paragraphs turned into list items by the list benchmarks.
+const int kListParagraphs = 100000;
+// Rounds of benchmarks that time only part of each round.
+const int kRounds = 5;
+// Keystrokes typed into each document by the insert benchmark.
+const int kKeystrokes = 1000;
+// Family, size and weight, changed together by the format benchmark.
+const int kFormatChanges = 3;
+// Rough memory a benchmark needs per byte of its file: a decoded QString,
+// or a QTextDocument with its layout.
+const qint64 kDecodedBytes = 3;
+const qint64 kDocumentBytes = 32;
+
+bool parseSize(const QString &text, qint64 *size)
+{
+    QString number = text.trimmed().toUpper();
+    qint64 unit = 1;
+    if (number.endsWith(QLatin1Char('K')))
+        unit = 1024;
+    else if (number.endsWith(QLatin1Char('M')))
+        unit = 1024 * 1024;
+    else if (number.endsWith(QLatin1Char('G')))
+        unit = 1024 * 1024 * 1024;
+    if (unit > 1)
+        number.chop(1);
+    bool ok = false;
+    const qint64 value = number.toLongLong(&ok);
+    *size = value * unit;
+    return ok && value > 0;
+}
+
+// About 4 KB of lines of words, the same on every run.
+QByteArray plainUnit()
+{
+    static const char *const words[] = {
+        "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit",
+        "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore", "magna"
+    };
+    QByteArray text;
+    quint32 seed = 1;
+    while (text.size() < 4096) {
+        QByteArray line;
+        while (line.size() < 72) {
+            seed = seed * 1103515245 + 12345;
+            line += words[(seed >> 16) % 16];
+            line += ' ';
+        }
+        line[line.size() - 1] = '\n';
+        text += line;
+    }
+    return text;
+}
+
+// Writes \a head, then whole copies of \a unit up to about \a size bytes,
+// then \a tail, so scaled up markup stays balanced.
+bool writeScaled(const QString &fileName, const QByteArray &head, const QByteArray &unit,
+                 const QByteArray &tail, qint64 size)
+{
+    QFile out(fileName);
+    if (!out.open(QFile::WriteOnly))
+        return false;
+    const qint64 units = qMax<qint64>(1, (size - head.size() - tail.size()) / unit.size());
+    const int perBlock = qMax(1, kWriteBlock / unit.size());
+    QByteArray block;
+    for (int i = 0; i < perBlock; ++i)
+        block += unit;
+
+    out.write(head);
+    for (qint64 done = 0; done < units; done += perBlock) {
+        const qint64 bytes = qMin<qint64>(perBlock, units - done) * unit.size();
+        if (out.write(block.constData(), bytes) != bytes)
+            return false;
+    }
+    out.write(tail);
+    return out.error() == QFile::NoError;
+}
+
+QString sizeName(qint64 size)
+{
+    if (size >= 1024 * 1024 * 1024 && size % (1024 * 1024 * 1024) == 0)
+        return QString::number(size / (1024 * 1024 * 1024)) + QLatin1Char('G');
+    if (size >= 1024 * 1024 && size % (1024 * 1024) == 0)
+        return QString::number(size / (1024 * 1024)) + QLatin1Char('M');
+    if (size >= 1024 && size % 1024 == 0)
+        return QString::number(size / 1024) + QLatin1Char('K');
+    return QString::number(size);
+}
+
+// Loads \a fileName the way TextEdit::load() does: rich text is inserted
+// into \a document, plain text goes to a plain text document or, from
+// the editor's threshold on, to a piece table.
+bool load(const QString &fileName, QTextDocument *document)
+{
+    DocumentLoader loader;
+    loader.setPlainTextThreshold(DocumentLimits::pieceTableCharacters());
+    loader.setPlainTextDocument(document);
+    QEventLoop loop;
+    bool ok = false;
+    QObject::connect(&loader, &DocumentLoader::plainTextStarted, &loop, [&]() {
+        document->setDocumentLayout(new QPlainTextDocumentLayout(document));
+    });
+    QObject::connect(&loader, &DocumentLoader::plainTextDecoded, &loop, [&](const QString &text) {
+        const PieceTable table(text);
+        Q_UNUSED(table);
+    });
+    QObject::connect(&loader, &DocumentLoader::finished, &loop, [&](bool result) {
+        ok = result;
+        loop.quit();
+    });
+    loader.start(fileName, document);
+    if (loader.isRunning())
+        loop.exec();
+    return ok;
+}
+
+bool exportPdf(const QTextDocument *document, const QString &fileName)
+{
+    PdfExporter exporter;
+    QEventLoop loop;
+    bool ok = false;
+    QObject::connect(&exporter, &PdfExporter::finished, &loop, [&](bool result) {
+        ok = result;
+        loop.quit();
+    });
+    exporter.start(document, fileName);
+    if (exporter.isRunning())
+        loop.exec();
+    return ok;
+}
+
+// Runs \a body, which returns the nanoseconds spent in its timed part or
+// -1 on failure, a few times and returns the best, so that setup is not
+// counted.
+qint64 bestOf(const std::function<qint64()> &body)
+{
+    qint64 best = -1;
+    for (int i = 0; i < kRounds; ++i) {
+        const qint64 ns = body();
+        if (ns < 0)
+            return -1;
+        if (best < 0 || ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+// Memory the system can still hand out, or -1 where it is not known.
+qint64 availableMemory()
+{
+#ifdef Q_OS_LINUX
+    QFile meminfo(QStringLiteral("/proc/meminfo"));
+    if (meminfo.open(QFile::ReadOnly)) {
+        foreach (const QByteArray &line, meminfo.readAll().split('\n')) {
+            if (line.startsWith("MemAvailable:"))
+                return line.mid(13).trimmed().split(' ').first().toLongLong() * 1024;
+        }
+    }
+#endif
+    return -1;
+}
+
+// Why a benchmark that needs \a bytesPerByte bytes of memory for each
+// byte of a \a size byte file cannot run, or an empty string if it can.
+QString tooLarge(qint64 size, qint64 bytesPerByte)
+{
+    if (size * int(sizeof(QChar)) >= INT_MAX)
+        return QStringLiteral("the text does not fit in a QString");
+    const qint64 available = availableMemory();
+    if (available >= 0 && size * bytesPerByte > available)
+        return QStringLiteral("needs about %1 MB of memory, %2 MB are available")
+                .arg(size * bytesPerByte >> 20).arg(available >> 20);
+    return QString();
+}
+
+QString paragraphs()
+{
+    QStringList lines;
+    for (int i = 0; i < kListParagraphs; ++i)
+        lines.append(QStringLiteral("Paragraph %1").arg(i));
+    return lines.join(QLatin1Char('\n'));
+}
+
+QString readAll(const QString &fileName)
+{
+    QFile in(fileName);
+    if (!in.open(QFile::ReadOnly))
+        return QString();
+    return QString::fromUtf8(in.readAll());
+}
+}
+
+class tst_TextEdit : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void loadPlain_data();
+    void loadPlain();
+    void loadHtml_data();
+    void loadHtml();
+    void loadMapped_data();
+    void loadMapped();
+    void decodePlain_data();
+    void decodePlain();
+    void setHtml_data();
+    void setHtml();
+    void insert_data();
+    void insert();
+    void save_data();
+    void save();
+    void exportPdf_data();
+    void exportPdf();
+    void mergeFormat_data();
+    void mergeFormat();
+    void listApply();
+    void listRemove();
+
+private:
+    void addSizes();
+    QString plainFile(qint64 size) const;
+    QString richFile(qint64 size) const;
+
+    QTemporaryDir dir;
+    QList<qint64> sizes;
+};
+
+void tst_TextEdit::initTestCase()
+{
+    QVERIFY(dir.isValid());
+    const QString list = qEnvironmentVariableIsSet("TEXTEDIT_BENCH_SIZES")
+            ? QString::fromLocal8Bit(qgetenv("TEXTEDIT_BENCH_SIZES")) : QString::fromLatin1(kDefaultSizes);
+    foreach (const QString &text, list.split(QLatin1Char(','), QString::SkipEmptyParts)) {
+        qint64 size = 0;
+        QVERIFY2(parseSize(text, &size), qPrintable(QStringLiteral("invalid size \"%1\"").arg(text)));
+        sizes.append(size);
+    }
+
+    QFile example(QStringLiteral(":/example.html"));
+    QVERIFY(example.open(QFile::ReadOnly));
+    const QByteArray markup = example.readAll();
+    const int bodyStart = markup.indexOf('>', markup.indexOf("<body")) + 1;
+    const int bodyEnd = markup.lastIndexOf("</body>");
+    QVERIFY(bodyStart > 0 && bodyEnd >= bodyStart);
+    const QByteArray head = markup.left(bodyStart);
+    const QByteArray body = markup.mid(bodyStart, bodyEnd - bodyStart);
+    const QByteArray tail = markup.mid(bodyEnd);
+    const QByteArray plain = plainUnit();
+
+    foreach (qint64 size, sizes) {
+        QVERIFY(writeScaled(plainFile(size), QByteArray(), plain, QByteArray(), size));
+        QVERIFY(writeScaled(richFile(size), head, body, tail, size));
+    }
+}
+
+void tst_TextEdit::addSizes()
+{
+    QTest::addColumn<qint64>("size");
+    foreach (qint64 size, sizes)
+        QTest::newRow(qPrintable(sizeName(size))) << size;
+}
+
+QString tst_TextEdit::plainFile(qint64 size) const
+{
+    return QDir(dir.path()).filePath(QStringLiteral("plain-%1.txt").arg(size));
+}
+
+QString tst_TextEdit::richFile(qint64 size) const
+{
+    return QDir(dir.path()).filePath(QStringLiteral("rich-%1.html").arg(size));
+}
+
+void tst_TextEdit::loadPlain_data()
+{
+    addSizes();
+}
+
+void tst_TextEdit::loadPlain()
+{
+    QFETCH(qint64, size);
+    const QString reason = tooLarge(size, kDocumentBytes);
+    if (!reason.isEmpty())
+        QSKIP(qPrintable(reason));
+    QBENCHMARK {
+        QTextDocument document;
+        QVERIFY(load(plainFile(size), &document));
+    }
+}
+
+void tst_TextEdit::loadHtml_data()
+{
+    addSizes();
+}
+
+void tst_TextEdit::loadHtml()
+{
+    QFETCH(qint64, size);
+    const QString reason = tooLarge(size, kDocumentBytes);
+    if (!reason.isEmpty())
+        QSKIP(qPrintable(reason));
+    QBENCHMARK {
+        QTextDocument document;
+        QVERIFY(load(richFile(size), &document));
+    }
+}
+
+void tst_TextEdit::loadMapped_data()
+{
+    addSizes();
+}
+
+void tst_TextEdit::loadMapped()
+{
+    QFETCH(qint64, size);
+    QBENCHMARK {
+        MappedFile file;
+        QEventLoop loop;
+        connect(&file, &MappedFile::indexFinished, &loop, &QEventLoop::quit);
+        QVERIFY(file.open(plainFile(size)));
+        if (!file.isIndexed())
+            loop.exec();
+    }
+}
+
+void tst_TextEdit::decodePlain_data()
+{
+    addSizes();
+}
+
+void tst_TextEdit::decodePlain()
+{
+    // Decoding alone, reported in bytes per second.
+    QFETCH(qint64, size);
+    const QString reason = tooLarge(size, kDecodedBytes);
+    if (!reason.isEmpty())
+        QSKIP(qPrintable(reason));
+    QFile in(plainFile(size));
+    QVERIFY(in.open(QFile::ReadOnly));
+    const QByteArray data = in.readAll();
+    const qint64 ns = bestOf([&]() {
+        QElapsedTimer timer;
+        timer.start();
+        const QString text = TextDecoder::decodePlain(data);
+        const qint64 elapsed = timer.nsecsElapsed();
+        return text.isEmpty() ? qint64(-1) : elapsed;
+    });
+    QVERIFY(ns >= 0);
+    QTest::setBenchmarkResult(data.size() / qMax(ns / 1e9, 1e-9), QTest::BytesPerSecond);
+}
+
+void tst_TextEdit::setHtml_data()
+{
+    addSizes();
+}
+
+void tst_TextEdit::setHtml()
+{
+    QFETCH(qint64, size);
+    const QString reason = tooLarge(size, kDocumentBytes);
+    if (!reason.isEmpty())
+        QSKIP(qPrintable(reason));
+    const QString html = readAll(richFile(size));
+    QVERIFY(!html.isEmpty());
+    QBENCHMARK {
+        QTextDocument document;
+        document.setHtml(html);
+    }
+}
+
+void tst_TextEdit::insert_data()
+{
+    // Typing spread over the document, into the piece table the editor
+    // uses for large plain text and into a QTextDocument.
+    QTest::addColumn<qint64>("size");
+    QTest::addColumn<bool>("pieceTable");
+    foreach (qint64 size, sizes) {
+        QTest::newRow(qPrintable(QStringLiteral("piece table %1").arg(sizeName(size)))) << size << true;
+        QTest::newRow(qPrintable(QStringLiteral("text document %1").arg(sizeName(size)))) << size << false;
+    }
+}
+
+void tst_TextEdit::insert()
+{
+    QFETCH(qint64, size);
+    QFETCH(bool, pieceTable);
+    const QString reason = tooLarge(size, kDocumentBytes);
+    if (!reason.isEmpty())
+        QSKIP(qPrintable(reason));
+    const QString text = readAll(plainFile(size));
+    QVERIFY(!text.isEmpty());
+    const int step = qMax(1, text.size() / kKeystrokes);
+    const QString key = QStringLiteral("x");
+
+    if (pieceTable) {
+        PieceTable table(text);
+        QBENCHMARK {
+            for (int i = 0; i < kKeystrokes; ++i)
+                table.insert(qMin(i * step, table.length()), key);
+        }
+    } else {
+        QTextDocument document;
+        document.setDocumentLayout(new QPlainTextDocumentLayout(&document));
+        document.setPlainText(text);
+        QTextCursor cursor(&document);
+        QBENCHMARK {
+            for (int i = 0; i < kKeystrokes; ++i) {
+                cursor.setPosition(qMin(i * step, document.characterCount() - 1));
+                cursor.insertText(key);
+            }
+        }
+    }
+}
+
+void tst_TextEdit::save_data()
+{
+    QTest::addColumn<qint64>("size");
+    QTest::addColumn<QString>("format");
+    const QStringList formats = QStringList() << "odt" << "html" << "txt";
+    foreach (qint64 size, sizes) {
+        foreach (const QString &format, formats)
+            QTest::newRow(qPrintable(format + QLatin1Char('-') + sizeName(size))) << size << format;
+    }
+}
+
+void tst_TextEdit::save()
+{
+    QFETCH(qint64, size);
+    QFETCH(QString, format);
+    const QString reason = tooLarge(size, kDocumentBytes);
+    if (!reason.isEmpty())
+        QSKIP(qPrintable(reason));
+    QTextDocument document;
+    document.setHtml(readAll(richFile(size)));
+    const QString out = QDir(dir.path()).filePath(QStringLiteral("out.") + format);
+    if (format == QLatin1String("odt")) {
+        // The path DocumentSaver takes: a snapshot, written by an
+        // OdtWriter that is kept from one save to the next.
+        OdtWriter writer;
+        QBENCHMARK {
+            QScopedPointer<QTextDocument> snapshot(document.clone());
+            QVERIFY(writer.write(out, snapshot.data()));
+        }
+        return;
+    }
+    QBENCHMARK {
+        QVERIFY(DocumentSaver::writeDocument(out, &document));
+    }
+}
+
+void tst_TextEdit::exportPdf_data()
+{
+    addSizes();
+}
+
+void tst_TextEdit::exportPdf()
+{
+    QFETCH(qint64, size);
+    const QString reason = tooLarge(size, kDocumentBytes);
+    if (!reason.isEmpty())
+        QSKIP(qPrintable(reason));
+    QTextDocument document;
+    document.setHtml(readAll(richFile(size)));
+    const QString out = QDir(dir.path()).filePath(QStringLiteral("out.pdf"));
+    QBENCHMARK {
+        QVERIFY(::exportPdf(&document, out));
+    }
+}
+
+void tst_TextEdit::mergeFormat_data()
+{
+    // Before and after FormatBatcher: the old path merged into the
+    // selection and then into the current format, each in an edit of its
+    // own. Several changes at once, such as family, size and bold, are
+    // what the batcher folds into one edit block.
+    QTest::addColumn<qint64>("size");
+    QTest::addColumn<bool>("batched");
+    QTest::addColumn<int>("changes");
+    foreach (qint64 size, sizes) {
+        const QString name = sizeName(size);
+        QTest::newRow(qPrintable(QStringLiteral("direct, 1 change %1").arg(name))) << size << false << 1;
+        QTest::newRow(qPrintable(QStringLiteral("batched, 1 change %1").arg(name))) << size << true << 1;
+        QTest::newRow(qPrintable(QStringLiteral("direct, %1 changes %2").arg(kFormatChanges).arg(name)))
+                << size << false << kFormatChanges;
+        QTest::newRow(qPrintable(QStringLiteral("batched, %1 changes %2").arg(kFormatChanges).arg(name)))
+                << size << true << kFormatChanges;
+    }
+}
+
+void tst_TextEdit::mergeFormat()
+{
+    // What mergeFormatOnWordOrSelection() does with a whole document
+    // selected.
+    QFETCH(qint64, size);
+    QFETCH(bool, batched);
+    QFETCH(int, changes);
+    const QString reason = tooLarge(size, kDocumentBytes);
+    if (!reason.isEmpty())
+        QSKIP(qPrintable(reason));
+    QTextEdit editor;
+    editor.setHtml(readAll(richFile(size)));
+    editor.selectAll();
+    FormatBatcher batcher(&editor);
+    int round = 0;
+    QBENCHMARK {
+        const bool odd = round++ % 2;
+        QList<QTextCharFormat> formats;
+        QTextCharFormat family;
+        family.setFontFamily(odd ? QStringLiteral("Times") : QStringLiteral("Helvetica"));
+        QTextCharFormat pointSize;
+        pointSize.setFontPointSize(odd ? 12 : 14);
+        QTextCharFormat weight;
+        weight.setFontWeight(odd ? QFont::Normal : QFont::Bold);
+        formats << weight << family << pointSize;
+        for (int i = 0; i < changes; ++i) {
+            if (batched) {
+                batcher.merge(formats.at(i));
+            } else {
+                QTextCursor cursor = editor.textCursor();
+                cursor.mergeCharFormat(formats.at(i));
+                editor.mergeCurrentCharFormat(formats.at(i));
+            }
+        }
+        if (batched)
+            batcher.flush();
+    }
+}
+
+void tst_TextEdit::listApply()
+{
+    const QString text = paragraphs();
+    QTextDocument document;
+    document.setUndoRedoEnabled(false);
+    const qint64 ns = bestOf([&]() {
+        document.setPlainText(text);
+        QTextCursor cursor(&document);
+        cursor.select(QTextCursor::Document);
+        QElapsedTimer timer;
+        timer.start();
+        ListFormatter::apply(cursor, QTextListFormat::ListDecimal);
+        return timer.nsecsElapsed();
+    });
+    QTest::setBenchmarkResult(ns / 1e6, QTest::WalltimeMilliseconds);
+}
+
+void tst_TextEdit::listRemove()
+{
+    const QString text = paragraphs();
+    QTextDocument document;
+    document.setUndoRedoEnabled(false);
+    const qint64 ns = bestOf([&]() {
+        document.setPlainText(text);
+        QTextCursor cursor(&document);
+        cursor.select(QTextCursor::Document);
+        ListFormatter::apply(cursor, QTextListFormat::ListDisc);
+        QElapsedTimer timer;
+        timer.start();
+        ListFormatter::remove(cursor);
+        return timer.nsecsElapsed();
+    });
+    QTest::setBenchmarkResult(ns / 1e6, QTest::WalltimeMilliseconds);
+}
+
+QTEST_MAIN(tst_TextEdit)
+
+#include "tst_bench_textedit.moc"
@@ -0,0 +1,35 @@
+#include "documentlimits.h"
+#include "lazydocumentlayout.h"
+#include <QTextDocument>
+
+namespace {
+const qint64 kLargeFileThreshold = 64 * 1024 * 1024;
+const int kPieceTableThreshold = 4 * 1024 * 1024;
+const qint64 kLazyLayoutThreshold = 2 * 1024 * 1024;
+const int kLazyLayoutBlocks = 50000;
+}
+
+bool DocumentLimits::opensMapped(qint64 bytes)
+{
+    return bytes >= kLargeFileThreshold;
+}
+
+bool DocumentLimits::usesPieceTable(int characters)
+{
+    return characters >= kPieceTableThreshold;
+}
+
+int DocumentLimits::pieceTableCharacters()
+{
+    return kPieceTableThreshold;
+}
+
+bool DocumentLimits::loadsLazily(qint64 bytes)
+{
+    return bytes >= kLazyLayoutThreshold;
+}
+
+bool DocumentLimits::keepsLazyLayout(const QTextDocument *document)
+{
+    return document->blockCount() >= kLazyLayoutBlocks && LazyDocumentLayout::supports(document);
+}
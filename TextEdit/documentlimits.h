@@ -0,0 +1,29 @@
+#ifndef DOCUMENTLIMITS_H
+#define DOCUMENTLIMITS_H
+
+#include <QtGlobal>
+
+QT_BEGIN_NAMESPACE
+class QTextDocument;
+QT_END_NAMESPACE
+
+// The sizes at which the editor opens a document in another view or lays
+// it out differently. Anything that wants to reproduce what the editor
+// does with a file, such as --memstats, decides with these.
+class DocumentLimits
+{
+public:
+    // Files of \a bytes are opened in the read-only memory-mapped viewer.
+    static bool opensMapped(qint64 bytes);
+    // Plain text is edited in a QPlainTextEdit, or in a piece table from
+    // a number of characters on.
+    static bool usesPieceTable(int characters);
+    // The number of characters from which usesPieceTable() holds.
+    static int pieceTableCharacters();
+    // Files of \a bytes are loaded with the lazy layout, which is kept if
+    // keepsLazyLayout() holds for the loaded document.
+    static bool loadsLazily(qint64 bytes);
+    static bool keepsLazyLayout(const QTextDocument *document);
+};
+
+#endif // DOCUMENTLIMITS_H
@@ -0,0 +1,317 @@
+#include "documentloader.h"
+#include "perflog.h"
+#include "textdecoder.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <QScopedPointer>
+#include <QTextCodec>
+#include <QTextCursor>
+#include <QtConcurrent>
+
+namespace {
+// Sizes are in characters. The first slice is kept small so that the
+// first screen is painted before the rest is inserted.
+const int kFirstChunk = 16 * 1024;
+const int kChunk = 256 * 1024;
+// Time spent inserting per event loop iteration.
+const int kSliceMs = 12;
+const qint64 kReadBlock = 1024 * 1024;
+// Parsed HTML segments waiting to be inserted.
+const int kMaxQueuedSegments = 8;
+}
+
+DocumentLoader::DocumentLoader(QObject *parent) :
+    QObject(parent),
+    stop(false),
+    running(false),
+    plainTextThreshold(-1),
+    position(0),
+    htmlRead(false),
+    segmentsInserted(0)
+{
+    insertTimer.setInterval(0);
+    connect(&insertTimer, &QTimer::timeout, this, &DocumentLoader::insertChunk);
+    segmentTimer.setInterval(0);
+    connect(&segmentTimer, &QTimer::timeout, this, &DocumentLoader::insertSegments);
+    connect(&watcher, &QFutureWatcher<DecodedText>::finished, this, &DocumentLoader::decoded);
+}
+
+DocumentLoader::~DocumentLoader()
+{
+    stop = true;
+    clearQueue();
+    watcher.waitForFinished();
+}
+
+void DocumentLoader::start(const QString &fileName, QTextDocument *document)
+{
+    cancel();
+    watcher.waitForFinished();
+    clearQueue();
+
+    file = fileName;
+    target = document;
+    stop = false;
+    running = true;
+    text.clear();
+    position = 0;
+    styleSheet = document->defaultStyleSheet();
+    htmlRead = false;
+    segmentsInserted = 0;
+    loadTimer.start();
+    target->setUndoRedoEnabled(false);
+
+    emit progress(0);
+    watcher.setFuture(QtConcurrent::run(this, &DocumentLoader::read, fileName));
+}
+
+void DocumentLoader::setPlainTextThreshold(int chars)
+{
+    plainTextThreshold = chars;
+}
+
+void DocumentLoader::setPlainTextDocument(QTextDocument *document)
+{
+    plainDocument = document;
+}
+
+void DocumentLoader::cancel()
+{
+    if (!running)
+        return;
+    stop = true;
+    insertTimer.stop();
+    segmentTimer.stop();
+    clearQueue();
+    running = false;
+    text.clear();
+    if (target)
+        target->setUndoRedoEnabled(true);
+    emit cancelled();
+}
+
+bool DocumentLoader::isRunning() const
+{
+    return running;
+}
+
+QString DocumentLoader::fileName() const
+{
+    return file;
+}
+
+DecodedText DocumentLoader::read(const QString &fileName)
+{
+    DecodedText result;
+    QFile in(fileName);
+    if (!in.open(QFile::ReadOnly))
+        return result;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Reading accounts for the first half of the progress range,
+    // inserting for the second.
+    const qint64 total = in.size();
+    QByteArray data = in.read(kReadBlock);
+    if (QTextCodec *codec = TextDecoder::codecForRichText(data)) {
+        readHtml(in, data, codec);
+        result.rich = true;
+        result.ok = !stop && in.error() == QFile::NoError;
+        qCDebug(lcPerf) << "read and parsed" << fileName << "in" << timer.elapsed() << "ms";
+        return result;
+    }
+
+    data.reserve(int(total));
+    if (total > 0)
+        emit progress(int(qint64(data.size()) * 50 / total));
+    while (!in.atEnd()) {
+        if (stop)
+            return result;
+        data += in.read(kReadBlock);
+        if (total > 0)
+            emit progress(int(qint64(data.size()) * 50 / total));
+    }
+
+    const qint64 readMs = timer.restart();
+    result.text = TextDecoder::decodePlain(data);
+    result.ok = !stop;
+
+    const qint64 decodeMs = timer.elapsed();
+    qCDebug(lcPerf) << "read" << fileName << "in" << readMs << "ms, decoded in" << decodeMs << "ms"
+                    << "(" << data.size() / 1048576.0 * 1000 / qMax<qint64>(1, decodeMs) << "MB/s )";
+    return result;
+}
+
+void DocumentLoader::readHtml(QFile &in, const QByteArray &head, QTextCodec *codec)
+{
+    QScopedPointer<QTextDecoder> decoder(codec->makeDecoder());
+    HtmlStreamImporter importer(styleSheet);
+    const qint64 total = in.size();
+    qint64 done = 0;
+
+    QByteArray data = head;
+    while (!stop) {
+        done += data.size();
+        importer.append(decoder->toUnicode(data));
+        const bool atEnd = in.atEnd();
+        if (atEnd)
+            importer.finish();
+        const int percent = total > 0 ? int(done * 100 / total) : 100;
+        while (importer.hasSegment() && !stop)
+            enqueue(importer.takeSegment(), percent);
+        if (atEnd)
+            break;
+        data = in.read(kReadBlock);
+        if (data.isEmpty())
+            break;
+    }
+}
+
+void DocumentLoader::enqueue(const HtmlSegment &segment, int percent)
+{
+    PendingSegment pending;
+    pending.segment = segment;
+    pending.percent = percent;
+
+    QMutexLocker lock(&queueMutex);
+    while (queue.size() >= kMaxQueuedSegments && !stop)
+        queueNotFull.wait(&queueMutex);
+    if (stop)
+        return;
+    queue.enqueue(pending);
+    lock.unlock();
+    QMetaObject::invokeMethod(this, "startInserting", Qt::QueuedConnection);
+}
+
+void DocumentLoader::clearQueue()
+{
+    // Wakes a reader waiting for room after stop was set.
+    QMutexLocker lock(&queueMutex);
+    queue.clear();
+    queueNotFull.wakeAll();
+}
+
+void DocumentLoader::decoded()
+{
+    if (!running || stop)
+        return;
+
+    DecodedText result = watcher.result();
+    if (!result.ok || !target) {
+        finish(false);
+        return;
+    }
+
+    if (!result.rich && plainTextThreshold >= 0 && result.text.size() >= plainTextThreshold) {
+        emit plainTextDecoded(result.text);
+        finish(true);
+        return;
+    }
+
+    if (result.rich) {
+        htmlRead = true;
+        startInserting();
+        return;
+    }
+
+    text = result.text;
+    position = 0;
+    if (plainDocument) {
+        // The target was only needed for rich text.
+        target->setUndoRedoEnabled(true);
+        target = plainDocument;
+        target->setUndoRedoEnabled(false);
+        target->clear();
+        emit plainTextStarted();
+    }
+    insertChunk();
+    if (running)
+        insertTimer.start();
+}
+
+void DocumentLoader::insertChunk()
+{
+    if (!target) {
+        finish(false);
+        return;
+    }
+
+    QElapsedTimer budget;
+    budget.start();
+    QTextCursor cursor(target);
+    cursor.movePosition(QTextCursor::End);
+
+    const bool first = position == 0;
+    do {
+        int size = qMin(first ? kFirstChunk : kChunk, text.size() - position);
+        // Never split a surrogate pair or a CRLF line break.
+        const int end = position + size;
+        if (end < text.size() && (text.at(end - 1).isHighSurrogate() || text.at(end - 1) == QLatin1Char('\r')))
+            ++size;
+        cursor.insertText(text.mid(position, size));
+        position += size;
+    } while (!first && position < text.size() && budget.elapsed() < kSliceMs);
+
+    emit progress(text.isEmpty() ? 100 : 50 + int(qint64(position) * 50 / text.size()));
+    if (position >= text.size())
+        finish(true);
+}
+
+void DocumentLoader::startInserting()
+{
+    if (running && !stop && !segmentTimer.isActive())
+        segmentTimer.start();
+}
+
+void DocumentLoader::insertSegments()
+{
+    if (!target) {
+        finish(false);
+        return;
+    }
+
+    QElapsedTimer budget;
+    budget.start();
+    QTextCursor cursor(target);
+    cursor.movePosition(QTextCursor::End);
+
+    bool empty = false;
+    while (budget.elapsed() < kSliceMs) {
+        PendingSegment pending;
+        {
+            QMutexLocker lock(&queueMutex);
+            empty = queue.isEmpty();
+            if (empty)
+                break;
+            pending = queue.dequeue();
+            queueNotFull.wakeAll();
+        }
+        if (segmentsInserted == 0)
+            HtmlStreamImporter::setDocumentFormat(target, pending.segment);
+        HtmlStreamImporter::insert(cursor, pending.segment);
+        if (segmentsInserted++ == 0)
+            qCDebug(lcPerf) << "first segment of" << file << "shown after" << loadTimer.elapsed() << "ms";
+        emit progress(pending.percent);
+    }
+    if (!empty)
+        return;
+
+    segmentTimer.stop();
+    if (htmlRead)
+        finish(true);
+}
+
+void DocumentLoader::finish(bool ok)
+{
+    insertTimer.stop();
+    segmentTimer.stop();
+    running = false;
+    text.clear();
+    if (target) {
+        target->setUndoRedoEnabled(true);
+        target->setModified(false);
+    }
+    qCDebug(lcPerf) << "loaded" << file << "in" << loadTimer.elapsed() << "ms";
+    emit finished(ok);
+}
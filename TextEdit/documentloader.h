@@ -0,0 +1,107 @@
+#ifndef DOCUMENTLOADER_H
+#define DOCUMENTLOADER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QMutex>
+#include <QPointer>
+#include <QQueue>
+#include <QTextDocument>
+#include <QTimer>
+#include <QWaitCondition>
+#include <atomic>
+#include "htmlstreamimporter.h"
+
+QT_BEGIN_NAMESPACE
+class QFile;
+class QTextCodec;
+QT_END_NAMESPACE
+
+struct DecodedText
+{
+    DecodedText() : ok(false), rich(false) {}
+
+    QString text;
+    bool ok;
+    // Rich text is streamed into the document while it is read and is
+    // not part of the result.
+    bool rich;
+};
+
+// Reads and decodes a file on a worker thread, then fills the target
+// document in small slices from the event loop so the window stays
+// responsive and the first screen of text shows up right away. HTML is
+// parsed segment by segment while it is read, with only a few parsed
+// segments held back at a time.
+class DocumentLoader : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DocumentLoader(QObject *parent = 0);
+    ~DocumentLoader();
+
+    void start(const QString &fileName, QTextDocument *document);
+    // Plain text of at least \a chars characters is not inserted into the
+    // document but handed out through plainTextDecoded(). A negative
+    // threshold, the default, keeps all text in the document.
+    void setPlainTextThreshold(int chars);
+    // Plain text below the threshold is inserted into \a document instead
+    // of the target, which stays empty; plainTextStarted() is emitted
+    // before the first slice.
+    void setPlainTextDocument(QTextDocument *document);
+    void cancel();
+    bool isRunning() const;
+    QString fileName() const;
+
+signals:
+    void progress(int percent);
+    void plainTextDecoded(const QString &text);
+    void plainTextStarted();
+    void finished(bool ok);
+    void cancelled();
+
+private slots:
+    void decoded();
+    void insertChunk();
+    void insertSegments();
+    void startInserting();
+
+private:
+    struct PendingSegment
+    {
+        PendingSegment() : percent(0) {}
+
+        HtmlSegment segment;
+        int percent;
+    };
+
+    DecodedText read(const QString &fileName);
+    void readHtml(QFile &in, const QByteArray &head, QTextCodec *codec);
+    void enqueue(const HtmlSegment &segment, int percent);
+    void clearQueue();
+    void finish(bool ok);
+
+    QString file;
+    QPointer<QTextDocument> target;
+    QPointer<QTextDocument> plainDocument;
+    QFutureWatcher<DecodedText> watcher;
+    std::atomic<bool> stop;
+    bool running;
+    int plainTextThreshold;
+
+    QTimer insertTimer;
+    QString text;
+    int position;
+
+    QString styleSheet;
+    QTimer segmentTimer;
+    QMutex queueMutex;
+    QWaitCondition queueNotFull;
+    QQueue<PendingSegment> queue;
+    bool htmlRead;
+    int segmentsInserted;
+    QElapsedTimer loadTimer;
+};
+
+#endif // DOCUMENTLOADER_H
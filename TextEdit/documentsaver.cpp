@@ -0,0 +1,152 @@
+#include "documentsaver.h"
+#include "perflog.h"
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QTextBlock>
+#include <QTextDocumentWriter>
+#include <QTextStream>
+#include <QtConcurrent>
+
+DocumentSaver::DocumentSaver(QObject *parent) :
+    QObject(parent),
+    pending(false),
+    result(false)
+{
+    connect(&watcher, &QFutureWatcher<bool>::finished, this, &DocumentSaver::complete);
+}
+
+DocumentSaver::~DocumentSaver()
+{
+    watcher.waitForFinished();
+}
+
+void DocumentSaver::save(const QString &fileName, const QTextDocument *document)
+{
+    waitForFinished();
+    // Cloning is a single pass over the fragments; serializing and writing
+    // the clone is left to the worker.
+    timer.start();
+    snapshot.reset(document->clone());
+    pieces = PieceTable();
+    file = fileName;
+    const QString suffix = QFileInfo(fileName).suffix().toLower();
+    if (suffix == QLatin1String("odt") || suffix == QLatin1String("odf"))
+        watcher.setFuture(QtConcurrent::run(&odtWriter, &OdtWriter::write, fileName, snapshot.data()));
+    else
+        watcher.setFuture(QtConcurrent::run(&DocumentSaver::writeDocument, fileName, snapshot.data()));
+    pending = true;
+}
+
+void DocumentSaver::saveText(const QString &fileName, const QTextDocument *document)
+{
+    waitForFinished();
+    timer.start();
+    snapshot.reset(document->clone());
+    pieces = PieceTable();
+    file = fileName;
+    watcher.setFuture(QtConcurrent::run(&DocumentSaver::writeText, fileName, snapshot.data()));
+    pending = true;
+}
+
+void DocumentSaver::save(const QString &fileName, const PieceTable &table)
+{
+    waitForFinished();
+    // Copying a piece table only shares its buffers and root.
+    timer.start();
+    snapshot.reset();
+    pieces = table;
+    file = fileName;
+    watcher.setFuture(QtConcurrent::run(&DocumentSaver::writePieceTable, fileName, pieces));
+    pending = true;
+}
+
+bool DocumentSaver::isRunning() const
+{
+    return pending;
+}
+
+bool DocumentSaver::waitForFinished()
+{
+    if (!pending)
+        return result;
+    watcher.waitForFinished();
+    complete();
+    return result;
+}
+
+const PieceTable &DocumentSaver::pieceSnapshot() const
+{
+    return pieces;
+}
+
+void DocumentSaver::complete()
+{
+    if (!pending)
+        return;
+    pending = false;
+    result = watcher.result();
+    snapshot.reset();
+    qCDebug(lcPerf) << "saved" << file << "in" << timer.elapsed() << "ms";
+    emit finished(result, file, timer.elapsed());
+}
+
+bool DocumentSaver::writeDocument(const QString &fileName, QTextDocument *document)
+{
+    const QByteArray suffix = QFileInfo(fileName).suffix().toLower().toLatin1();
+    if (suffix == "txt" || suffix == "plaintext")
+        return writeText(fileName, document);
+
+    QSaveFile out(fileName);
+    if (!out.open(QFile::WriteOnly))
+        return false;
+    QTextDocumentWriter writer(&out, suffix);
+    if (!writer.write(document)) {
+        out.cancelWriting();
+        return false;
+    }
+    // QSaveFile syncs the temporary file before renaming it.
+    return out.commit();
+}
+
+bool DocumentSaver::writeText(const QString &fileName, QTextDocument *document)
+{
+    QSaveFile out(fileName);
+    if (!out.open(QFile::WriteOnly))
+        return false;
+    // Same text as QTextDocument::toPlainText, one block at a time, and
+    // in UTF-8 like QTextDocumentWriter rather than the locale encoding.
+    QTextStream stream(&out);
+    stream.setCodec("UTF-8");
+    for (QTextBlock block = document->begin(); block.isValid(); block = block.next()) {
+        QString text = block.text();
+        text.replace(QChar::Nbsp, QLatin1Char(' '));
+        text.replace(QChar::LineSeparator, QLatin1Char('\n'));
+        stream << text;
+        if (block.next().isValid())
+            stream << '\n';
+    }
+    stream.flush();
+    if (stream.status() != QTextStream::Ok) {
+        out.cancelWriting();
+        return false;
+    }
+    return out.commit();
+}
+
+bool DocumentSaver::writePieceTable(const QString &fileName, const PieceTable &table)
+{
+    static const int kSlice = 1024 * 1024;
+    QSaveFile out(fileName);
+    if (!out.open(QFile::WriteOnly))
+        return false;
+    QTextStream stream(&out);
+    stream.setCodec("UTF-8");
+    for (int position = 0; position < table.length(); position += kSlice)
+        stream << table.text(position, kSlice);
+    stream.flush();
+    if (stream.status() != QTextStream::Ok) {
+        out.cancelWriting();
+        return false;
+    }
+    return out.commit();
+}
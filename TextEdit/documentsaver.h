@@ -0,0 +1,56 @@
+#ifndef DOCUMENTSAVER_H
+#define DOCUMENTSAVER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QScopedPointer>
+#include <QTextDocument>
+#include "odtwriter.h"
+#include "piecetable.h"
+
+// Saves a snapshot of a document from a worker thread. The data goes to a
+// temporary file that is synced and renamed over the target only once it
+// is complete, so an interrupted save never leaves a truncated file.
+class DocumentSaver : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DocumentSaver(QObject *parent = 0);
+    ~DocumentSaver();
+
+    void save(const QString &fileName, const QTextDocument *document);
+    // Writes the text of \a document, whatever the suffix of \a fileName.
+    void saveText(const QString &fileName, const QTextDocument *document);
+    void save(const QString &fileName, const PieceTable &table);
+    bool isRunning() const;
+    // Blocks until the running save is done and returns its result.
+    bool waitForFinished();
+
+    const PieceTable &pieceSnapshot() const;
+
+    // Writes \a document in the format named by the suffix of \a fileName.
+    // Safe to call from any thread.
+    static bool writeDocument(const QString &fileName, QTextDocument *document);
+
+signals:
+    void finished(bool ok, const QString &fileName, qint64 elapsed);
+
+private slots:
+    void complete();
+
+private:
+    static bool writeText(const QString &fileName, QTextDocument *document);
+    static bool writePieceTable(const QString &fileName, const PieceTable &table);
+
+    QFutureWatcher<bool> watcher;
+    OdtWriter odtWriter;
+    QScopedPointer<QTextDocument> snapshot;
+    PieceTable pieces;
+    QString file;
+    QElapsedTimer timer;
+    bool pending;
+    bool result;
+};
+
+#endif // DOCUMENTSAVER_H
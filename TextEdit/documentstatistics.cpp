@@ -0,0 +1,228 @@
+#include "documentstatistics.h"
+#include "perflog.h"
+#include <QElapsedTimer>
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <QtConcurrent>
+
+namespace {
+// Blocks per job when the whole document is counted.
+const int kBlocksPerJob = 4096;
+// Changes larger than this are counted on the thread pool.
+const int kRecountChars = 1024 * 1024;
+const int kWordsPerMinute = 230;
+
+class BlockCounts : public QTextBlockUserData
+{
+public:
+    BlockCounts(const QSharedPointer<DocumentStatistics::Totals> &totals, int words, bool filled) :
+        totals(totals), words(words), filled(filled)
+    {
+        totals->words += words;
+        totals->paragraphs += filled;
+    }
+
+    ~BlockCounts()
+    {
+        totals->words -= words;
+        totals->paragraphs -= filled;
+    }
+
+    void set(int newWords, bool newFilled)
+    {
+        totals->words += newWords - words;
+        totals->paragraphs += int(newFilled) - int(filled);
+        words = newWords;
+        filled = newFilled;
+    }
+
+    QSharedPointer<DocumentStatistics::Totals> totals;
+    int words;
+    bool filled;
+};
+}
+
+int TextCounts::readingMinutes() const
+{
+    return int((words + kWordsPerMinute - 1) / kWordsPerMinute);
+}
+
+QVector<int> WordCounter::operator()(const QStringList &texts) const
+{
+    QVector<int> words;
+    words.reserve(texts.size());
+    foreach (const QString &text, texts)
+        words.append(DocumentStatistics::wordCount(text));
+    return words;
+}
+
+DocumentStatistics::DocumentStatistics(QTextDocument *document, QObject *parent) :
+    QObject(parent),
+    document(document),
+    totals(new Totals),
+    countedRevision(-1),
+    counting(false),
+    stale(false),
+    relayout(false)
+{
+    connect(document, &QTextDocument::contentsChange, this, &DocumentStatistics::contentsChange);
+    connect(document, &QTextDocument::documentLayoutChanged, this, &DocumentStatistics::layoutChanged);
+    connect(&watcher, &QFutureWatcher<QVector<int> >::finished, this, &DocumentStatistics::counted);
+    recount();
+}
+
+DocumentStatistics::~DocumentStatistics()
+{
+    watcher.cancel();
+    watcher.waitForFinished();
+}
+
+int DocumentStatistics::wordCount(const QString &text)
+{
+    // A word is a run of letters, digits and combining marks.
+    int words = 0;
+    bool inWord = false;
+    const QChar *p = text.constData();
+    const QChar *end = p + text.size();
+    for (; p != end; ++p) {
+        const bool wordChar = p->isLetterOrNumber() || p->isMark();
+        if (wordChar && !inWord)
+            ++words;
+        inWord = wordChar;
+    }
+    return words;
+}
+
+void DocumentStatistics::recount()
+{
+    watcher.cancel();
+    watcher.waitForFinished();
+
+    // Block texts are copied here; counting them is left to the pool.
+    QList<QStringList> jobs;
+    QStringList texts;
+    for (QTextBlock block = document->begin(); block.isValid(); block = block.next()) {
+        texts.append(block.text());
+        if (texts.size() == kBlocksPerJob) {
+            jobs.append(texts);
+            texts.clear();
+        }
+    }
+    jobs.append(texts);
+
+    countedRevision = document->revision();
+    counting = true;
+    stale = false;
+    watcher.setFuture(QtConcurrent::mapped(jobs, WordCounter()));
+}
+
+bool DocumentStatistics::isCounting() const
+{
+    return counting;
+}
+
+void DocumentStatistics::counted()
+{
+    if (watcher.isCanceled() || !watcher.isFinished())
+        return;
+    if (document->revision() != countedRevision) {
+        recount();
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    // Counts of the previous pass drop out of their own totals.
+    totals = QSharedPointer<Totals>(new Totals);
+    QTextBlock block = document->begin();
+    foreach (const QVector<int> &words, watcher.future().results()) {
+        foreach (int count, words) {
+            block.setUserData(new BlockCounts(totals, count, block.length() > 1));
+            block = block.next();
+        }
+    }
+    counting = false;
+    qCDebug(lcPerf) << "counted" << totals->words << "words in" << document->blockCount()
+                    << "blocks, stored in" << timer.elapsed() << "ms";
+    emit changed();
+}
+
+void DocumentStatistics::layoutChanged()
+{
+    relayout = true;
+}
+
+void DocumentStatistics::contentsChange(int position, int removed, int added)
+{
+    Q_UNUSED(removed);
+    // A new layout reports the whole document as inserted right after it
+    // is installed.
+    if (relayout) {
+        relayout = false;
+        return;
+    }
+    // Loads and recoveries run with undo disabled and are counted as a
+    // whole once they are done; a pass that is running starts over anyway.
+    if (!document->isUndoRedoEnabled()) {
+        stale = true;
+        return;
+    }
+    if (counting)
+        return;
+    if (stale || added > kRecountChars) {
+        recount();
+        return;
+    }
+    update(position, position + added);
+    emit changed();
+}
+
+void DocumentStatistics::update(int from, int to)
+{
+    const QTextBlock last = document->findBlock(qMin(to, document->characterCount() - 1));
+    for (QTextBlock block = document->findBlock(from); block.isValid(); block = block.next()) {
+        const int words = wordCount(block.text());
+        const bool filled = block.length() > 1;
+        BlockCounts *counts = dynamic_cast<BlockCounts *>(block.userData());
+        if (counts && counts->totals == totals)
+            counts->set(words, filled);
+        else
+            block.setUserData(new BlockCounts(totals, words, filled));
+        if (block == last)
+            break;
+    }
+}
+
+TextCounts DocumentStatistics::counts() const
+{
+    TextCounts result;
+    result.words = totals->words;
+    result.paragraphs = totals->paragraphs;
+    result.characters = document->characterCount() - document->blockCount();
+    return result;
+}
+
+TextCounts DocumentStatistics::count(const QTextCursor &selection) const
+{
+    TextCounts result;
+    if (!selection.hasSelection())
+        return result;
+    const int start = selection.selectionStart();
+    const int end = selection.selectionEnd();
+    for (QTextBlock block = document->findBlock(start); block.isValid() && block.position() <= end; block = block.next()) {
+        const int from = qMax(start, block.position()) - block.position();
+        const int to = qMin(end, block.position() + block.length() - 1) - block.position();
+        const BlockCounts *counts = dynamic_cast<const BlockCounts *>(block.userData());
+        if (from == 0 && to == block.length() - 1 && counts && counts->totals == totals && !counting) {
+            // Whole blocks are not counted again.
+            result.words += counts->words;
+            result.paragraphs += counts->filled;
+        } else if (to > from) {
+            result.words += wordCount(block.text().mid(from, to - from));
+            ++result.paragraphs;
+        }
+        result.characters += to - from;
+    }
+    return result;
+}
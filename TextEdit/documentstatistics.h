@@ -0,0 +1,84 @@
+#ifndef DOCUMENTSTATISTICS_H
+#define DOCUMENTSTATISTICS_H
+
+#include <QObject>
+#include <QFutureWatcher>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QVector>
+
+QT_BEGIN_NAMESPACE
+class QTextCursor;
+class QTextDocument;
+QT_END_NAMESPACE
+
+struct TextCounts
+{
+    TextCounts() : words(0), characters(0), paragraphs(0) {}
+
+    qint64 words;
+    // Without paragraph separators.
+    qint64 characters;
+    // Paragraphs with at least one character.
+    qint64 paragraphs;
+
+    int readingMinutes() const;
+};
+
+struct WordCounter
+{
+    typedef QVector<int> result_type;
+
+    QVector<int> operator()(const QStringList &texts) const;
+};
+
+// Keeps word, character and paragraph counts of a document up to date.
+// Every block carries its own counts as user data, which takes them out of
+// the totals again when the block is deleted, so an edit costs as much as
+// counting the blocks it touched. Whole documents are counted on the
+// thread pool.
+class DocumentStatistics : public QObject
+{
+    Q_OBJECT
+public:
+    struct Totals
+    {
+        Totals() : words(0), paragraphs(0) {}
+
+        qint64 words;
+        qint64 paragraphs;
+    };
+
+    explicit DocumentStatistics(QTextDocument *document, QObject *parent = 0);
+    ~DocumentStatistics();
+
+    // Counts the whole document again, in the background.
+    void recount();
+    bool isCounting() const;
+
+    TextCounts counts() const;
+    TextCounts count(const QTextCursor &selection) const;
+
+    static int wordCount(const QString &text);
+
+signals:
+    void changed();
+
+private slots:
+    void contentsChange(int position, int removed, int added);
+    void layoutChanged();
+    void counted();
+
+private:
+    void update(int from, int to);
+
+    QTextDocument *document;
+    QSharedPointer<Totals> totals;
+    QFutureWatcher<QVector<int> > watcher;
+    int countedRevision;
+    bool counting;
+    bool stale;
+    bool relayout;
+};
+
+#endif // DOCUMENTSTATISTICS_H
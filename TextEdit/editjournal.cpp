@@ -0,0 +1,368 @@
+#include "editjournal.h"
+#include "perflog.h"
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QLockFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTextDocumentFragment>
+#include <QtConcurrent>
+
+namespace {
+const quint32 kMagic = 0x54454a31; // "TEJ1"
+const int kFlushMs = 2000;
+// A journal is compacted once it is larger than the snapshot, but never
+// before it reaches this size.
+const qint64 kMinCompactBytes = 1024 * 1024;
+
+QString journalRoot()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation)
+            + QLatin1String("/journal");
+}
+
+// Files of a journal directory sorted by generation.
+QMap<int, QString> filesOf(const QString &path, const QString &kind)
+{
+    QMap<int, QString> files;
+    const QString prefix = kind + QLatin1Char('-');
+    foreach (const QString &name, QDir(path).entryList(QStringList() << prefix + QLatin1Char('*'), QDir::Files)) {
+        bool ok = false;
+        const int generation = name.mid(prefix.size()).toInt(&ok);
+        if (ok)
+            files.insert(generation, path + QLatin1Char('/') + name);
+    }
+    return files;
+}
+
+bool readSnapshot(const QString &path, QString *fileName, QString *html)
+{
+    QFile in(path);
+    if (!in.open(QFile::ReadOnly))
+        return false;
+    QDataStream stream(&in);
+    stream.setVersion(QDataStream::Qt_5_0);
+    quint32 magic = 0;
+    stream >> magic;
+    if (magic != kMagic)
+        return false;
+    stream >> *fileName;
+    if (html)
+        stream >> *html;
+    return stream.status() == QDataStream::Ok;
+}
+}
+
+EditJournal::EditJournal(QTextDocument *document, QObject *parent) :
+    QObject(parent),
+    document(document),
+    generation(0),
+    snapshotGeneration(0),
+    journalSize(0),
+    snapshotSize(0),
+    relayout(false),
+    suspended(false)
+{
+    flushTimer.setSingleShot(true);
+    flushTimer.setInterval(kFlushMs);
+    connect(&flushTimer, &QTimer::timeout, this, &EditJournal::flush);
+    connect(&watcher, &QFutureWatcher<bool>::finished, this, &EditJournal::snapshotWritten);
+    connect(document, &QTextDocument::contentsChange, this, &EditJournal::contentsChange);
+    connect(document, &QTextDocument::documentLayoutChanged, this, &EditJournal::layoutChanged);
+}
+
+EditJournal::~EditJournal()
+{
+    watcher.waitForFinished();
+    flush();
+}
+
+void EditJournal::reset(const QString &fileName)
+{
+    watcher.waitForFinished();
+    snapshot.reset();
+    flushTimer.stop();
+    pending.clear();
+    journal.close();
+    if (!directory.isEmpty()) {
+        lock.reset();
+        QDir(directory).removeRecursively();
+        directory.clear();
+    }
+    this->fileName = fileName;
+    generation = 0;
+    snapshotGeneration = 0;
+    journalSize = 0;
+    suspended = false;
+}
+
+JournalSession EditJournal::suspend()
+{
+    // The snapshot being written still belongs to the session.
+    watcher.waitForFinished();
+    snapshotWritten();
+    flush();
+    journal.close();
+
+    JournalSession session;
+    session.fileName = fileName;
+    session.directory = directory;
+    session.lock = lock;
+    session.generation = generation;
+    session.snapshotGeneration = snapshotGeneration;
+    session.journalSize = journalSize;
+    session.snapshotSize = snapshotSize;
+
+    lock.reset();
+    directory.clear();
+    reset(QString());
+    suspended = true;
+    return session;
+}
+
+void EditJournal::resume(const JournalSession &session)
+{
+    reset(session.fileName);
+    directory = session.directory;
+    lock = session.lock;
+    generation = session.generation;
+    snapshotGeneration = session.snapshotGeneration;
+    journalSize = session.journalSize;
+    snapshotSize = session.snapshotSize;
+    if (generation > 0) {
+        journal.setFileName(filePath(QLatin1String("journal"), generation));
+        journal.open(QFile::WriteOnly | QFile::Append);
+    }
+}
+
+void JournalSession::discard()
+{
+    lock.reset();
+    if (!directory.isEmpty())
+        QDir(directory).removeRecursively();
+    *this = JournalSession();
+}
+
+void EditJournal::checkpoint()
+{
+    if (document->isModified() && !watcher.isRunning())
+        startGeneration();
+}
+
+void EditJournal::flush()
+{
+    flushTimer.stop();
+    if (pending.isEmpty() || !journal.isOpen())
+        return;
+    journal.write(pending);
+    journal.flush();
+    pending.clear();
+}
+
+void EditJournal::layoutChanged()
+{
+    relayout = true;
+}
+
+void EditJournal::contentsChange(int position, int removed, int added)
+{
+    // A new layout reports the whole document as inserted right after it
+    // is installed.
+    if (relayout) {
+        relayout = false;
+        return;
+    }
+    if (suspended)
+        return;
+    // Bulk inserts while loading run with undo disabled.
+    if (!document->isUndoRedoEnabled())
+        return;
+    if (generation == 0) {
+        // The snapshot already contains this change.
+        startGeneration();
+        return;
+    }
+
+    const int end = qMin(position + added, document->characterCount() - 1);
+    QString html;
+    if (end > position) {
+        QTextCursor cursor(document);
+        cursor.setPosition(position);
+        cursor.setPosition(end, QTextCursor::KeepAnchor);
+        html = cursor.selection().toHtml();
+    }
+
+    // Inserted fragments are merged into the blocks around them, so the
+    // formats of the first and last block are kept separately.
+    QByteArray record;
+    QDataStream out(&record, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << qint32(position) << qint32(removed) << qint32(added) << html
+        << QTextFormat(document->findBlock(position).blockFormat())
+        << QTextFormat(document->findBlock(end).blockFormat());
+
+    QDataStream frame(&pending, QIODevice::WriteOnly | QIODevice::Append);
+    frame.setVersion(QDataStream::Qt_5_0);
+    frame << record;
+    journalSize += record.size();
+    if (!flushTimer.isActive())
+        flushTimer.start();
+
+    if (journalSize > qMax(kMinCompactBytes, snapshotSize) && !watcher.isRunning())
+        startGeneration();
+}
+
+void EditJournal::startGeneration()
+{
+    flush();
+    if (directory.isEmpty()) {
+        directory = journalRoot() + QLatin1Char('/')
+                + QString::number(QCoreApplication::applicationPid()) + QLatin1Char('-')
+                + QString::number(QDateTime::currentMSecsSinceEpoch());
+        QDir().mkpath(directory);
+        lock.reset(new QLockFile(directory + QLatin1String("/lock")));
+        lock->tryLock(0);
+    }
+
+    // Changes from here on go to the next journal, which is replayed on
+    // top of the snapshot taken now.
+    journal.close();
+    ++generation;
+    journal.setFileName(filePath(QLatin1String("journal"), generation));
+    journal.open(QFile::WriteOnly | QFile::Truncate);
+    journalSize = 0;
+
+    snapshot.reset(document->clone());
+    snapshotSize = qint64(document->characterCount()) * 2;
+    snapshotGeneration = generation;
+    watcher.setFuture(QtConcurrent::run(&EditJournal::writeSnapshot, snapshot.data(),
+                                        filePath(QLatin1String("snapshot"), generation), fileName));
+}
+
+void EditJournal::snapshotWritten()
+{
+    if (!snapshot)
+        return;
+    snapshot.reset();
+    if (!watcher.result() || directory.isEmpty())
+        return;
+    // Everything before the new snapshot is no longer needed.
+    const QStringList kinds = QStringList() << QLatin1String("snapshot") << QLatin1String("journal");
+    foreach (const QString &kind, kinds) {
+        const QMap<int, QString> files = filesOf(directory, kind);
+        for (QMap<int, QString>::const_iterator it = files.constBegin(); it != files.constEnd() && it.key() < snapshotGeneration; ++it)
+            QFile::remove(it.value());
+    }
+    qCDebug(lcPerf) << "journal compacted to generation" << snapshotGeneration;
+}
+
+QString EditJournal::filePath(const QString &kind, int generation) const
+{
+    return directory + QLatin1Char('/') + kind + QLatin1Char('-') + QString::number(generation);
+}
+
+bool EditJournal::writeSnapshot(QTextDocument *document, const QString &path, const QString &fileName)
+{
+    QSaveFile out(path);
+    if (!out.open(QFile::WriteOnly))
+        return false;
+    QDataStream stream(&out);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << kMagic << fileName << document->toHtml();
+    return stream.status() == QDataStream::Ok && out.commit();
+}
+
+QStringList EditJournal::pendingRecoveries()
+{
+    QStringList paths;
+    const QDir root(journalRoot());
+    foreach (const QString &name, root.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        const QString path = root.filePath(name);
+        // A lock that is still held belongs to a running session.
+        QLockFile probe(path + QLatin1String("/lock"));
+        if (!probe.tryLock(0))
+            continue;
+        if (filesOf(path, QLatin1String("snapshot")).isEmpty())
+            QDir(path).removeRecursively();
+        else
+            paths << path;
+    }
+    return paths;
+}
+
+QString EditJournal::recoveredFileName(const QString &path)
+{
+    const QMap<int, QString> snapshots = filesOf(path, QLatin1String("snapshot"));
+    QString fileName;
+    if (!snapshots.isEmpty())
+        readSnapshot(snapshots.last(), &fileName, 0);
+    return fileName;
+}
+
+bool EditJournal::recover(const QString &path, QTextDocument *document)
+{
+    const QMap<int, QString> snapshots = filesOf(path, QLatin1String("snapshot"));
+    if (snapshots.isEmpty())
+        return false;
+    QString fileName;
+    QString html;
+    if (!readSnapshot(snapshots.last(), &fileName, &html))
+        return false;
+
+    // Replayed edits are neither undoable nor journaled again.
+    document->setUndoRedoEnabled(false);
+    document->setHtml(html);
+
+    // A journal of a later generation exists if a compaction was cut short.
+    const QMap<int, QString> journals = filesOf(path, QLatin1String("journal"));
+    for (QMap<int, QString>::const_iterator it = journals.lowerBound(snapshots.lastKey()); it != journals.constEnd(); ++it) {
+        if (!replay(it.value(), document))
+            break;
+    }
+    document->setUndoRedoEnabled(true);
+    return true;
+}
+
+bool EditJournal::replay(const QString &path, QTextDocument *document)
+{
+    QFile file(path);
+    if (!file.open(QFile::ReadOnly))
+        return false;
+    QDataStream frames(&file);
+    frames.setVersion(QDataStream::Qt_5_0);
+    QTextCursor cursor(document);
+    forever {
+        QByteArray record;
+        frames >> record;
+        // A record cut off by a crash ends the journal.
+        if (frames.status() != QDataStream::Ok)
+            return true;
+
+        QDataStream in(record);
+        in.setVersion(QDataStream::Qt_5_0);
+        qint32 position, removed, added;
+        QString html;
+        QTextFormat first, last;
+        in >> position >> removed >> added >> html >> first >> last;
+        const int end = document->characterCount() - 1;
+        if (in.status() != QDataStream::Ok || position < 0 || position > end)
+            return false;
+
+        cursor.setPosition(position);
+        cursor.setPosition(qMin(position + removed, end), QTextCursor::KeepAnchor);
+        cursor.removeSelectedText();
+        if (!html.isEmpty())
+            cursor.insertFragment(QTextDocumentFragment::fromHtml(html));
+        QTextCursor(document->findBlock(position)).setBlockFormat(first.toBlockFormat());
+        QTextCursor(document->findBlock(position + added)).setBlockFormat(last.toBlockFormat());
+    }
+}
+
+void EditJournal::discard(const QString &path)
+{
+    QDir(path).removeRecursively();
+}
@@ -0,0 +1,93 @@
+#ifndef EDITJOURNAL_H
+#define EDITJOURNAL_H
+
+#include <QObject>
+#include <QFile>
+#include <QFutureWatcher>
+#include <QScopedPointer>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QTextDocument>
+#include <QTimer>
+
+QT_BEGIN_NAMESPACE
+class QLockFile;
+QT_END_NAMESPACE
+
+// The journal of a document that is not in the editor. Its files stay on
+// disk, and locked, until it is resumed or discarded.
+struct JournalSession
+{
+    JournalSession() : generation(0), snapshotGeneration(0), journalSize(0), snapshotSize(0) {}
+
+    QString fileName;
+    QString directory;
+    QSharedPointer<QLockFile> lock;
+    int generation;
+    int snapshotGeneration;
+    qint64 journalSize;
+    qint64 snapshotSize;
+
+    void discard();
+};
+
+// Keeps unsaved edits of a document on disk for crash recovery. The first
+// edit after a reset writes a snapshot of the document from a worker
+// thread; every later change is appended to a journal as the changed
+// range, so autosaving costs as much as the edit. Once the journal has
+// grown past the size of the snapshot, a new snapshot is written in the
+// background and the older files are dropped.
+class EditJournal : public QObject
+{
+    Q_OBJECT
+public:
+    explicit EditJournal(QTextDocument *document, QObject *parent = 0);
+    ~EditJournal();
+
+    // Drops the journal; the document now matches \a fileName on disk.
+    void reset(const QString &fileName);
+    // Hands out the journal of a document that is switched out of the
+    // editor, with its files kept. Changes are ignored until the next
+    // reset() or resume().
+    JournalSession suspend();
+    // Goes on with the journal of a document switched back in.
+    void resume(const JournalSession &session);
+    // Writes a snapshot right away if the document has unsaved changes.
+    void checkpoint();
+    void flush();
+
+    // Journals left behind by sessions that did not exit cleanly.
+    static QStringList pendingRecoveries();
+    static QString recoveredFileName(const QString &path);
+    static bool recover(const QString &path, QTextDocument *document);
+    static void discard(const QString &path);
+
+private slots:
+    void contentsChange(int position, int removed, int added);
+    void layoutChanged();
+    void snapshotWritten();
+
+private:
+    void startGeneration();
+    QString filePath(const QString &kind, int generation) const;
+    static bool writeSnapshot(QTextDocument *document, const QString &path, const QString &fileName);
+    static bool replay(const QString &path, QTextDocument *document);
+
+    QTextDocument *document;
+    QString fileName;
+    QString directory;
+    QSharedPointer<QLockFile> lock;
+    QFile journal;
+    QByteArray pending;
+    QTimer flushTimer;
+    QFutureWatcher<bool> watcher;
+    QScopedPointer<QTextDocument> snapshot;
+    int generation;
+    int snapshotGeneration;
+    qint64 journalSize;
+    qint64 snapshotSize;
+    bool relayout;
+    bool suspended;
+};
+
+#endif // EDITJOURNAL_H
@@ -0,0 +1,474 @@
+#include "findbar.h"
+#include "perflog.h"
+#include "textsearch.h"
+#include <QCheckBox>
+#include <QGridLayout>
+#include <QKeyEvent>
+#include <QLabel>
+#include <QLineEdit>
+#include <QPlainTextEdit>
+#include <QPushButton>
+#include <QTextBlock>
+#include <QTextCursor>
+
+namespace {
+// Let typing settle before the document is searched again.
+const int kRestartMs = 200;
+// Highlights are added at most once per frame.
+const int kHighlightMs = 16;
+// Every extra selection is a cursor the document keeps up to date on
+// each edit, so only this many hits are highlighted.
+const int kMaxHighlights = 5000;
+
+// The characters [from, to) of \a document as toPlainText() has them.
+QString plainText(const QTextDocument *document, int from, int to)
+{
+    QString text;
+    text.reserve(to - from);
+    for (QTextBlock block = document->findBlock(from); block.isValid() && block.position() < to; block = block.next()) {
+        // Block separators, frame boundaries included, read as newlines.
+        const QString blockText = block.text() + QLatin1Char('\n');
+        const int start = qMax(from, block.position());
+        text += blockText.midRef(start - block.position(), qMin(to, block.position() + blockText.size()) - start);
+    }
+    for (int i = 0; i < text.size(); ++i) {
+        if (text.at(i) == QChar::LineSeparator)
+            text[i] = QLatin1Char('\n');
+        else if (text.at(i) == QChar::Nbsp)
+            text[i] = QLatin1Char(' ');
+    }
+    return text;
+}
+}
+
+FindBar::FindBar(QTextEdit *editor, QPlainTextEdit *plainEditor, QWidget *parent) :
+    QWidget(parent),
+    editor(editor),
+    plainEditor(plainEditor),
+    plain(false),
+    search(new TextSearch(this)),
+    snapshotRevision(-1),
+    searchRevision(-1),
+    snapshotEdited(false),
+    hitsEdited(false),
+    pendingAction(NoAction)
+{
+    findEdit = new QLineEdit(this);
+    findEdit->setPlaceholderText(tr("Find"));
+    replaceEdit = new QLineEdit(this);
+    replaceEdit->setPlaceholderText(tr("Replace with"));
+    caseBox = new QCheckBox(tr("Match case"), this);
+    regexBox = new QCheckBox(tr("Regular expression"), this);
+    status = new QLabel(this);
+
+    QPushButton *nextButton = new QPushButton(tr("Next"), this);
+    QPushButton *previousButton = new QPushButton(tr("Previous"), this);
+    QPushButton *replaceButton = new QPushButton(tr("Replace"), this);
+    QPushButton *replaceAllButton = new QPushButton(tr("Replace All"), this);
+
+    replaceRow = new QWidget(this);
+    QHBoxLayout *replaceLayout = new QHBoxLayout(replaceRow);
+    replaceLayout->setContentsMargins(0, 0, 0, 0);
+    replaceLayout->addWidget(replaceEdit, 1);
+    replaceLayout->addWidget(replaceButton);
+    replaceLayout->addWidget(replaceAllButton);
+
+    QGridLayout *layout = new QGridLayout(this);
+    layout->setContentsMargins(4, 2, 4, 2);
+    layout->addWidget(findEdit, 0, 0);
+    layout->addWidget(previousButton, 0, 1);
+    layout->addWidget(nextButton, 0, 2);
+    layout->addWidget(caseBox, 0, 3);
+    layout->addWidget(regexBox, 0, 4);
+    layout->addWidget(status, 0, 5);
+    layout->addWidget(replaceRow, 1, 0, 1, 3);
+    layout->setColumnStretch(0, 1);
+
+    restartTimer.setSingleShot(true);
+    restartTimer.setInterval(kRestartMs);
+    connect(&restartTimer, &QTimer::timeout, this, &FindBar::restartSearch);
+    highlightTimer.setSingleShot(true);
+    highlightTimer.setInterval(kHighlightMs);
+    connect(&highlightTimer, &QTimer::timeout, this, &FindBar::updateHighlights);
+
+    connect(findEdit, &QLineEdit::textChanged, &restartTimer, static_cast<void (QTimer::*)()>(&QTimer::start));
+    connect(findEdit, &QLineEdit::returnPressed, this, &FindBar::findNext);
+    connect(replaceEdit, &QLineEdit::returnPressed, this, &FindBar::replace);
+    connect(caseBox, &QCheckBox::toggled, this, &FindBar::restartSearch);
+    connect(regexBox, &QCheckBox::toggled, this, &FindBar::restartSearch);
+    connect(nextButton, &QPushButton::clicked, this, &FindBar::findNext);
+    connect(previousButton, &QPushButton::clicked, this, &FindBar::findPrevious);
+    connect(replaceButton, &QPushButton::clicked, this, &FindBar::replace);
+    connect(replaceAllButton, &QPushButton::clicked, this, &FindBar::replaceAll);
+    foreach (QTextDocument *watched, QList<QTextDocument *>() << editor->document() << plainEditor->document()) {
+        connect(watched, &QTextDocument::contentsChange, this, [this, watched](int position, int removed, int added) {
+            if (isVisible() && watched == document())
+                documentChanged(position, removed, added);
+        });
+        connect(watched, &QTextDocument::contentsChanged, this, [this, watched]() {
+            if (isVisible() && watched == document())
+                documentEdited();
+        });
+    }
+    connect(search, &TextSearch::hitsFound, this, &FindBar::hitsFound);
+    connect(search, &TextSearch::finished, this, &FindBar::searchFinished);
+
+    hide();
+}
+
+void FindBar::showFind()
+{
+    open(false);
+}
+
+void FindBar::showReplace()
+{
+    open(true);
+}
+
+void FindBar::setPlainText(bool plain)
+{
+    if (plain == this->plain)
+        return;
+    hide();
+    this->plain = plain;
+    snapshot.clear();
+    snapshotRevision = -1;
+    searchRevision = -1;
+}
+
+QWidget *FindBar::currentEditor() const
+{
+    return plain ? static_cast<QWidget *>(plainEditor) : editor;
+}
+
+bool FindBar::isReadOnly() const
+{
+    return plain ? plainEditor->isReadOnly() : editor->isReadOnly();
+}
+
+QTextDocument *FindBar::document() const
+{
+    return plain ? plainEditor->document() : editor->document();
+}
+
+QTextCursor FindBar::textCursor() const
+{
+    return plain ? plainEditor->textCursor() : editor->textCursor();
+}
+
+void FindBar::setTextCursor(const QTextCursor &cursor)
+{
+    if (plain)
+        plainEditor->setTextCursor(cursor);
+    else
+        editor->setTextCursor(cursor);
+}
+
+void FindBar::setExtraSelections(const QList<QTextEdit::ExtraSelection> &selections)
+{
+    if (plain)
+        plainEditor->setExtraSelections(selections);
+    else
+        editor->setExtraSelections(selections);
+}
+
+void FindBar::open(bool withReplace)
+{
+    replaceRow->setVisible(withReplace);
+    const QTextCursor cursor = textCursor();
+    if (cursor.hasSelection() && !cursor.selectedText().contains(QChar::ParagraphSeparator))
+        findEdit->setText(cursor.selectedText());
+    show();
+    findEdit->setFocus();
+    findEdit->selectAll();
+    if (!isCurrent())
+        restartSearch();
+}
+
+bool FindBar::isCurrent() const
+{
+    return searchRevision >= 0 && searchRevision == document()->revision();
+}
+
+void FindBar::restartSearch()
+{
+    restartTimer.stop();
+    highlights.clear();
+    setExtraSelections(highlights);
+
+    TextSearch::Options options;
+    if (caseBox->isChecked())
+        options |= TextSearch::CaseSensitive;
+    if (regexBox->isChecked())
+        options |= TextSearch::RegularExpression;
+
+    // toPlainText() keeps every document position, paragraph and frame
+    // boundaries included.
+    if (snapshotRevision != document()->revision()) {
+        snapshot = document()->toPlainText();
+        snapshotRevision = document()->revision();
+    }
+    searchRevision = snapshotRevision;
+    if (!search->start(snapshot, findEdit->text(), options)) {
+        status->setText(search->errorString());
+        return;
+    }
+    showCount();
+}
+
+void FindBar::documentChanged(int position, int removed, int added)
+{
+    if (snapshotRevision < 0)
+        return;
+    // Both are still at the revision before this edit.
+    const bool inStep = searchRevision == snapshotRevision;
+    if (!editSnapshot(position, removed, added)) {
+        snapshot.clear();
+        snapshotRevision = -1;
+        searchRevision = -1;
+        hitsEdited = false;
+        return;
+    }
+    snapshotEdited = true;
+    hitsEdited = inStep && search->edit(snapshot, position, removed, added);
+    if (!hitsEdited)
+        searchRevision = -1;
+}
+
+void FindBar::documentEdited()
+{
+    if (snapshotEdited)
+        snapshotRevision = document()->revision();
+    else
+        snapshotRevision = -1;
+    if (hitsEdited) {
+        searchRevision = snapshotRevision;
+        highlights.clear();
+        if (!highlightTimer.isActive())
+            highlightTimer.start();
+    } else {
+        restartTimer.start();
+    }
+    snapshotEdited = false;
+    hitsEdited = false;
+}
+
+bool FindBar::editSnapshot(int position, int removed, int added)
+{
+    // The change reported for a whole document can run past its end.
+    const int length = document()->characterCount() - 1;
+    if (position < 0 || position + removed > snapshot.size()
+            || snapshot.size() - removed + added != length)
+        return false;
+    snapshot.replace(position, removed, plainText(document(), position, position + added));
+    return true;
+}
+
+void FindBar::hitsFound(int from, int count)
+{
+    Q_UNUSED(from);
+    Q_UNUSED(count);
+    if (!highlightTimer.isActive())
+        highlightTimer.start();
+    if (pendingAction == FindNext)
+        findNext();
+}
+
+void FindBar::searchFinished()
+{
+    updateHighlights();
+    runPending();
+}
+
+void FindBar::runPending()
+{
+    const PendingAction action = pendingAction;
+    pendingAction = NoAction;
+    switch (action) {
+    case FindNext:
+        findNext();
+        break;
+    case FindPrevious:
+        findPrevious();
+        break;
+    case ReplaceAll:
+        replaceAll();
+        break;
+    case NoAction:
+        break;
+    }
+}
+
+void FindBar::updateHighlights()
+{
+    const QVector<SearchHit> &hits = search->hits();
+    QTextCharFormat format;
+    format.setBackground(QColor(255, 230, 100));
+    for (int i = highlights.size(); i < qMin(hits.size(), kMaxHighlights); ++i) {
+        QTextEdit::ExtraSelection selection;
+        selection.cursor = QTextCursor(document());
+        selection.cursor.setPosition(hits.at(i).position);
+        selection.cursor.setPosition(hits.at(i).position + hits.at(i).length, QTextCursor::KeepAnchor);
+        selection.format = format;
+        highlights.append(selection);
+    }
+    setExtraSelections(highlights);
+    showCount();
+}
+
+void FindBar::showCount()
+{
+    const int count = search->hits().size();
+    if (search->isRunning())
+        status->setText(tr("%1 matches so far...").arg(count));
+    else if (findEdit->text().isEmpty())
+        status->clear();
+    else
+        status->setText(count == 1 ? tr("1 match") : tr("%1 matches").arg(count));
+}
+
+void FindBar::select(int index)
+{
+    const SearchHit &hit = search->hits().at(index);
+    QTextCursor cursor(document());
+    cursor.setPosition(hit.position);
+    cursor.setPosition(hit.position + hit.length, QTextCursor::KeepAnchor);
+    setTextCursor(cursor);
+}
+
+void FindBar::findNext()
+{
+    pendingAction = NoAction;
+    if (!isVisible())
+        showFind();
+    if (searchRevision != document()->revision())
+        restartSearch();
+
+    const QVector<SearchHit> &hits = search->hits();
+    const int from = textCursor().selectionEnd();
+    int lo = 0;
+    int hi = hits.size();
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+        if (hits.at(mid).position < from)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < hits.size())
+        select(lo);
+    else if (search->isRunning())
+        pendingAction = FindNext; // try again when more hits are in
+    else if (!hits.isEmpty())
+        select(0);
+}
+
+void FindBar::findPrevious()
+{
+    pendingAction = NoAction;
+    if (!isVisible())
+        showFind();
+    if (searchRevision != document()->revision())
+        restartSearch();
+    // Going backwards needs every hit; try again when they are all in.
+    if (search->isRunning()) {
+        pendingAction = FindPrevious;
+        return;
+    }
+
+    const QVector<SearchHit> &hits = search->hits();
+    if (hits.isEmpty())
+        return;
+    const int to = textCursor().selectionStart();
+    int lo = 0;
+    int hi = hits.size();
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+        if (hits.at(mid).position + hits.at(mid).length <= to)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    select(lo > 0 ? lo - 1 : hits.size() - 1);
+}
+
+void FindBar::replace()
+{
+    if (isReadOnly())
+        return;
+    // Replace the selection if it is a hit, then move on to the next one.
+    const QTextCursor selection = textCursor();
+    if (searchRevision == document()->revision() && selection.hasSelection()) {
+        const QVector<SearchHit> &hits = search->hits();
+        foreach (const SearchHit &hit, hits) {
+            if (hit.position == selection.selectionStart() && hit.length == selection.selectionEnd() - hit.position) {
+                QTextCursor cursor = selection;
+                cursor.insertText(search->replacement(hit, replaceEdit->text()));
+                setTextCursor(cursor);
+                break;
+            }
+            if (hit.position > selection.selectionStart())
+                break;
+        }
+    }
+    findNext();
+}
+
+void FindBar::replaceAll()
+{
+    pendingAction = NoAction;
+    if (isReadOnly())
+        return;
+    if (searchRevision != document()->revision())
+        restartSearch();
+    if (search->isRunning()) {
+        pendingAction = ReplaceAll;
+        return;
+    }
+    const QVector<SearchHit> hits = search->hits();
+    if (hits.isEmpty())
+        return;
+
+    // Hits are replaced back to front so the positions of the ones still
+    // to go stay valid. A single edit block is one undo step and one
+    // layout pass.
+    highlights.clear();
+    setExtraSelections(highlights);
+    QTextCursor cursor(document());
+    cursor.beginEditBlock();
+    for (int i = hits.size() - 1; i >= 0; --i) {
+        const SearchHit &hit = hits.at(i);
+        cursor.setPosition(hit.position);
+        cursor.setPosition(hit.position + hit.length, QTextCursor::KeepAnchor);
+        cursor.insertText(search->replacement(hit, replaceEdit->text()));
+    }
+    cursor.endEditBlock();
+    status->setText(hits.size() == 1 ? tr("Replaced 1 match") : tr("Replaced %1 matches").arg(hits.size()));
+}
+
+void FindBar::keyPressEvent(QKeyEvent *e)
+{
+    if (e->key() == Qt::Key_Escape) {
+        hide();
+        currentEditor()->setFocus();
+        return;
+    }
+    QWidget::keyPressEvent(e);
+}
+
+void FindBar::hideEvent(QHideEvent *e)
+{
+    search->cancel();
+    pendingAction = NoAction;
+    restartTimer.stop();
+    highlightTimer.stop();
+    highlights.clear();
+    setExtraSelections(highlights);
+    snapshot.clear();
+    snapshotRevision = -1;
+    searchRevision = -1;
+    snapshotEdited = false;
+    hitsEdited = false;
+    QWidget::hideEvent(e);
+}
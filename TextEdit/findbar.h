@@ -0,0 +1,95 @@
+#ifndef FINDBAR_H
+#define FINDBAR_H
+
+#include <QWidget>
+#include <QTextEdit>
+#include <QTimer>
+
+QT_BEGIN_NAMESPACE
+class QCheckBox;
+class QLabel;
+class QLineEdit;
+class QPlainTextEdit;
+QT_END_NAMESPACE
+
+class TextSearch;
+
+// Find and replace bar below the editor. Searching runs in the background
+// on a snapshot of the document and is started again shortly after the
+// pattern changes; hits are highlighted as they come in. Edits are patched
+// into the snapshot, and the hits around a small edit are found again in
+// place rather than by searching the whole document.
+class FindBar : public QWidget
+{
+    Q_OBJECT
+public:
+    FindBar(QTextEdit *editor, QPlainTextEdit *plainEditor, QWidget *parent = 0);
+
+    void showFind();
+    void showReplace();
+    // Searches the plain text editor instead of the rich text one.
+    void setPlainText(bool plain);
+
+public slots:
+    void findNext();
+    void findPrevious();
+    void replace();
+    void replaceAll();
+
+protected:
+    void keyPressEvent(QKeyEvent *e) Q_DECL_OVERRIDE;
+    void hideEvent(QHideEvent *e) Q_DECL_OVERRIDE;
+
+private slots:
+    void restartSearch();
+    void hitsFound(int from, int count);
+    void searchFinished();
+    void updateHighlights();
+
+private:
+    // Actions that wait for hits the search has not found yet.
+    enum PendingAction {
+        NoAction,
+        FindNext,
+        FindPrevious,
+        ReplaceAll
+    };
+
+    void open(bool withReplace);
+    void runPending();
+    QWidget *currentEditor() const;
+    bool isReadOnly() const;
+    QTextDocument *document() const;
+    QTextCursor textCursor() const;
+    void setTextCursor(const QTextCursor &cursor);
+    void setExtraSelections(const QList<QTextEdit::ExtraSelection> &selections);
+    bool isCurrent() const;
+    void select(int index);
+    void showCount();
+    void documentChanged(int position, int removed, int added);
+    void documentEdited();
+    bool editSnapshot(int position, int removed, int added);
+
+    QTextEdit *editor;
+    QPlainTextEdit *plainEditor;
+    bool plain;
+    TextSearch *search;
+    QLineEdit *findEdit;
+    QLineEdit *replaceEdit;
+    QWidget *replaceRow;
+    QCheckBox *caseBox;
+    QCheckBox *regexBox;
+    QLabel *status;
+    QTimer restartTimer;
+    QTimer highlightTimer;
+    QList<QTextEdit::ExtraSelection> highlights;
+    // The document as toPlainText() has it, at snapshotRevision.
+    QString snapshot;
+    int snapshotRevision;
+    int searchRevision;
+    bool snapshotEdited;
+    bool hitsEdited;
+    PendingAction pendingAction;
+};
+
+#endif // FINDBAR_H
@@ -0,0 +1,62 @@
+#include "formatbatcher.h"
+#include "perflog.h"
+#include <QElapsedTimer>
+#include <QTextCursor>
+#include <QTextEdit>
+
+FormatBatcher::FormatBatcher(QTextEdit *editor, QObject *parent) :
+    QObject(parent),
+    editor(editor),
+    anchor(-1),
+    position(-1),
+    operations(0)
+{
+    timer.setSingleShot(true);
+    timer.setInterval(0);
+    connect(&timer, &QTimer::timeout, this, &FormatBatcher::flush);
+}
+
+void FormatBatcher::merge(const QTextCharFormat &format)
+{
+    // Changes queued for another selection go out first.
+    const QTextCursor cursor = editor->textCursor();
+    if (operations > 0 && (cursor.anchor() != anchor || cursor.position() != position))
+        flush();
+
+    anchor = cursor.anchor();
+    position = cursor.position();
+    pending.merge(format);
+    ++operations;
+    timer.start();
+}
+
+void FormatBatcher::flush()
+{
+    timer.stop();
+    if (operations == 0)
+        return;
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    QTextCursor cursor = editor->textCursor();
+    const bool selection = cursor.hasSelection();
+    if (!selection)
+        cursor.select(QTextCursor::WordUnderCursor);
+    cursor.beginEditBlock();
+    cursor.mergeCharFormat(pending);
+    cursor.endEditBlock();
+
+    // With a selection the merge above already covers what
+    // mergeCurrentCharFormat() would do a second time; without one it
+    // only sets the format for typing.
+    if (selection)
+        editor->setTextCursor(editor->textCursor());
+    else
+        editor->mergeCurrentCharFormat(pending);
+
+    qCDebug(lcPerf) << "merged" << operations << "format changes into"
+                    << cursor.selectionEnd() - cursor.selectionStart() << "characters in"
+                    << elapsed.elapsed() << "ms";
+    pending = QTextCharFormat();
+    operations = 0;
+}
@@ -0,0 +1,35 @@
+#ifndef FORMATBATCHER_H
+#define FORMATBATCHER_H
+
+#include <QObject>
+#include <QTextCharFormat>
+#include <QTimer>
+
+QT_BEGIN_NAMESPACE
+class QTextEdit;
+QT_END_NAMESPACE
+
+// Collects character format changes made to the same selection within one
+// pass through the event loop and applies them together, as one edit
+// block, one undo step and one relayout of the selected range.
+class FormatBatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FormatBatcher(QTextEdit *editor, QObject *parent = 0);
+
+    void merge(const QTextCharFormat &format);
+
+public slots:
+    void flush();
+
+private:
+    QTextEdit *editor;
+    QTextCharFormat pending;
+    int anchor;
+    int position;
+    int operations;
+    QTimer timer;
+};
+
+#endif // FORMATBATCHER_H
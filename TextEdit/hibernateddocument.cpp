@@ -0,0 +1,12 @@
+#include "hibernateddocument.h"
+
+void HibernatedDocument::pack(const QString &text)
+{
+    // Fast compression; text and markup shrink well even at level 1.
+    data = text.isEmpty() ? QByteArray() : qCompress(text.toUtf8(), 1);
+}
+
+QString HibernatedDocument::unpack() const
+{
+    return data.isEmpty() ? QString() : QString::fromUtf8(qUncompress(data));
+}
@@ -0,0 +1,31 @@
+#ifndef HIBERNATEDDOCUMENT_H
+#define HIBERNATEDDOCUMENT_H
+
+#include <QByteArray>
+#include <QString>
+#include "editjournal.h"
+
+// A document whose tab is not active. Only its compressed text is kept,
+// without a QTextDocument, layouts or undo history; it is loaded into the
+// editor again when its tab is activated.
+struct HibernatedDocument
+{
+    HibernatedDocument() : mode(0), modified(false), cursorPosition(0), scrollPosition(0) {}
+
+    QString fileName;
+    // TextEdit::EditorMode the document was shown in.
+    int mode;
+    bool modified;
+    // HTML for rich text, plain text for piece tables; empty for files in
+    // the mapped viewer, which are mapped again.
+    QByteArray data;
+    int cursorPosition;
+    int scrollPosition;
+    // Crash recovery files of unsaved changes.
+    JournalSession journal;
+
+    void pack(const QString &text);
+    QString unpack() const;
+};
+
+#endif // HIBERNATEDDOCUMENT_H
@@ -0,0 +1,245 @@
+#include "htmlstreamimporter.h"
+#include "perflog.h"
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <QTextFrame>
+
+namespace {
+// Sizes are in characters of HTML. The first segment is kept small so the
+// first screen shows up before the rest is parsed.
+const int kFirstSegment = 16 * 1024;
+const int kSegment = 64 * 1024;
+
+bool isBlockTag(const QString &name)
+{
+    static const QStringList tags = QStringList()
+            << "p" << "h1" << "h2" << "h3" << "h4" << "h5" << "h6" << "table" << "ul" << "ol"
+            << "dl" << "blockquote" << "div" << "pre" << "hr" << "center" << "address";
+    return tags.contains(name);
+}
+
+// Block tags that may contain other blocks.
+bool isContainerTag(const QString &name)
+{
+    static const QStringList tags = QStringList()
+            << "table" << "ul" << "ol" << "dl" << "blockquote" << "div" << "pre" << "center";
+    return tags.contains(name);
+}
+
+// Containers without margins or numbering of their own, which look the
+// same when closed at a cut and opened again after it.
+bool isSplittableTag(const QString &name)
+{
+    return name == QLatin1String("div") || name == QLatin1String("center");
+}
+}
+
+HtmlStreamImporter::HtmlStreamImporter(const QString &styleSheet) :
+    styleSheet(styleSheet),
+    scanPos(0),
+    segmentStart(0),
+    headEnd(0),
+    segments(0),
+    inBody(false),
+    bodyEnded(false),
+    reportedUnsplittable(false)
+{
+}
+
+void HtmlStreamImporter::append(const QString &html)
+{
+    if (bodyEnded)
+        return;
+    buffer += html;
+    scan();
+
+    // The head is still needed in the buffer until the body starts.
+    if (inBody && segmentStart > 0) {
+        buffer.remove(0, segmentStart);
+        scanPos -= segmentStart;
+        segmentStart = 0;
+    }
+}
+
+void HtmlStreamImporter::finish()
+{
+    if (!inBody) {
+        // No block tags at all; parse the input as it is.
+        if (!buffer.isEmpty())
+            ready << buffer;
+    } else if (!bodyEnded) {
+        cut(buffer.size());
+    }
+    buffer.clear();
+    bodyEnded = true;
+}
+
+void HtmlStreamImporter::scan()
+{
+    while (!bodyEnded) {
+        const int open = buffer.indexOf(QLatin1Char('<'), scanPos);
+        if (open < 0) {
+            scanPos = buffer.size();
+            return;
+        }
+        if (buffer.midRef(open, 4) == QLatin1String("<!--")) {
+            const int close = buffer.indexOf(QLatin1String("-->"), open + 4);
+            if (close < 0) {
+                scanPos = open;
+                return;
+            }
+            scanPos = close + 3;
+            continue;
+        }
+        const int close = buffer.indexOf(QLatin1Char('>'), open);
+        if (close < 0) {
+            scanPos = open;
+            return;
+        }
+
+        int i = open + 1;
+        const bool closing = i < close && buffer.at(i) == QLatin1Char('/');
+        if (closing)
+            ++i;
+        const int nameStart = i;
+        while (i < close && buffer.at(i).isLetterOrNumber())
+            ++i;
+        const QString name = buffer.mid(nameStart, i - nameStart).toLower();
+        scanPos = close + 1;
+        if (name.isEmpty())
+            continue;
+
+        if (!closing && (name == QLatin1String("style") || name == QLatin1String("script"))) {
+            const int end = buffer.indexOf(QLatin1String("</") + name, scanPos, Qt::CaseInsensitive);
+            if (end < 0) {
+                scanPos = open;
+                return;
+            }
+            scanPos = end;
+            continue;
+        }
+
+        if (!inBody) {
+            if (closing && name == QLatin1String("head")) {
+                headEnd = scanPos;
+                continue;
+            }
+            if (!closing && name == QLatin1String("body")) {
+                head = buffer.left(open);
+                bodyTag = buffer.mid(open, scanPos - open);
+                segmentStart = scanPos;
+                inBody = true;
+                continue;
+            }
+            if (closing || !isBlockTag(name))
+                continue;
+            // A fragment without a body tag starts with its first block.
+            head = buffer.left(headEnd);
+            bodyTag = QLatin1String("<body>");
+            segmentStart = headEnd;
+            inBody = true;
+        }
+
+        if (closing && (name == QLatin1String("body") || name == QLatin1String("html"))) {
+            cut(open);
+            bodyEnded = true;
+            return;
+        }
+        if (!isBlockTag(name))
+            continue;
+        if (!closing && open - segmentStart >= (segments == 0 ? kFirstSegment : kSegment)) {
+            int blocking = 0;
+            while (blocking < openNames.size() && isSplittableTag(openNames.at(blocking)))
+                ++blocking;
+            if (blocking == openNames.size()) {
+                cut(open);
+            } else if (!reportedUnsplittable) {
+                qCDebug(lcPerf) << "cannot cut HTML inside" << openNames.at(blocking)
+                                << "- parsing it in one piece";
+                reportedUnsplittable = true;
+            }
+        }
+        if (!isContainerTag(name))
+            continue;
+        if (!closing) {
+            openNames << name;
+            openTags << buffer.mid(open, scanPos - open);
+        } else if (openNames.contains(name)) {
+            // Unclosed containers inside it end with it, as in the parser.
+            const int index = openNames.lastIndexOf(name);
+            openNames.erase(openNames.begin() + index, openNames.end());
+            openTags.erase(openTags.begin() + index, openTags.end());
+        }
+    }
+}
+
+void HtmlStreamImporter::cut(int end)
+{
+    if (end > segmentStart) {
+        // Containers open at the cut are closed here and reopened in the
+        // next segment.
+        QString html = reopen + buffer.mid(segmentStart, end - segmentStart);
+        for (int i = openNames.size() - 1; i >= 0; --i)
+            html += QLatin1String("</") + openNames.at(i) + QLatin1Char('>');
+        ready << html;
+        reopen = openTags.join(QString());
+    }
+    segmentStart = end;
+    ++segments;
+}
+
+bool HtmlStreamImporter::hasSegment() const
+{
+    return !ready.isEmpty();
+}
+
+HtmlSegment HtmlStreamImporter::takeSegment()
+{
+    QString html = ready.takeFirst();
+    if (!bodyTag.isEmpty())
+        html = head + bodyTag + html + QLatin1String("</body></html>");
+
+    QTextDocument document;
+    document.setDefaultStyleSheet(styleSheet);
+    document.setHtml(html);
+
+    HtmlSegment segment;
+    const QTextBlock first = document.begin();
+    segment.blockFormat = first.blockFormat();
+    segment.charFormat = first.charFormat();
+    // Documents starting with a table have an empty block in front of it.
+    QTextCursor cursor(&document);
+    cursor.movePosition(QTextCursor::NextBlock);
+    segment.startsWithFrame = first.length() == 1 && cursor.currentFrame() != document.rootFrame();
+    segment.rootFrameFormat = document.rootFrame()->frameFormat();
+    segment.title = document.metaInformation(QTextDocument::DocumentTitle);
+    cursor.select(QTextCursor::Document);
+    segment.fragment = QTextDocumentFragment(cursor);
+    return segment;
+}
+
+void HtmlStreamImporter::insert(QTextCursor &cursor, const HtmlSegment &segment)
+{
+    if (!segment.startsWithFrame) {
+        // The empty block at the start of the document or after a table is
+        // where setHtml() would have put the next block, too.
+        const QTextBlock block = cursor.block();
+        const QTextBlock previous = block.previous();
+        if (block.length() == 1 && (!previous.isValid()
+                                    || QTextCursor(previous).currentFrame() != cursor.currentFrame())) {
+            cursor.setBlockFormat(segment.blockFormat);
+            cursor.setBlockCharFormat(segment.charFormat);
+        } else {
+            cursor.insertBlock(segment.blockFormat, segment.charFormat);
+        }
+    }
+    cursor.insertFragment(segment.fragment);
+}
+
+void HtmlStreamImporter::setDocumentFormat(QTextDocument *document, const HtmlSegment &segment)
+{
+    // Fragments carry neither, so inserting them leaves both unset.
+    document->rootFrame()->setFrameFormat(segment.rootFrameFormat);
+    document->setMetaInformation(QTextDocument::DocumentTitle, segment.title);
+}
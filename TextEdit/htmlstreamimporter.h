@@ -0,0 +1,77 @@
+#ifndef HTMLSTREAMIMPORTER_H
+#define HTMLSTREAMIMPORTER_H
+
+#include <QStringList>
+#include <QTextDocumentFragment>
+#include <QTextFormat>
+
+QT_BEGIN_NAMESPACE
+class QTextCursor;
+class QTextDocument;
+QT_END_NAMESPACE
+
+// A parsed run of top-level blocks, ready to be appended to a document.
+struct HtmlSegment
+{
+    HtmlSegment() : startsWithFrame(false) {}
+
+    QTextDocumentFragment fragment;
+    // Inserting a fragment merges its first block into the block at the
+    // cursor, so the format of that block is carried separately.
+    QTextBlockFormat blockFormat;
+    QTextCharFormat charFormat;
+    // What setHtml() puts outside the blocks: the body attributes and the
+    // title.
+    QTextFrameFormat rootFrameFormat;
+    QString title;
+    bool startsWithFrame;
+};
+
+// Cuts HTML into segments at top-level block tags as it arrives and parses
+// each segment on its own, with the head and body attributes of the whole
+// document, so the result matches what QTextDocument::setHtml builds.
+// Parsing does not touch the target document and can run on any thread.
+//
+// Segments are only cut between top-level blocks, or inside divs, which
+// are reopened in the next segment. A document that is a single table or
+// list is parsed in one piece.
+class HtmlStreamImporter
+{
+public:
+    explicit HtmlStreamImporter(const QString &styleSheet = QString());
+
+    void append(const QString &html);
+    // Makes the rest of the input available as the last segment.
+    void finish();
+
+    bool hasSegment() const;
+    HtmlSegment takeSegment();
+
+    static void insert(QTextCursor &cursor, const HtmlSegment &segment);
+    // Sets what a whole document loaded from the segments takes from the
+    // first one.
+    static void setDocumentFormat(QTextDocument *document, const HtmlSegment &segment);
+
+private:
+    void scan();
+    void cut(int end);
+
+    QString styleSheet;
+    QString buffer;
+    QStringList ready;
+    QString head;
+    QString bodyTag;
+    // Containers the scan is inside of, with their opening tags.
+    QStringList openNames;
+    QStringList openTags;
+    QString reopen;
+    int scanPos;
+    int segmentStart;
+    int headEnd;
+    int segments;
+    bool inBody;
+    bool bodyEnded;
+    bool reportedUnsplittable;
+};
+
+#endif // HTMLSTREAMIMPORTER_H
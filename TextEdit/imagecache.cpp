@@ -0,0 +1,101 @@
+#include "imagecache.h"
+#include "perflog.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QImageReader>
+#include <QPointer>
+#include <QtConcurrent>
+
+namespace {
+const int kDefaultMaxKB = 64 * 1024;
+}
+
+ImageCache::ImageCache(QObject *parent) :
+    QObject(parent),
+    cache(kDefaultMaxKB)
+{
+}
+
+ImageCache *ImageCache::instance()
+{
+    // Owned by the application so pending decodes end with it.
+    static QPointer<ImageCache> cache;
+    if (!cache)
+        cache = new ImageCache(QCoreApplication::instance());
+    return cache;
+}
+
+void ImageCache::setMaxBytes(qint64 bytes)
+{
+    cache.setMaxCost(int(qMin<qint64>(bytes / 1024, INT_MAX)));
+}
+
+qint64 ImageCache::maxBytes() const
+{
+    return qint64(cache.maxCost()) * 1024;
+}
+
+qint64 ImageCache::totalBytes() const
+{
+    return qint64(cache.totalCost()) * 1024;
+}
+
+QString ImageCache::key(const QString &path, const QSize &size)
+{
+    return QStringLiteral("%1@%2x%3").arg(path).arg(size.width()).arg(size.height());
+}
+
+QPixmap ImageCache::find(const QString &key)
+{
+    // Looking an image up makes it the most recently used one. The
+    // pixmap is shared, not copied.
+    const QPixmap *pixmap = cache.object(key);
+    return pixmap ? *pixmap : QPixmap();
+}
+
+void ImageCache::request(const QString &path, const QSize &size, qreal ratio)
+{
+    const QString k = key(path, size);
+    if (pending.contains(k))
+        return;
+    pending.insert(k);
+    QFutureWatcher<QImage> *watcher = new QFutureWatcher<QImage>(this);
+    connect(watcher, &QFutureWatcher<QImage>::finished, this, [this, watcher, k, ratio]() {
+        watcher->deleteLater();
+        pending.remove(k);
+        const QImage image = watcher->result();
+        if (image.isNull())
+            return;
+        // Converted once; the decoded image is not kept besides.
+        QPixmap *pixmap = new QPixmap(QPixmap::fromImage(image));
+        pixmap->setDevicePixelRatio(ratio);
+        const qint64 bytes = qint64(pixmap->width()) * pixmap->height() * pixmap->depth() / 8;
+        if (!cache.insert(k, pixmap, int(qMax<qint64>(1, bytes / 1024)))) {
+            // Documents keep showing the placeholder rather than asking
+            // for it again.
+            qCWarning(lcPerf) << "image" << k << "is larger than the whole image cache";
+            return;
+        }
+        emit decoded(k);
+    });
+    watcher->setFuture(QtConcurrent::run(&ImageCache::decode, path, size));
+}
+
+QImage ImageCache::decode(const QString &path, const QSize &size)
+{
+    QElapsedTimer timer;
+    timer.start();
+    QImageReader reader(path);
+    const QSize natural = reader.size();
+    // Readers that support it, such as JPEG, decode straight to the
+    // smaller size.
+    if (size.isValid() && natural.isValid() && size != natural)
+        reader.setScaledSize(size);
+    QImage image = reader.read();
+    if (!image.isNull() && size.isValid() && image.size() != size)
+        image = image.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    qCDebug(lcPerf) << "decoded" << path << "from" << natural << "to" << image.size()
+                    << "in" << timer.elapsed() << "ms";
+    return image;
+}
@@ -0,0 +1,46 @@
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+#include <QObject>
+#include <QCache>
+#include <QImage>
+#include <QPixmap>
+#include <QSet>
+#include <QSize>
+
+// Decodes images on the thread pool at the size they are shown at and
+// keeps the results in a memory-bounded LRU cache that all documents
+// share. The cache is the only owner of the decoded pixels: documents
+// look their images up by key whenever they paint them, and request them
+// again once they have been evicted. Lives in the GUI thread.
+class ImageCache : public QObject
+{
+    Q_OBJECT
+public:
+    static ImageCache *instance();
+
+    void setMaxBytes(qint64 bytes);
+    qint64 maxBytes() const;
+    qint64 totalBytes() const;
+
+    static QString key(const QString &path, const QSize &size);
+    // Returns a null pixmap if \a key is not cached.
+    QPixmap find(const QString &key);
+    // Starts decoding \a path scaled to \a size, unless that is already
+    // under way; decoded() follows. The pixmap gets \a ratio as its
+    // device pixel ratio, so that it is never copied to set one.
+    void request(const QString &path, const QSize &size, qreal ratio = 1);
+
+signals:
+    void decoded(const QString &key);
+
+private:
+    explicit ImageCache(QObject *parent = 0);
+    static QImage decode(const QString &path, const QSize &size);
+
+    // Costs are in kilobytes, QCache counts in int.
+    QCache<QString, QPixmap> cache;
+    QSet<QString> pending;
+};
+
+#endif // IMAGECACHE_H
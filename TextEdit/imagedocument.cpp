@@ -0,0 +1,158 @@
+#include "imagedocument.h"
+#include "imagecache.h"
+#include <QAbstractTextDocumentLayout>
+#include <QDir>
+#include <QGuiApplication>
+#include <QImageReader>
+#include <QPixmap>
+#include <QTextFormat>
+#include <QTimer>
+
+namespace {
+const QRgb kPlaceholderColor = 0xffe8e8e8;
+
+qint64 pixmapBytes(const QPixmap &pixmap)
+{
+    return qint64(pixmap.width()) * pixmap.height() * pixmap.depth() / 8;
+}
+}
+
+ImageDocument::ImageDocument(QObject *parent) :
+    QTextDocument(parent),
+    placeholderBytes(0),
+    repaintQueued(false)
+{
+    connect(ImageCache::instance(), &ImageCache::decoded, this, &ImageDocument::imageDecoded);
+    connect(this, &QTextDocument::baseUrlChanged, this, &ImageDocument::updateDocumentUrl);
+}
+
+qint64 ImageDocument::imageBytes() const
+{
+    return placeholderBytes;
+}
+
+void ImageDocument::releaseImages()
+{
+    images.clear();
+    waiting.clear();
+    placeholders.clear();
+    placeholderBytes = 0;
+}
+
+void ImageDocument::clear()
+{
+    QTextDocument::clear();
+    releaseImages();
+}
+
+void ImageDocument::updateDocumentUrl(const QUrl &url)
+{
+    // Clones do not copy the base URL, but resolve relative image names
+    // against the document URL, which they do copy.
+    setMetaInformation(DocumentUrl, url.toString());
+}
+
+QPixmap ImageDocument::placeholder(const QUrl &name, const QSize &size)
+{
+    QPixmap &pixmap = placeholders[name];
+    if (pixmap.size() != size) {
+        placeholderBytes -= pixmapBytes(pixmap);
+        pixmap = QPixmap(size);
+        pixmap.fill(QColor::fromRgba(kPlaceholderColor));
+        placeholderBytes += pixmapBytes(pixmap);
+    }
+    return pixmap;
+}
+
+QString ImageDocument::localPath(const QUrl &name) const
+{
+    if (name.scheme() == QLatin1String("qrc"))
+        return QLatin1Char(':') + name.path();
+    if (name.toString().startsWith(QLatin1String(":/")))
+        return name.toString();
+    QUrl url = name;
+    if (url.isRelative()) {
+        const QUrl base = baseUrl().isEmpty() ? QUrl::fromLocalFile(QDir::currentPath() + QLatin1Char('/')) : baseUrl();
+        url = base.resolved(name);
+    }
+    return url.isLocalFile() ? url.toLocalFile() : QString();
+}
+
+QSize ImageDocument::shownSize(const QUrl &name, const QSize &natural) const
+{
+    // The largest size any image format using this image asks for; a
+    // missing side keeps the aspect ratio, as QTextImageHandler does.
+    QSize shown;
+    const QString text = name.toString();
+    foreach (const QTextFormat &format, allFormats()) {
+        if (!format.isImageFormat())
+            continue;
+        const QTextImageFormat image = format.toImageFormat();
+        if (image.name() != text)
+            continue;
+        QSizeF size(natural);
+        const bool hasWidth = image.hasProperty(QTextFormat::ImageWidth);
+        const bool hasHeight = image.hasProperty(QTextFormat::ImageHeight);
+        if (hasWidth && hasHeight)
+            size = QSizeF(image.width(), image.height());
+        else if (hasWidth && natural.width() > 0)
+            size = QSizeF(image.width(), image.width() * natural.height() / natural.width());
+        else if (hasHeight && natural.height() > 0)
+            size = QSizeF(image.height() * natural.width() / natural.height(), image.height());
+        shown = shown.expandedTo(size.toSize());
+    }
+    return shown.isEmpty() ? natural : shown;
+}
+
+QVariant ImageDocument::loadResource(int type, const QUrl &name)
+{
+    if (type != ImageResource)
+        return QTextDocument::loadResource(type, name);
+    QHash<QUrl, ShownImage>::const_iterator it = images.constFind(name);
+    if (it == images.constEnd()) {
+        const QString path = localPath(name);
+        const QSize natural = path.isEmpty() ? QSize() : QImageReader(path).size();
+        if (!natural.isValid())
+            return QTextDocument::loadResource(type, name);
+
+        // Only the header has been read so far. Images are decoded at the
+        // size they are shown at, in device pixels, but never enlarged.
+        ShownImage image;
+        image.path = path;
+        image.shown = shownSize(name, natural);
+        image.decoded = (QSizeF(image.shown) * qGuiApp->devicePixelRatio()).toSize().boundedTo(natural);
+        image.key = ImageCache::key(path, image.decoded);
+        it = images.insert(name, image);
+    }
+
+    const ShownImage &image = it.value();
+    const QPixmap cached = ImageCache::instance()->find(image.key);
+    if (!cached.isNull())
+        return cached;
+    // Not decoded yet, or evicted since.
+    if (!waiting.contains(image.key, name)) {
+        waiting.insert(image.key, name);
+        ImageCache::instance()->request(image.path, image.decoded,
+                                        qreal(image.decoded.width()) / qMax(1, image.shown.width()));
+    }
+    return placeholder(name, image.shown);
+}
+
+void ImageDocument::imageDecoded(const QString &key)
+{
+    const QList<QUrl> names = waiting.values(key);
+    if (names.isEmpty())
+        return;
+    waiting.remove(key);
+    foreach (const QUrl &name, names)
+        placeholderBytes -= pixmapBytes(placeholders.take(name));
+    // The placeholders had the same size, so a repaint is enough; images
+    // decoded together are painted together.
+    if (repaintQueued)
+        return;
+    repaintQueued = true;
+    QTimer::singleShot(0, this, [this]() {
+        repaintQueued = false;
+        emit documentLayout()->update();
+    });
+}
@@ -0,0 +1,60 @@
+#ifndef IMAGEDOCUMENT_H
+#define IMAGEDOCUMENT_H
+
+#include <QHash>
+#include <QMultiHash>
+#include <QPixmap>
+#include <QTextDocument>
+#include <QUrl>
+
+// A document that does not decode images on the GUI thread. Local images
+// are shown as placeholders of the right size first and decoded by
+// ImageCache at the size the document shows them at, then swapped in.
+//
+// The document only remembers which cache entry each image is shown from;
+// the pixels stay with the cache, which may evict them, and are decoded
+// again when next painted. Nothing is added as a resource, so clones made
+// for saving, printing and export load the originals by name.
+class ImageDocument : public QTextDocument
+{
+    Q_OBJECT
+public:
+    explicit ImageDocument(QObject *parent = 0);
+
+    // Bytes of the placeholders shown; decoded images belong to the cache.
+    qint64 imageBytes() const;
+    // Forgets the images shown; those still in the document are looked up
+    // again when painted.
+    void releaseImages();
+
+    void clear() Q_DECL_OVERRIDE;
+
+protected:
+    QVariant loadResource(int type, const QUrl &name) Q_DECL_OVERRIDE;
+
+private slots:
+    void imageDecoded(const QString &key);
+    void updateDocumentUrl(const QUrl &url);
+
+private:
+    // Where an image is decoded from, and at which size it is shown.
+    struct ShownImage
+    {
+        QString key;
+        QString path;
+        QSize decoded;
+        QSize shown;
+    };
+
+    QString localPath(const QUrl &name) const;
+    QSize shownSize(const QUrl &name, const QSize &natural) const;
+    QPixmap placeholder(const QUrl &name, const QSize &size);
+
+    QHash<QUrl, ShownImage> images;
+    QMultiHash<QString, QUrl> waiting;
+    QHash<QUrl, QPixmap> placeholders;
+    qint64 placeholderBytes;
+    bool repaintQueued;
+};
+
+#endif // IMAGEDOCUMENT_H
@@ -0,0 +1,99 @@
+#include "largefileview.h"
+#include "mappedfile.h"
+#include <QFontDatabase>
+#include <QPainter>
+#include <QScrollBar>
+#include <climits>
+
+LargeFileView::LargeFileView(QWidget *parent) :
+    QAbstractScrollArea(parent),
+    mapped(new MappedFile(this)),
+    widestLine(0)
+{
+    setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    viewport()->setBackgroundRole(QPalette::Base);
+    viewport()->setAutoFillBackground(true);
+
+    connect(mapped, &MappedFile::indexProgress, this, [this](qint64 lines, qint64 bytes) {
+        updateScrollBars();
+        viewport()->update();
+        emit indexProgress(lines, bytes);
+    });
+    connect(mapped, &MappedFile::indexFinished, this, &LargeFileView::indexFinished);
+}
+
+LargeFileView::~LargeFileView()
+{
+}
+
+bool LargeFileView::openFile(const QString &fileName)
+{
+    widestLine = 0;
+    verticalScrollBar()->setValue(0);
+    horizontalScrollBar()->setValue(0);
+    const bool ok = mapped->open(fileName);
+    updateScrollBars();
+    viewport()->update();
+    return ok;
+}
+
+void LargeFileView::closeFile()
+{
+    mapped->close();
+    updateScrollBars();
+    viewport()->update();
+}
+
+MappedFile *LargeFileView::file() const
+{
+    return mapped;
+}
+
+int LargeFileView::visibleLines() const
+{
+    return qMax(1, viewport()->height() / fontMetrics().lineSpacing());
+}
+
+void LargeFileView::updateScrollBars()
+{
+    const qint64 lines = mapped->lineCount();
+    const int page = visibleLines();
+    verticalScrollBar()->setPageStep(page);
+    verticalScrollBar()->setRange(0, int(qBound<qint64>(0, lines - page, INT_MAX)));
+
+    horizontalScrollBar()->setPageStep(viewport()->width());
+    horizontalScrollBar()->setSingleStep(fontMetrics().averageCharWidth());
+    horizontalScrollBar()->setRange(0, qMax(0, widestLine - viewport()->width()));
+}
+
+void LargeFileView::resizeEvent(QResizeEvent *e)
+{
+    QAbstractScrollArea::resizeEvent(e);
+    updateScrollBars();
+}
+
+void LargeFileView::paintEvent(QPaintEvent *)
+{
+    QPainter painter(viewport());
+    const QFontMetrics fm = fontMetrics();
+    const int lineSpacing = fm.lineSpacing();
+    const int x = 4 - horizontalScrollBar()->value();
+    const qint64 first = verticalScrollBar()->value();
+    const qint64 last = qMin(mapped->lineCount(), first + visibleLines() + 1);
+
+    int y = fm.ascent();
+    int widest = widestLine;
+    for (qint64 i = first; i < last; ++i) {
+        const QString text = mapped->line(i);
+        painter.drawText(x, y, text);
+        widest = qMax(widest, fm.width(text) + 8);
+        y += lineSpacing;
+    }
+
+    // The horizontal range grows with the widest line seen so far; the
+    // file is never measured as a whole.
+    if (widest != widestLine) {
+        widestLine = widest;
+        horizontalScrollBar()->setRange(0, qMax(0, widestLine - viewport()->width()));
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef LARGEFILEVIEW_H
+#define LARGEFILEVIEW_H
+
+#include <QAbstractScrollArea>
+
+class MappedFile;
+
+// Read-only viewer that only decodes and paints the lines currently in the
+// viewport, so its cost does not depend on the size of the file.
+class LargeFileView : public QAbstractScrollArea
+{
+    Q_OBJECT
+public:
+    explicit LargeFileView(QWidget *parent = 0);
+    ~LargeFileView();
+
+    bool openFile(const QString &fileName);
+    void closeFile();
+    MappedFile *file() const;
+
+signals:
+    void indexProgress(qint64 lines, qint64 bytes);
+    void indexFinished();
+
+protected:
+    void paintEvent(QPaintEvent *e) Q_DECL_OVERRIDE;
+    void resizeEvent(QResizeEvent *e) Q_DECL_OVERRIDE;
+
+private:
+    void updateScrollBars();
+    int visibleLines() const;
+
+    MappedFile *mapped;
+    int widestLine;
+};
+
+#endif // LARGEFILEVIEW_H
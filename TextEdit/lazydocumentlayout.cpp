@@ -0,0 +1,420 @@
+#include "lazydocumentlayout.h"
+#include "perflog.h"
+#include <QElapsedTimer>
+#include <QFontMetricsF>
+#include <QPainter>
+#include <QTextBlock>
+#include <QTextDocument>
+#include <QTextFrame>
+#include <QTextLayout>
+#include <QTextList>
+#include <cmath>
+
+namespace {
+// Time spent measuring blocks per event loop iteration.
+const int kRefineMs = 4;
+// Line width used when the document is not wrapped.
+const qreal kNoWrapWidth = 1e7;
+
+Qt::Alignment visualAlignment(Qt::LayoutDirection direction, Qt::Alignment alignment)
+{
+    if (!(alignment & Qt::AlignHorizontal_Mask))
+        alignment |= Qt::AlignLeft;
+    if (!(alignment & Qt::AlignAbsolute) && (alignment & (Qt::AlignLeft | Qt::AlignRight))
+            && direction == Qt::RightToLeft)
+        alignment ^= (Qt::AlignLeft | Qt::AlignRight);
+    return alignment;
+}
+
+// The top margin of a block collapses with the bottom margin of the one
+// before it, as in QTextDocumentLayout.
+qreal topMargin(const QTextBlock &block, const QTextBlockFormat &format)
+{
+    const QTextBlock previous = block.previous();
+    if (!previous.isValid())
+        return format.topMargin();
+    const qreal previousBottom = previous.blockFormat().bottomMargin();
+    return qMax(format.topMargin(), previousBottom) - previousBottom;
+}
+}
+
+LazyDocumentLayout::LazyDocumentLayout(QTextDocument *document) :
+    QAbstractTextDocumentLayout(document),
+    total(0),
+    widest(0),
+    generation(0),
+    width(document->textWidth()),
+    charWidth(1),
+    lineHeight(1),
+    refineBlock(0)
+{
+    refineTimer.setInterval(0);
+    connect(&refineTimer, &QTimer::timeout, this, &LazyDocumentLayout::refine);
+    sizeTimer.setSingleShot(true);
+    sizeTimer.setInterval(0);
+    connect(&sizeTimer, &QTimer::timeout, this, &LazyDocumentLayout::sizeChanged);
+}
+
+bool LazyDocumentLayout::supports(const QTextDocument *document)
+{
+    if (!document->rootFrame()->childFrames().isEmpty())
+        return false;
+    foreach (const QTextFormat &format, document->allFormats()) {
+        if (format.isListFormat() || (format.isCharFormat() && format.objectType() != QTextFormat::NoObject))
+            return false;
+    }
+    return true;
+}
+
+bool LazyDocumentLayout::supportsBlocks(QTextBlock block, int count) const
+{
+    if (!document()->rootFrame()->childFrames().isEmpty())
+        return false;
+    for (int i = 0; i < count && block.isValid(); ++i, block = block.next()) {
+        if (block.textList())
+            return false;
+        for (QTextBlock::iterator it = block.begin(); !it.atEnd(); ++it) {
+            if (it.fragment().charFormat().objectType() != QTextFormat::NoObject)
+                return false;
+        }
+    }
+    return true;
+}
+
+void LazyDocumentLayout::documentChanged(int from, int charsRemoved, int charsAdded)
+{
+    QTextDocument *doc = document();
+    const int blockCount = doc->blockCount();
+
+    if (from == 0 && charsRemoved == 0 && charsAdded >= doc->characterCount()
+            && heights.size() == blockCount) {
+        // The layout was installed, or the page width or default font
+        // changed. Blocks are measured again lazily; until then the old
+        // heights stand in as estimates.
+        width = doc->textWidth();
+        ++generation;
+        refineBlock = 0;
+        widest = 0;
+        const QFontMetricsF metrics(doc->defaultFont());
+        charWidth = metrics.averageCharWidth();
+        lineHeight = metrics.height();
+    } else {
+        QTextBlock first = doc->findBlock(from);
+        if (!first.isValid())
+            first = doc->lastBlock();
+        QTextBlock last = doc->findBlock(from + charsAdded);
+        if (!last.isValid())
+            last = doc->lastBlock();
+        const int firstNumber = first.blockNumber();
+        const int newCount = last.blockNumber() - firstNumber + 1;
+        const int oldCount = newCount - (blockCount - heights.size());
+
+        if (heights.isEmpty() || oldCount < 0 || firstNumber + oldCount > heights.size()) {
+            rebuild();
+        } else {
+            if (oldCount != newCount) {
+                heights.remove(firstNumber, oldCount);
+                heights.insert(firstNumber, newCount, 0);
+                measured.remove(firstNumber, oldCount);
+                measured.insert(firstNumber, newCount, -1);
+            }
+            // The block after the change collapses its top margin with the
+            // last changed one.
+            const int end = qMin(firstNumber + newCount + 1, blockCount);
+            QTextBlock block = first;
+            for (int n = firstNumber; n < end; ++n, block = block.next()) {
+                measured[n] = -1;
+                if (oldCount != newCount)
+                    heights[n] = estimate(block);
+                else
+                    setHeight(n, estimate(block));
+            }
+            if (oldCount != newCount)
+                buildTree();
+        }
+        if (!supportsBlocks(first, newCount))
+            emit unsupportedContent();
+    }
+
+    emit documentSizeChanged(documentSize());
+    emit update();
+    if (!refineTimer.isActive())
+        refineTimer.start();
+}
+
+void LazyDocumentLayout::rebuild()
+{
+    QTextDocument *doc = document();
+    width = doc->textWidth();
+    const QFontMetricsF metrics(doc->defaultFont());
+    charWidth = metrics.averageCharWidth();
+    lineHeight = metrics.height();
+
+    QElapsedTimer timer;
+    timer.start();
+    const int count = doc->blockCount();
+    heights.resize(count);
+    measured.fill(-1, count);
+    int n = 0;
+    for (QTextBlock block = doc->begin(); block.isValid() && n < count; block = block.next())
+        heights[n++] = estimate(block);
+    buildTree();
+    refineBlock = 0;
+    qCDebug(lcPerf) << "estimated" << count << "blocks in" << timer.elapsed() << "ms";
+}
+
+qreal LazyDocumentLayout::availableWidth(const QTextBlockFormat &format) const
+{
+    if (width <= 0)
+        return kNoWrapWidth;
+    const QTextDocument *doc = document();
+    return qMax<qreal>(1, width - 2 * doc->documentMargin() - format.leftMargin() - format.rightMargin()
+                       - format.indent() * doc->indentWidth());
+}
+
+qreal LazyDocumentLayout::estimate(const QTextBlock &block) const
+{
+    const QTextBlockFormat format = block.blockFormat();
+    const int chars = block.length() - 1;
+    int lines = 1;
+    if (width > 0 && chars > 0 && !format.nonBreakableLines())
+        lines = qMax(1, int(std::ceil(chars * charWidth / availableWidth(format))));
+    return topMargin(block, format) + lines * lineHeight + format.bottomMargin();
+}
+
+qreal LazyDocumentLayout::layoutBlock(const QTextBlock &block) const
+{
+    const QTextDocument *doc = document();
+    const QTextBlockFormat format = block.blockFormat();
+    QTextOption option = doc->defaultTextOption();
+    option.setTextDirection(format.layoutDirection());
+    option.setAlignment(visualAlignment(format.layoutDirection(), format.alignment()));
+    if (width <= 0 || format.nonBreakableLines())
+        option.setWrapMode(QTextOption::NoWrap);
+
+    QTextLayout *layout = block.layout();
+    layout->setTextOption(option);
+    const qreal left = doc->documentMargin() + format.leftMargin() + format.indent() * doc->indentWidth();
+    const qreal available = availableWidth(format);
+    qreal y = topMargin(block, format);
+
+    layout->beginLayout();
+    for (int i = 0; ; ++i) {
+        QTextLine line = layout->createLine();
+        if (!line.isValid())
+            break;
+        const qreal indent = i == 0 ? format.textIndent() : 0;
+        line.setLineWidth(available - indent);
+        line.setPosition(QPointF(left + indent, y));
+        y += format.lineHeight(line.height(), 1);
+        widest = qMax(widest, left + indent + line.naturalTextWidth());
+    }
+    layout->endLayout();
+    return y + format.bottomMargin();
+}
+
+void LazyDocumentLayout::ensureLayout(const QTextBlock &block) const
+{
+    const int n = block.blockNumber();
+    // Signals for a change go out before the layout hears about it.
+    if (n < 0 || n >= heights.size())
+        return;
+    if (measured.at(n) == generation && block.layout()->lineCount() > 0)
+        return;
+    const qreal height = layoutBlock(block);
+    measured[n] = generation;
+    if (height != heights.at(n)) {
+        setHeight(n, height);
+        sizeTimer.start();
+    }
+}
+
+void LazyDocumentLayout::refine()
+{
+    QElapsedTimer budget;
+    budget.start();
+    bool changed = false;
+    QTextBlock block = document()->findBlockByNumber(refineBlock);
+    while (block.isValid() && refineBlock < heights.size() && budget.elapsed() < kRefineMs) {
+        if (measured.at(refineBlock) != generation) {
+            // Blocks that were never painted do not keep their lines.
+            const bool keep = block.layout()->lineCount() > 0;
+            const qreal height = layoutBlock(block);
+            if (!keep)
+                block.layout()->clearLayout();
+            measured[refineBlock] = generation;
+            if (height != heights.at(refineBlock)) {
+                setHeight(refineBlock, height);
+                changed = true;
+            }
+        }
+        block = block.next();
+        ++refineBlock;
+    }
+    if (changed)
+        sizeChanged();
+    if (!block.isValid() || refineBlock >= heights.size())
+        refineTimer.stop();
+}
+
+void LazyDocumentLayout::sizeChanged()
+{
+    emit documentSizeChanged(documentSize());
+    emit update();
+}
+
+void LazyDocumentLayout::buildTree() const
+{
+    const int count = heights.size();
+    tree.fill(0, count + 1);
+    total = 0;
+    for (int i = 1; i <= count; ++i) {
+        tree[i] += heights.at(i - 1);
+        total += heights.at(i - 1);
+        const int parent = i + (i & -i);
+        if (parent <= count)
+            tree[parent] += tree[i];
+    }
+}
+
+void LazyDocumentLayout::setHeight(int block, qreal height) const
+{
+    const qreal delta = height - heights.at(block);
+    heights[block] = height;
+    total += delta;
+    for (int i = block + 1; i < tree.size(); i += i & -i)
+        tree[i] += delta;
+}
+
+qreal LazyDocumentLayout::offsetOf(int block) const
+{
+    qreal y = document()->documentMargin();
+    for (int i = block; i > 0; i -= i & -i)
+        y += tree.at(i);
+    return y;
+}
+
+int LazyDocumentLayout::blockAt(qreal y) const
+{
+    const int count = heights.size();
+    qreal rest = y - document()->documentMargin();
+    int step = 1;
+    while (step * 2 <= count)
+        step *= 2;
+    int n = 0;
+    for (; step > 0; step /= 2) {
+        if (n + step <= count && tree.at(n + step) <= rest) {
+            n += step;
+            rest -= tree.at(n);
+        }
+    }
+    return qBound(0, n, count - 1);
+}
+
+void LazyDocumentLayout::draw(QPainter *painter, const PaintContext &context)
+{
+    if (heights.isEmpty())
+        return;
+    const QSizeF size = documentSize();
+    const QRectF clip = context.clip.isValid() ? context.clip : QRectF(QPointF(0, 0), size);
+    const QVariant cursorWidthProperty = property("cursorWidth");
+    const int cursorWidth = cursorWidthProperty.isValid() ? cursorWidthProperty.toInt() : 1;
+
+    int n = blockAt(clip.top());
+    QTextBlock block = document()->findBlockByNumber(n);
+    qreal y = offsetOf(n);
+
+    painter->save();
+    painter->setPen(context.palette.color(QPalette::Text));
+    while (block.isValid() && n < heights.size() && y <= clip.bottom()) {
+        ensureLayout(block);
+        const qreal height = heights.at(n);
+        const QTextBlockFormat format = block.blockFormat();
+        if (format.hasProperty(QTextFormat::BackgroundBrush))
+            painter->fillRect(QRectF(0, y, size.width(), height), format.background());
+
+        const int start = block.position();
+        const int end = start + block.length();
+        QVector<QTextLayout::FormatRange> selections;
+        foreach (const Selection &selection, context.selections) {
+            const int from = qMax(selection.cursor.selectionStart(), start);
+            const int to = qMin(selection.cursor.selectionEnd(), end);
+            if (to <= from)
+                continue;
+            QTextLayout::FormatRange range;
+            range.start = from - start;
+            range.length = to - from;
+            range.format = selection.format;
+            selections.append(range);
+        }
+
+        QTextLayout *layout = block.layout();
+        layout->draw(painter, QPointF(0, y), selections, clip);
+        if (context.cursorPosition >= start && context.cursorPosition < end)
+            layout->drawCursor(painter, QPointF(0, y), context.cursorPosition - start, cursorWidth);
+
+        y += height;
+        block = block.next();
+        ++n;
+    }
+    painter->restore();
+}
+
+int LazyDocumentLayout::hitTest(const QPointF &point, Qt::HitTestAccuracy accuracy) const
+{
+    if (heights.isEmpty())
+        return -1;
+    const int n = blockAt(point.y());
+    const QTextBlock block = document()->findBlockByNumber(n);
+    ensureLayout(block);
+    const QTextLayout *layout = block.layout();
+    const qreal y = point.y() - offsetOf(n);
+
+    for (int i = 0; i < layout->lineCount(); ++i) {
+        const QTextLine line = layout->lineAt(i);
+        if (y >= line.y() + line.height() && i < layout->lineCount() - 1)
+            continue;
+        if (accuracy == Qt::ExactHit
+                && (y < line.y() || y > line.y() + line.height()
+                    || point.x() < line.x() || point.x() > line.x() + line.naturalTextWidth()))
+            return -1;
+        return block.position() + line.xToCursor(point.x());
+    }
+    return accuracy == Qt::ExactHit ? -1 : block.position();
+}
+
+qint64 LazyDocumentLayout::indexBytes() const
+{
+    return qint64(heights.capacity() + tree.capacity()) * sizeof(qreal)
+            + qint64(measured.capacity()) * sizeof(int);
+}
+
+int LazyDocumentLayout::pageCount() const
+{
+    return 1;
+}
+
+QSizeF LazyDocumentLayout::documentSize() const
+{
+    const qreal margin = document()->documentMargin();
+    const qreal w = width > 0 ? width : widest + margin;
+    return QSizeF(w, total + 2 * margin);
+}
+
+QRectF LazyDocumentLayout::frameBoundingRect(QTextFrame *frame) const
+{
+    if (frame != document()->rootFrame())
+        return QRectF();
+    return QRectF(QPointF(0, 0), documentSize());
+}
+
+QRectF LazyDocumentLayout::blockBoundingRect(const QTextBlock &block) const
+{
+    if (!block.isValid())
+        return QRectF();
+    const int n = block.blockNumber();
+    if (n >= heights.size())
+        return QRectF();
+    ensureLayout(block);
+    return QRectF(0, offsetOf(n), documentSize().width(), heights.at(n));
+}
@@ -0,0 +1,77 @@
+#ifndef LAZYDOCUMENTLAYOUT_H
+#define LAZYDOCUMENTLAYOUT_H
+
+#include <QAbstractTextDocumentLayout>
+#include <QTimer>
+#include <QVector>
+
+QT_BEGIN_NAMESPACE
+class QTextBlock;
+QT_END_NAMESPACE
+
+// Document layout for very long documents made of plain paragraphs. Block
+// heights start out as estimates kept in a Fenwick tree, so positions and
+// the document height are known without laying anything out. Blocks are
+// laid out when they are painted or hit, and the rest is measured in small
+// slices while the event loop is idle. Tables, frames, lists and inline
+// objects are not supported; unsupportedContent() is emitted when they
+// show up so the owner can switch back to the standard layout.
+class LazyDocumentLayout : public QAbstractTextDocumentLayout
+{
+    Q_OBJECT
+public:
+    explicit LazyDocumentLayout(QTextDocument *document);
+
+    static bool supports(const QTextDocument *document);
+
+    // Bytes of the height index. Layouts are only kept for blocks that
+    // were painted or hit.
+    qint64 indexBytes() const;
+
+    void draw(QPainter *painter, const PaintContext &context) Q_DECL_OVERRIDE;
+    int hitTest(const QPointF &point, Qt::HitTestAccuracy accuracy) const Q_DECL_OVERRIDE;
+    int pageCount() const Q_DECL_OVERRIDE;
+    QSizeF documentSize() const Q_DECL_OVERRIDE;
+    QRectF frameBoundingRect(QTextFrame *frame) const Q_DECL_OVERRIDE;
+    QRectF blockBoundingRect(const QTextBlock &block) const Q_DECL_OVERRIDE;
+
+signals:
+    void unsupportedContent();
+
+protected:
+    void documentChanged(int from, int charsRemoved, int charsAdded) Q_DECL_OVERRIDE;
+
+private slots:
+    void refine();
+    void sizeChanged();
+
+private:
+    void rebuild();
+    bool supportsBlocks(QTextBlock block, int count) const;
+    qreal estimate(const QTextBlock &block) const;
+    qreal layoutBlock(const QTextBlock &block) const;
+    void ensureLayout(const QTextBlock &block) const;
+    qreal availableWidth(const QTextBlockFormat &format) const;
+
+    void buildTree() const;
+    void setHeight(int block, qreal height) const;
+    qreal offsetOf(int block) const;
+    int blockAt(qreal y) const;
+
+    // Heights by block number, and the width generation each one was
+    // measured at; -1 for estimates.
+    mutable QVector<qreal> heights;
+    mutable QVector<int> measured;
+    mutable QVector<qreal> tree;
+    mutable qreal total;
+    mutable qreal widest;
+    int generation;
+    qreal width;
+    qreal charWidth;
+    qreal lineHeight;
+    int refineBlock;
+    QTimer refineTimer;
+    mutable QTimer sizeTimer;
+};
+
+#endif // LAZYDOCUMENTLAYOUT_H
@@ -0,0 +1,77 @@
+#include "listformatter.h"
+#include <QTextBlock>
+#include <QTextDocument>
+#include <QTextList>
+
+void ListFormatter::apply(QTextCursor cursor, QTextListFormat::Style style)
+{
+    QTextDocument *document = cursor.document();
+    const QTextBlock first = document->findBlock(cursor.selectionStart());
+    const QTextBlock last = document->findBlock(cursor.selectionEnd());
+    QTextCursor editor(document);
+
+    cursor.beginEditBlock();
+    // A list selected as a whole is restyled through its format. Anything
+    // else becomes a new list, so the part of a list outside the selection
+    // keeps its style.
+    QTextList *target = first.textList();
+    if (target && target->item(0).position() >= first.position()
+            && target->item(target->count() - 1).position() <= last.position()) {
+        QTextListFormat format = target->format();
+        format.setStyle(style);
+        target->setFormat(format);
+    } else {
+        // The new list takes over the indent of the first paragraph, or
+        // of the list it is in.
+        QTextListFormat format = target ? target->format() : QTextListFormat();
+        if (!target)
+            format.setIndent(first.blockFormat().indent() + 1);
+        format.setStyle(style);
+        const bool wasInList = target != 0;
+        QTextBlockFormat blockFormat = first.blockFormat();
+        editor.setPosition(first.position());
+        target = editor.createList(format);
+        if (!wasInList) {
+            blockFormat.setIndent(0);
+            blockFormat.setObjectIndex(target->objectIndex());
+            editor.setBlockFormat(blockFormat);
+        }
+    }
+
+    // All other selected paragraphs join it in one pass.
+    for (QTextBlock block = first; block.isValid(); block = block.next()) {
+        if (block.textList() != target) {
+            QTextBlockFormat format = block.blockFormat();
+            if (!block.textList())
+                format.setIndent(0);
+            format.setObjectIndex(target->objectIndex());
+            editor.setPosition(block.position());
+            editor.setBlockFormat(format);
+        }
+        if (block == last)
+            break;
+    }
+    cursor.endEditBlock();
+}
+
+void ListFormatter::remove(QTextCursor cursor)
+{
+    QTextDocument *document = cursor.document();
+    const QTextBlock last = document->findBlock(cursor.selectionEnd());
+    QTextCursor editor(document);
+
+    cursor.beginEditBlock();
+    for (QTextBlock block = document->findBlock(cursor.selectionStart()); block.isValid(); block = block.next()) {
+        if (QTextList *list = block.textList()) {
+            // Gives back the indent the list took over in apply().
+            QTextBlockFormat format = block.blockFormat();
+            format.setIndent(format.indent() + qMax(0, list->format().indent() - 1));
+            format.setObjectIndex(-1);
+            editor.setPosition(block.position());
+            editor.setBlockFormat(format);
+        }
+        if (block == last)
+            break;
+    }
+    cursor.endEditBlock();
+}
@@ -0,0 +1,18 @@
+#ifndef LISTFORMATTER_H
+#define LISTFORMATTER_H
+
+#include <QTextCursor>
+#include <QTextListFormat>
+
+// Turns the paragraphs of a selection into list items and back, as one
+// edit block and in a single pass over the selected blocks. The selected
+// paragraphs become one list; a list that is selected as a whole is
+// restyled through its format instead of moving its blocks into a new one.
+class ListFormatter
+{
+public:
+    static void apply(QTextCursor cursor, QTextListFormat::Style style);
+    static void remove(QTextCursor cursor);
+};
+
+#endif // LISTFORMATTER_H
@@ -1,11 +1,31 @@
 #include "textedit.h"
+#include "batchconverter.h"
+#include "memorystats.h"
+#include "perflog.h"
 #include <QApplication>
 
 int main(int argc, char *argv[])
 {
+    if (BatchConverter::isRequested(argc, argv)) {
+        // Conversions never show a window, so they do not need a display.
+        if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+            qputenv("QT_QPA_PLATFORM", "offscreen");
+        QGuiApplication app(argc, argv);
+        return BatchConverter::run(app.arguments());
+    }
+
+    if (MemoryStats::isRequested(argc, argv)) {
+        if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+            qputenv("QT_QPA_PLATFORM", "offscreen");
+        QApplication app(argc, argv);
+        return MemoryStats::run(app.arguments());
+    }
+
     QApplication a(argc, argv);
+    traceStartup("QApplication");
     TextEdit w;
     w.show();
+    traceStartup("show");
 
     return a.exec();
 }
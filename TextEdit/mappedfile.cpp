@@ -0,0 +1,173 @@
+#include "mappedfile.h"
+#include "perflog.h"
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QtConcurrent>
+#include <cstring>
+
+namespace {
+// Bytes scanned between two publications of the partial index.
+const qint64 kChunk = 16 * 1024 * 1024;
+}
+
+MappedFile::MappedFile(QObject *parent) :
+    QObject(parent),
+    data(0),
+    length(0),
+    lines(0),
+    indexed(false),
+    cancelled(false)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const QString &fileName)
+{
+    close();
+
+    file.setFileName(fileName);
+    if (!file.open(QFile::ReadOnly))
+        return false;
+
+    length = file.size();
+    if (length > 0) {
+        data = reinterpret_cast<const char *>(file.map(0, length));
+        if (!data) {
+            file.close();
+            length = 0;
+            return false;
+        }
+    }
+
+    cancelled = false;
+    indexed = false;
+    indexer = QtConcurrent::run(this, &MappedFile::buildIndex);
+    return true;
+}
+
+void MappedFile::close()
+{
+    cancelled = true;
+    indexer.waitForFinished();
+
+    if (data)
+        file.unmap(reinterpret_cast<uchar *>(const_cast<char *>(data)));
+    file.close();
+    data = 0;
+    length = 0;
+
+    QMutexLocker locker(&mutex);
+    checkpoints.clear();
+    lines = 0;
+}
+
+QString MappedFile::fileName() const
+{
+    return file.fileName();
+}
+
+qint64 MappedFile::size() const
+{
+    return length;
+}
+
+qint64 MappedFile::lineCount() const
+{
+    QMutexLocker locker(&mutex);
+    return lines;
+}
+
+bool MappedFile::isIndexed() const
+{
+    return indexed;
+}
+
+qint64 MappedFile::indexBytes() const
+{
+    QMutexLocker locker(&mutex);
+    return qint64(checkpoints.capacity()) * sizeof(qint64);
+}
+
+void MappedFile::buildIndex()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QVector<qint64> batch;
+    qint64 count = 0;
+    qint64 pos = 0;
+    if (length > 0) {
+        batch.append(0);
+        count = 1;
+    }
+
+    while (pos < length && !cancelled) {
+        const qint64 chunkEnd = qMin(length, pos + kChunk);
+        const char *p = data + pos;
+        const char *end = data + chunkEnd;
+        while ((p = static_cast<const char *>(memchr(p, '\n', end - p)))) {
+            ++p;
+            // A trailing newline does not start another line.
+            if (p == data + length)
+                break;
+            if (count % kStride == 0)
+                batch.append(p - data);
+            ++count;
+        }
+        pos = chunkEnd;
+
+        {
+            QMutexLocker locker(&mutex);
+            checkpoints += batch;
+            lines = count;
+        }
+        batch.clear();
+        emit indexProgress(count, pos);
+    }
+
+    if (cancelled)
+        return;
+    qCDebug(lcPerf) << "indexed" << count << "lines of" << file.fileName()
+                    << "in" << timer.elapsed() << "ms";
+    indexed = true;
+    emit indexFinished();
+}
+
+const char *MappedFile::lineStart(qint64 index) const
+{
+    qint64 offset;
+    {
+        QMutexLocker locker(&mutex);
+        if (index < 0 || index >= lines)
+            return 0;
+        offset = checkpoints.at(index / kStride);
+    }
+
+    const char *p = data + offset;
+    const char *end = data + length;
+    for (qint64 skip = index % kStride; skip > 0; --skip) {
+        p = static_cast<const char *>(memchr(p, '\n', end - p));
+        if (!p)
+            return 0;
+        ++p;
+    }
+    return p;
+}
+
+QString MappedFile::line(qint64 index, int maxBytes) const
+{
+    const char *start = lineStart(index);
+    if (!start)
+        return QString();
+
+    const qint64 available = qMin<qint64>(data + length - start, maxBytes);
+    const char *eol = static_cast<const char *>(memchr(start, '\n', available));
+    int size = eol ? int(eol - start) : int(available);
+    if (size > 0 && start[size - 1] == '\r')
+        --size;
+    return QString::fromUtf8(start, size);
+}
@@ -0,0 +1,56 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <QObject>
+#include <QFile>
+#include <QFuture>
+#include <QMutex>
+#include <QVector>
+#include <atomic>
+
+// Read-only view of a file through a memory mapping. A background task
+// records the offset of every kStride-th line, so the index stays small
+// even for multi-GB files and single lines are found with a short scan.
+class MappedFile : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MappedFile(QObject *parent = 0);
+    ~MappedFile();
+
+    bool open(const QString &fileName);
+    void close();
+
+    QString fileName() const;
+    qint64 size() const;
+    qint64 lineCount() const;
+    bool isIndexed() const;
+    // Bytes of the line index; the mapped pages belong to the file cache.
+    qint64 indexBytes() const;
+
+    // Decodes line \a index; lines longer than \a maxBytes are cut off.
+    QString line(qint64 index, int maxBytes = 64 * 1024) const;
+
+signals:
+    void indexProgress(qint64 lines, qint64 bytes);
+    void indexFinished();
+
+private:
+    void buildIndex();
+    const char *lineStart(qint64 index) const;
+
+    static const int kStride = 256;
+
+    QFile file;
+    const char *data;
+    qint64 length;
+
+    mutable QMutex mutex;
+    QVector<qint64> checkpoints;
+    qint64 lines;
+    std::atomic<bool> indexed;
+    std::atomic<bool> cancelled;
+    QFuture<void> indexer;
+};
+
+#endif // MAPPEDFILE_H
@@ -0,0 +1,127 @@
+#include "memorydialog.h"
+#include "imagecache.h"
+#include <QApplication>
+#include <QClipboard>
+#include <QDialogButtonBox>
+#include <QHeaderView>
+#include <QJsonDocument>
+#include <QLabel>
+#include <QPushButton>
+#include <QTreeWidget>
+#include <QVBoxLayout>
+
+namespace {
+const int kRefreshMs = 1000;
+
+enum Column {
+    DocumentColumn,
+    KindColumn,
+    TextColumn,
+    FormatsColumn,
+    UndoColumn,
+    LayoutColumn,
+    ImagesColumn,
+    TotalColumn
+};
+
+QString formatBytes(qint64 bytes)
+{
+    if (bytes < 1024)
+        return QString::number(bytes) + QStringLiteral(" B");
+    if (bytes < 1024 * 1024)
+        return QString::number(bytes / 1024.0, 'f', 1) + QStringLiteral(" KB");
+    if (bytes < 1024 * 1024 * 1024)
+        return QString::number(bytes / 1048576.0, 'f', 1) + QStringLiteral(" MB");
+    return QString::number(bytes / 1073741824.0, 'f', 2) + QStringLiteral(" GB");
+}
+}
+
+MemoryDialog::MemoryDialog(const Source &source, QWidget *parent) :
+    QDialog(parent),
+    source(source)
+{
+    setWindowTitle(tr("Memory Usage"));
+
+    tree = new QTreeWidget(this);
+    tree->setRootIsDecorated(false);
+    tree->setUniformRowHeights(true);
+    tree->setHeaderLabels(QStringList() << tr("Document") << tr("Kind") << tr("Text") << tr("Formats")
+                          << tr("Undo") << tr("Layout") << tr("Images") << tr("Total"));
+    tree->header()->setStretchLastSection(false);
+    tree->header()->setSectionResizeMode(DocumentColumn, QHeaderView::Stretch);
+    for (int column = KindColumn; column <= TotalColumn; ++column)
+        tree->header()->setSectionResizeMode(column, QHeaderView::ResizeToContents);
+    summary = new QLabel(this);
+
+    QDialogButtonBox *buttons = new QDialogButtonBox(QDialogButtonBox::Close, this);
+    QPushButton *copyButton = buttons->addButton(tr("Copy as JSON"), QDialogButtonBox::ActionRole);
+    connect(copyButton, &QPushButton::clicked, this, &MemoryDialog::copyReport);
+    connect(buttons, &QDialogButtonBox::rejected, this, &MemoryDialog::reject);
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->addWidget(tree);
+    layout->addWidget(summary);
+    layout->addWidget(buttons);
+    resize(720, 320);
+
+    refreshTimer.setInterval(kRefreshMs);
+    connect(&refreshTimer, &QTimer::timeout, this, &MemoryDialog::refresh);
+}
+
+void MemoryDialog::showEvent(QShowEvent *e)
+{
+    refresh();
+    refreshTimer.start();
+    QDialog::showEvent(e);
+}
+
+void MemoryDialog::hideEvent(QHideEvent *e)
+{
+    refreshTimer.stop();
+    QDialog::hideEvent(e);
+}
+
+void MemoryDialog::refresh()
+{
+    documents = source();
+
+    // Rows are reused so the selection and scroll position survive.
+    while (tree->topLevelItemCount() > documents.size())
+        delete tree->takeTopLevelItem(tree->topLevelItemCount() - 1);
+    while (tree->topLevelItemCount() < documents.size()) {
+        QTreeWidgetItem *item = new QTreeWidgetItem(tree);
+        for (int column = TextColumn; column <= TotalColumn; ++column)
+            item->setTextAlignment(column, Qt::AlignRight | Qt::AlignVCenter);
+    }
+
+    qint64 accounted = 0;
+    for (int i = 0; i < documents.size(); ++i) {
+        const MemoryUsage &usage = documents.at(i);
+        QTreeWidgetItem *item = tree->topLevelItem(i);
+        item->setText(DocumentColumn, usage.document);
+        item->setText(KindColumn, usage.kind);
+        item->setText(TextColumn, formatBytes(usage.text));
+        item->setText(FormatsColumn, formatBytes(usage.formats));
+        item->setText(UndoColumn, formatBytes(usage.undo));
+        item->setText(LayoutColumn, formatBytes(usage.layout));
+        item->setText(ImagesColumn, formatBytes(usage.images));
+        item->setText(TotalColumn, formatBytes(usage.total()));
+        accounted += usage.total();
+    }
+
+    const ImageCache *cache = ImageCache::instance();
+    accounted += cache->totalBytes();
+    QString text = tr("Image cache: %1 of %2. Accounted for: %3.")
+            .arg(formatBytes(cache->totalBytes()), formatBytes(cache->maxBytes()), formatBytes(accounted));
+    const qint64 process = MemoryStats::processBytes();
+    if (process >= 0)
+        text += QLatin1Char(' ') + tr("Process: %1.").arg(formatBytes(process));
+    summary->setText(text);
+}
+
+void MemoryDialog::copyReport()
+{
+#ifndef QT_NO_CLIPBOARD
+    QApplication::clipboard()->setText(QString::fromUtf8(QJsonDocument(MemoryStats::report(documents)).toJson()));
+#endif
+}
@@ -0,0 +1,40 @@
+#ifndef MEMORYDIALOG_H
+#define MEMORYDIALOG_H
+
+#include <QDialog>
+#include <QTimer>
+#include <functional>
+#include "memorystats.h"
+
+QT_BEGIN_NAMESPACE
+class QLabel;
+class QTreeWidget;
+QT_END_NAMESPACE
+
+// Diagnostics view of the memory each open document uses, by category.
+// The figures are taken again every second while the view is shown.
+class MemoryDialog : public QDialog
+{
+    Q_OBJECT
+public:
+    typedef std::function<QList<MemoryUsage>()> Source;
+
+    explicit MemoryDialog(const Source &source, QWidget *parent = 0);
+
+protected:
+    void showEvent(QShowEvent *e) Q_DECL_OVERRIDE;
+    void hideEvent(QHideEvent *e) Q_DECL_OVERRIDE;
+
+private slots:
+    void refresh();
+    void copyReport();
+
+private:
+    Source source;
+    QList<MemoryUsage> documents;
+    QTreeWidget *tree;
+    QLabel *summary;
+    QTimer refreshTimer;
+};
+
+#endif // MEMORYDIALOG_H
@@ -0,0 +1,286 @@
+#include "memorystats.h"
+#include "documentlimits.h"
+#include "documentloader.h"
+#include "hibernateddocument.h"
+#include "imagecache.h"
+#include "imagedocument.h"
+#include "lazydocumentlayout.h"
+#include "mappedfile.h"
+#include "piecetable.h"
+#include "undohistory.h"
+#include <QAbstractTextDocumentLayout>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QPlainTextDocumentLayout>
+#include <QTextDocument>
+#include <QTextFormat>
+#include <QTextStream>
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+namespace {
+// Rough sizes of Qt's private structures on a 64 bit build. A block holds
+// a fragment map node, its block data and a QTextLayout; a laid out block
+// adds a text engine with its lines and items, and per character the
+// glyphs, advances, offsets, attributes and log clusters.
+const qint64 kCharBytes = 2;
+const qint64 kBlockBytes = 160;
+const qint64 kFormatBytes = 48;
+const qint64 kPropertyBytes = 32;
+const qint64 kLayoutBlockBytes = 400;
+const qint64 kLayoutCharBytes = 28;
+// Width rich text is laid out at, so that its images are loaded.
+const qreal kPageWidth = 800;
+
+MemoryUsage measureFile(const QString &fileName, bool *ok)
+{
+    MemoryUsage usage;
+    *ok = false;
+    QEventLoop loop;
+    const qint64 size = QFileInfo(fileName).size();
+    if (DocumentLimits::opensMapped(size)) {
+        MappedFile file;
+        QObject::connect(&file, &MappedFile::indexFinished, &loop, &QEventLoop::quit);
+        *ok = file.open(fileName);
+        if (*ok && !file.isIndexed())
+            loop.exec();
+        usage = MemoryStats::measure(file);
+        usage.document = fileName;
+        return usage;
+    }
+
+    // The editor picks the view and layout in the same steps.
+    ImageDocument document;
+    if (DocumentLimits::loadsLazily(size))
+        document.setDocumentLayout(new LazyDocumentLayout(&document));
+    UndoHistory undoHistory(&document);
+    QTextDocument plainDocument;
+    plainDocument.setDocumentLayout(new QPlainTextDocumentLayout(&plainDocument));
+    UndoHistory plainUndoHistory(&plainDocument);
+    DocumentLoader loader;
+    loader.setPlainTextThreshold(DocumentLimits::pieceTableCharacters());
+    loader.setPlainTextDocument(&plainDocument);
+    QString plain;
+    bool decodedPlain = false;
+    bool insertedPlain = false;
+    QObject::connect(&loader, &DocumentLoader::plainTextStarted, &loop, [&]() {
+        insertedPlain = true;
+    });
+    QObject::connect(&loader, &DocumentLoader::plainTextDecoded, &loop, [&](const QString &text) {
+        plain = text;
+        decodedPlain = true;
+    });
+    QObject::connect(&loader, &DocumentLoader::finished, &loop, [&](bool result) {
+        *ok = result;
+        loop.quit();
+    });
+    loader.start(fileName, &document);
+    if (loader.isRunning())
+        loop.exec();
+
+    if (decodedPlain) {
+        usage = MemoryStats::measure(PieceTable(plain));
+    } else if (insertedPlain) {
+        plainUndoHistory.reset();
+        usage = MemoryStats::measure(&plainDocument);
+        usage.undo = plainUndoHistory.residentBytes() + plainUndoHistory.shadowBytes();
+    } else {
+        const bool lazy = DocumentLimits::keepsLazyLayout(&document);
+        if (lazy != (qobject_cast<LazyDocumentLayout *>(document.documentLayout()) != 0))
+            document.setDocumentLayout(lazy ? new LazyDocumentLayout(&document) : 0);
+        document.setTextWidth(kPageWidth);
+        document.documentLayout()->documentSize();
+        undoHistory.reset();
+        usage = MemoryStats::measure(&document);
+        usage.undo = undoHistory.residentBytes() + undoHistory.shadowBytes();
+    }
+    usage.document = fileName;
+    return usage;
+}
+}
+
+qint64 MemoryUsage::total() const
+{
+    return text + formats + undo + layout + images;
+}
+
+QJsonObject MemoryUsage::toJson() const
+{
+    QJsonObject entry;
+    entry.insert(QStringLiteral("document"), document);
+    entry.insert(QStringLiteral("kind"), kind);
+    entry.insert(QStringLiteral("text"), double(text));
+    entry.insert(QStringLiteral("formats"), double(formats));
+    entry.insert(QStringLiteral("undo"), double(undo));
+    entry.insert(QStringLiteral("layout"), double(layout));
+    entry.insert(QStringLiteral("images"), double(images));
+    entry.insert(QStringLiteral("total"), double(total()));
+    return entry;
+}
+
+qint64 MemoryStats::textBytes(const QTextDocument *document)
+{
+    if (!document)
+        return 0;
+    return qint64(document->characterCount()) * kCharBytes + qint64(document->blockCount()) * kBlockBytes;
+}
+
+qint64 MemoryStats::formatBytes(const QTextDocument *document)
+{
+    if (!document)
+        return 0;
+    qint64 bytes = 0;
+    foreach (const QTextFormat &format, document->allFormats())
+        bytes += kFormatBytes + format.propertyCount() * kPropertyBytes;
+    return bytes;
+}
+
+qint64 MemoryStats::layoutBytes(const QTextDocument *document)
+{
+    if (!document)
+        return 0;
+    // The lazy layout only keeps what was painted.
+    if (const LazyDocumentLayout *lazy = qobject_cast<const LazyDocumentLayout *>(document->documentLayout()))
+        return lazy->indexBytes();
+    return qint64(document->characterCount()) * kLayoutCharBytes
+            + qint64(document->blockCount()) * kLayoutBlockBytes;
+}
+
+MemoryUsage MemoryStats::measure(const QTextDocument *document)
+{
+    MemoryUsage usage;
+    const bool plain = qobject_cast<const QPlainTextDocumentLayout *>(document->documentLayout());
+    usage.kind = plain ? QStringLiteral("plain text") : QStringLiteral("rich text");
+    usage.text = textBytes(document);
+    usage.formats = formatBytes(document);
+    usage.layout = layoutBytes(document);
+    if (const ImageDocument *images = qobject_cast<const ImageDocument *>(document))
+        usage.images = images->imageBytes();
+    return usage;
+}
+
+MemoryUsage MemoryStats::measure(const PieceTable &table)
+{
+    // Only the visible lines are ever laid out.
+    MemoryUsage usage;
+    usage.kind = QStringLiteral("piece table");
+    usage.text = table.residentBytes();
+    usage.undo = table.historyBytes();
+    return usage;
+}
+
+MemoryUsage MemoryStats::measure(const MappedFile &file)
+{
+    MemoryUsage usage;
+    usage.kind = QStringLiteral("mapped");
+    usage.layout = file.indexBytes();
+    return usage;
+}
+
+MemoryUsage MemoryStats::measure(const HibernatedDocument &document)
+{
+    MemoryUsage usage;
+    usage.kind = QStringLiteral("hibernated");
+    usage.text = document.data.capacity();
+    return usage;
+}
+
+qint64 MemoryStats::processBytes()
+{
+#ifdef Q_OS_LINUX
+    // The second field is the resident set, in pages.
+    QFile statm(QStringLiteral("/proc/self/statm"));
+    if (statm.open(QFile::ReadOnly)) {
+        const QList<QByteArray> fields = statm.readAll().split(' ');
+        if (fields.size() > 1)
+            return fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE);
+    }
+#endif
+    return -1;
+}
+
+QJsonObject MemoryStats::report(const QList<MemoryUsage> &documents)
+{
+    QJsonArray entries;
+    qint64 accounted = 0;
+    foreach (const MemoryUsage &usage, documents) {
+        entries.append(usage.toJson());
+        accounted += usage.total();
+    }
+    const ImageCache *cache = ImageCache::instance();
+    accounted += cache->totalBytes();
+
+    QJsonObject imageCache;
+    imageCache.insert(QStringLiteral("bytes"), double(cache->totalBytes()));
+    imageCache.insert(QStringLiteral("max_bytes"), double(cache->maxBytes()));
+
+    QJsonObject root;
+    root.insert(QStringLiteral("documents"), entries);
+    root.insert(QStringLiteral("image_cache"), imageCache);
+    root.insert(QStringLiteral("accounted_bytes"), double(accounted));
+    const qint64 process = processBytes();
+    if (process >= 0)
+        root.insert(QStringLiteral("process_bytes"), double(process));
+    return root;
+}
+
+bool MemoryStats::isRequested(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        if (qstrcmp(argv[i], "--memstats") == 0)
+            return true;
+    }
+    return false;
+}
+
+int MemoryStats::run(const QStringList &arguments)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Reports the memory documents take when opened."));
+    parser.addHelpOption();
+    const QCommandLineOption memstatsOption(QStringLiteral("memstats"), QStringLiteral("Report memory use."));
+    const QCommandLineOption outputOption(QStringLiteral("output"),
+            QStringLiteral("Write the JSON report to <file> instead of stdout."), QStringLiteral("file"));
+    parser.addOption(memstatsOption);
+    parser.addOption(outputOption);
+    parser.addPositionalArgument(QStringLiteral("files"), QStringLiteral("Documents to open."), QStringLiteral("files..."));
+    parser.process(arguments);
+
+    QTextStream err(stderr);
+    const QStringList files = parser.positionalArguments();
+    if (files.isEmpty()) {
+        err << "No files given" << endl;
+        return 2;
+    }
+
+    int status = 0;
+    QList<MemoryUsage> documents;
+    foreach (const QString &fileName, files) {
+        bool ok = false;
+        const MemoryUsage usage = measureFile(fileName, &ok);
+        if (!ok) {
+            err << "Could not open " << QDir::toNativeSeparators(fileName) << endl;
+            status = 1;
+            continue;
+        }
+        documents.append(usage);
+    }
+
+    const QByteArray json = QJsonDocument(report(documents)).toJson();
+    if (parser.isSet(outputOption)) {
+        QFile out(parser.value(outputOption));
+        if (!out.open(QFile::WriteOnly) || out.write(json) != json.size()) {
+            err << "Could not write " << QDir::toNativeSeparators(out.fileName()) << endl;
+            return 1;
+        }
+    } else {
+        QTextStream(stdout) << json;
+    }
+    return status;
+}
@@ -0,0 +1,66 @@
+#ifndef MEMORYSTATS_H
+#define MEMORYSTATS_H
+
+#include <QJsonObject>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+QT_BEGIN_NAMESPACE
+class QTextDocument;
+QT_END_NAMESPACE
+
+class MappedFile;
+class PieceTable;
+struct HibernatedDocument;
+
+// Memory used by one open document, in bytes, by category.
+struct MemoryUsage
+{
+    MemoryUsage() : text(0), formats(0), undo(0), layout(0), images(0) {}
+
+    QString document;
+    QString kind;
+    qint64 text;
+    qint64 formats;
+    qint64 undo;
+    qint64 layout;
+    qint64 images;
+
+    qint64 total() const;
+    QJsonObject toJson() const;
+};
+
+// Estimates what documents cost from counters that are already kept, such
+// as character, block and format counts, so that it can be repeated every
+// second on documents of any size. The figures are approximations of Qt's
+// private structures on a 64 bit build, good for finding which category
+// grows rather than for exact accounting.
+//
+// Files can be measured without a window with
+//   TextEdit --memstats [--output FILE] FILE...
+// which opens each file the way the editor does and writes the same JSON
+// report the diagnostics view copies.
+class MemoryStats
+{
+public:
+    static qint64 textBytes(const QTextDocument *document);
+    static qint64 formatBytes(const QTextDocument *document);
+    static qint64 layoutBytes(const QTextDocument *document);
+
+    // Undo history is not included; it is kept apart from the document.
+    static MemoryUsage measure(const QTextDocument *document);
+    static MemoryUsage measure(const PieceTable &table);
+    static MemoryUsage measure(const MappedFile &file);
+    static MemoryUsage measure(const HibernatedDocument &document);
+
+    // Resident memory of the whole process, or -1 where it is not known.
+    static qint64 processBytes();
+    // \a documents together with the image cache they share.
+    static QJsonObject report(const QList<MemoryUsage> &documents);
+
+    static bool isRequested(int argc, char *argv[]);
+    static int run(const QStringList &arguments);
+};
+
+#endif // MEMORYSTATS_H
@@ -0,0 +1,438 @@
+#include "odtwriter.h"
+#include "documentsaver.h"
+#include "perflog.h"
+#include <QBuffer>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QSaveFile>
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <QTextDocumentWriter>
+#include <QUrl>
+#include <QVector>
+#include <QXmlStreamWriter>
+#include <QtEndian>
+
+namespace {
+const quint32 kLocalHeader = 0x04034b50;
+const quint32 kCentralHeader = 0x02014b50;
+const quint32 kEndOfDirectory = 0x06054b50;
+const int kLocalHeaderSize = 30;
+const int kCentralHeaderSize = 46;
+const int kEndOfDirectorySize = 22;
+const quint16 kVersion = 20;
+const quint16 kStored = 0;
+// General purpose flags: sizes in a trailing data descriptor, UTF-8 names.
+const quint16 kDataDescriptor = 0x0008;
+const quint16 kUtf8Names = 0x0800;
+
+struct ZipEntry
+{
+    QByteArray name;
+    quint16 flags;
+    quint16 method;
+    quint16 time;
+    quint16 date;
+    quint32 crc;
+    quint32 size;
+    QByteArray data;
+};
+
+// An image the writer stores in the package, and what it was resolved from.
+struct ImageSource
+{
+    QString key;
+    QUrl url;
+    // The file the image is read from, if it is one.
+    QString path;
+    QVariant original;
+    QImage image;
+    QByteArray bytes;
+    QByteArray format;
+    QSize size;
+};
+
+struct ImageUse
+{
+    int position;
+    int source;
+    QTextImageFormat format;
+};
+
+struct CrcTable
+{
+    CrcTable()
+    {
+        for (quint32 i = 0; i < 256; ++i) {
+            quint32 c = i;
+            for (int k = 0; k < 8; ++k)
+                c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            values[i] = c;
+        }
+    }
+    quint32 values[256];
+};
+
+quint32 crc32(const QByteArray &data)
+{
+    static const CrcTable table;
+    const uchar *p = reinterpret_cast<const uchar *>(data.constData());
+    quint32 crc = 0xffffffff;
+    for (int i = 0; i < data.size(); ++i)
+        crc = table.values[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+bool readZip(const QByteArray &zip, QVector<ZipEntry> *entries)
+{
+    const int end = zip.lastIndexOf(QByteArray("PK\x05\x06", 4));
+    if (end < 0 || zip.size() - end < kEndOfDirectorySize)
+        return false;
+    const uchar *p = reinterpret_cast<const uchar *>(zip.constData());
+    const int count = qFromLittleEndian<quint16>(p + end + 10);
+    qint64 offset = qFromLittleEndian<quint32>(p + end + 16);
+    for (int i = 0; i < count; ++i) {
+        if (offset + kCentralHeaderSize > zip.size() || qFromLittleEndian<quint32>(p + offset) != kCentralHeader)
+            return false;
+        const uchar *c = p + offset;
+        ZipEntry entry;
+        entry.flags = qFromLittleEndian<quint16>(c + 8) & ~kDataDescriptor;
+        entry.method = qFromLittleEndian<quint16>(c + 10);
+        entry.time = qFromLittleEndian<quint16>(c + 12);
+        entry.date = qFromLittleEndian<quint16>(c + 14);
+        entry.crc = qFromLittleEndian<quint32>(c + 16);
+        const qint64 compressed = qFromLittleEndian<quint32>(c + 20);
+        entry.size = qFromLittleEndian<quint32>(c + 24);
+        const int nameLength = qFromLittleEndian<quint16>(c + 28);
+        const int extraLength = qFromLittleEndian<quint16>(c + 30);
+        const int commentLength = qFromLittleEndian<quint16>(c + 32);
+        const qint64 local = qFromLittleEndian<quint32>(c + 42);
+        entry.name = zip.mid(int(offset) + kCentralHeaderSize, nameLength);
+
+        if (local + kLocalHeaderSize > zip.size() || qFromLittleEndian<quint32>(p + local) != kLocalHeader)
+            return false;
+        const qint64 start = local + kLocalHeaderSize + qFromLittleEndian<quint16>(p + local + 26)
+                + qFromLittleEndian<quint16>(p + local + 28);
+        if (start + compressed > zip.size())
+            return false;
+        entry.data = zip.mid(int(start), int(compressed));
+        entries->append(entry);
+        offset += kCentralHeaderSize + nameLength + extraLength + commentLength;
+    }
+    return true;
+}
+
+bool writeZip(QIODevice *out, const QVector<ZipEntry> &entries)
+{
+    QByteArray directory;
+    quint32 offset = 0;
+    foreach (const ZipEntry &entry, entries) {
+        QByteArray local(kLocalHeaderSize, 0);
+        uchar *l = reinterpret_cast<uchar *>(local.data());
+        qToLittleEndian<quint32>(kLocalHeader, l);
+        qToLittleEndian<quint16>(kVersion, l + 4);
+        qToLittleEndian<quint16>(entry.flags, l + 6);
+        qToLittleEndian<quint16>(entry.method, l + 8);
+        qToLittleEndian<quint16>(entry.time, l + 10);
+        qToLittleEndian<quint16>(entry.date, l + 12);
+        qToLittleEndian<quint32>(entry.crc, l + 14);
+        qToLittleEndian<quint32>(entry.data.size(), l + 18);
+        qToLittleEndian<quint32>(entry.size, l + 22);
+        qToLittleEndian<quint16>(entry.name.size(), l + 26);
+
+        QByteArray central(kCentralHeaderSize, 0);
+        uchar *c = reinterpret_cast<uchar *>(central.data());
+        qToLittleEndian<quint32>(kCentralHeader, c);
+        qToLittleEndian<quint16>(kVersion, c + 4);
+        // The rest of the local header is repeated from its version on.
+        memcpy(c + 6, l + 4, 24);
+        qToLittleEndian<quint32>(offset, c + 42);
+        directory += central;
+        directory += entry.name;
+
+        if (out->write(local) != local.size() || out->write(entry.name) != entry.name.size()
+                || out->write(entry.data) != entry.data.size())
+            return false;
+        offset += local.size() + entry.name.size() + entry.data.size();
+    }
+
+    QByteArray end(kEndOfDirectorySize, 0);
+    uchar *e = reinterpret_cast<uchar *>(end.data());
+    qToLittleEndian<quint32>(kEndOfDirectory, e);
+    qToLittleEndian<quint16>(entries.size(), e + 8);
+    qToLittleEndian<quint16>(entries.size(), e + 10);
+    qToLittleEndian<quint32>(directory.size(), e + 12);
+    qToLittleEndian<quint32>(offset, e + 16);
+    return out->write(directory) == directory.size() && out->write(end) == end.size();
+}
+
+// Reads the format and size of encoded image data. Only the header is
+// read unless the reader cannot tell the size without decoding.
+bool probeImage(ImageSource *source)
+{
+    QBuffer buffer(&source->bytes);
+    QImageReader reader(&buffer);
+    source->format = reader.format().toLower();
+    source->size = reader.size();
+    if (!source->size.isValid()) {
+        source->image = QImage::fromData(source->bytes);
+        if (source->image.isNull())
+            return false;
+        source->size = source->image.size();
+    }
+    return true;
+}
+
+// The local file an image name refers to, resolved the way the document
+// would load it, or an empty string.
+QString localFile(const QTextDocument *document, const QString &name)
+{
+    if (name.startsWith(QLatin1String(":/")) || QFileInfo(name).isAbsolute())
+        return name;
+    QUrl url(name);
+    if (url.scheme() == QLatin1String("qrc"))
+        return QLatin1Char(':') + url.path();
+    if (url.isRelative()) {
+        // Snapshots keep the document URL, not the base URL.
+        QUrl base = document->baseUrl();
+        if (base.isEmpty())
+            base = QUrl(document->metaInformation(QTextDocument::DocumentUrl));
+        if (base.isEmpty())
+            base = QUrl::fromLocalFile(QDir::currentPath() + QLatin1Char('/'));
+        url = base.resolved(url);
+    }
+    return url.isLocalFile() ? url.toLocalFile() : QString();
+}
+
+// Finds the image of \a name the way QTextOdfWriter does. An image file
+// is only looked at here and keyed on its path, time and size;
+// readImage() reads it when that key is new.
+bool resolveImage(QTextDocument *document, const QString &name, ImageSource *source)
+{
+    source->url = QUrl(name.startsWith(QLatin1String(":/")) ? QLatin1String("qrc") + name : name);
+    const QString path = localFile(document, name);
+    const QFileInfo info(path);
+    if (!path.isEmpty() && info.isFile()) {
+        source->path = path;
+        source->key = QStringLiteral("%1@%2-%3").arg(path).arg(info.lastModified().toMSecsSinceEpoch()).arg(info.size());
+        return true;
+    }
+    source->original = document->resource(QTextDocument::ImageResource, source->url);
+    if (source->original.type() == QVariant::Image) {
+        source->image = qvariant_cast<QImage>(source->original);
+        source->key = QString::number(source->image.cacheKey());
+    } else if (source->original.type() == QVariant::ByteArray) {
+        source->bytes = source->original.toByteArray();
+        source->key = QStringLiteral("%1-%2").arg(qHash(source->bytes)).arg(source->bytes.size());
+    }
+    if (source->image.isNull() && (source->bytes.isEmpty() || !probeImage(source)))
+        return false;
+    if (!source->image.isNull())
+        source->size = source->image.size();
+    source->key.prepend(name + QLatin1Char('@'));
+    return true;
+}
+
+bool readImage(ImageSource *source)
+{
+    QFile file(source->path);
+    if (!file.open(QFile::ReadOnly))
+        return false;
+    source->bytes = file.readAll();
+    return probeImage(source);
+}
+
+// The media type encoded data is stored with as it is, or an empty one if
+// it has to be encoded as PNG.
+QByteArray storedMediaType(const ImageSource &source)
+{
+    if (source.bytes.isEmpty())
+        return QByteArray();
+    if (source.format == "png")
+        return QByteArrayLiteral("image/png");
+    if (source.format == "jpeg" || source.format == "jpg")
+        return QByteArrayLiteral("image/jpeg");
+    return QByteArray();
+}
+
+// The manifest QTextOdfWriter writes lists every picture as image/png;
+// it is written again with the types the pictures are stored with.
+QByteArray manifest(const QVector<ZipEntry> &entries, const QHash<int, QByteArray> &mediaTypes)
+{
+    const QString ns = QStringLiteral("urn:oasis:names:tc:opendocument:xmlns:manifest:1.0");
+    QByteArray data;
+    QXmlStreamWriter writer(&data);
+    writer.setAutoFormatting(true);
+    writer.writeNamespace(ns, QStringLiteral("manifest"));
+    writer.writeStartDocument();
+    writer.writeStartElement(ns, QStringLiteral("manifest"));
+    writer.writeAttribute(ns, QStringLiteral("version"), QStringLiteral("1.2"));
+    writer.writeEmptyElement(ns, QStringLiteral("file-entry"));
+    writer.writeAttribute(ns, QStringLiteral("media-type"), QStringLiteral("application/vnd.oasis.opendocument.text"));
+    writer.writeAttribute(ns, QStringLiteral("version"), QStringLiteral("1.2"));
+    writer.writeAttribute(ns, QStringLiteral("full-path"), QStringLiteral("/"));
+    for (int i = 0; i < entries.size(); ++i) {
+        const QByteArray &name = entries.at(i).name;
+        if (name == "mimetype" || name.startsWith("META-INF/"))
+            continue;
+        QByteArray type = mediaTypes.value(i);
+        if (type.isEmpty())
+            type = name.endsWith(".xml") ? QByteArrayLiteral("text/xml") : QByteArrayLiteral("application/octet-stream");
+        writer.writeEmptyElement(ns, QStringLiteral("file-entry"));
+        writer.writeAttribute(ns, QStringLiteral("media-type"), QString::fromLatin1(type));
+        writer.writeAttribute(ns, QStringLiteral("full-path"), QString::fromUtf8(name));
+    }
+    writer.writeEndDocument();
+    return data;
+}
+}
+
+bool OdtWriter::write(const QString &fileName, QTextDocument *document)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    // The writer stores an image for every fragment that is a single
+    // object replacement character with a resolvable image, in document
+    // order.
+    QVector<ImageSource> sources;
+    QVector<ImageUse> uses;
+    QHash<QString, int> sourceOf;
+    for (QTextBlock block = document->begin(); block.isValid(); block = block.next()) {
+        for (QTextBlock::iterator it = block.begin(); !it.atEnd(); ++it) {
+            const QTextFragment fragment = it.fragment();
+            if (!fragment.charFormat().isImageFormat() || fragment.text() != QString(QChar::ObjectReplacementCharacter))
+                continue;
+            const QTextImageFormat format = fragment.charFormat().toImageFormat();
+            QHash<QString, int>::const_iterator known = sourceOf.constFind(format.name());
+            if (known == sourceOf.constEnd()) {
+                ImageSource source;
+                bool resolved = resolveImage(document, format.name(), &source);
+                if (resolved && !source.path.isEmpty()) {
+                    QHash<QString, ImageEntry>::const_iterator image = images.constFind(source.key);
+                    if (image != images.constEnd())
+                        source.size = image->size;
+                    else
+                        resolved = readImage(&source);
+                }
+                if (resolved)
+                    sources.append(source);
+                known = sourceOf.insert(format.name(), resolved ? sources.size() - 1 : -1);
+            }
+            if (known.value() < 0)
+                continue;
+            const ImageUse use = { fragment.position(), known.value(), format };
+            uses.append(use);
+        }
+    }
+    if (uses.isEmpty())
+        return DocumentSaver::writeDocument(fileName, document);
+
+    // The writer takes the size of an image from its format before the
+    // image itself, so the placeholders keep the real sizes.
+    QTextCursor cursor(document);
+    foreach (const ImageUse &use, uses) {
+        const QSize size = sources.at(use.source).size;
+        QTextImageFormat format;
+        bool sized = false;
+        if (!use.format.hasProperty(QTextFormat::ImageWidth)) {
+            format.setWidth(size.width());
+            sized = true;
+        }
+        if (!use.format.hasProperty(QTextFormat::ImageHeight)) {
+            format.setHeight(size.height());
+            sized = true;
+        }
+        if (!sized)
+            continue;
+        cursor.setPosition(use.position);
+        cursor.setPosition(use.position + 1, QTextCursor::KeepAnchor);
+        cursor.mergeCharFormat(format);
+    }
+    QImage placeholder(1, 1, QImage::Format_ARGB32);
+    placeholder.fill(Qt::transparent);
+    foreach (const ImageSource &source, sources)
+        document->addResource(QTextDocument::ImageResource, source.url, placeholder);
+
+    QBuffer package;
+    package.open(QBuffer::WriteOnly);
+    QVector<ZipEntry> entries;
+    QVector<int> pictures;
+    if (QTextDocumentWriter(&package, "odf").write(document) && readZip(package.data(), &entries)) {
+        for (int i = 0; i < entries.size(); ++i) {
+            if (entries.at(i).name.startsWith("Pictures/"))
+                pictures.append(i);
+        }
+    }
+    package.close();
+    if (pictures.size() != uses.size()) {
+        // Not the package that was expected; written again the usual way.
+        qCWarning(lcPerf) << "unexpected ODF package layout, writing" << fileName << "in full";
+        foreach (const ImageSource &source, sources)
+            document->addResource(QTextDocument::ImageResource, source.url, source.original);
+        images.clear();
+        return DocumentSaver::writeDocument(fileName, document);
+    }
+
+    QHash<QString, ImageEntry> kept;
+    QHash<int, QByteArray> mediaTypes;
+    int reused = 0;
+    for (int i = 0; i < pictures.size(); ++i) {
+        const ImageSource &source = sources.at(uses.at(i).source);
+        ImageEntry image = kept.value(source.key, images.value(source.key));
+        if (image.data.isEmpty()) {
+            image.mediaType = storedMediaType(source);
+            image.size = source.size;
+            if (!image.mediaType.isEmpty()) {
+                image.data = source.bytes;
+            } else {
+                QBuffer buffer(&image.data);
+                buffer.open(QBuffer::WriteOnly);
+                QImageWriter(&buffer, "png").write(source.image.isNull() ? QImage::fromData(source.bytes) : source.image);
+                buffer.close();
+                image.mediaType = QByteArrayLiteral("image/png");
+            }
+            image.crc = crc32(image.data);
+        } else {
+            ++reused;
+        }
+        kept.insert(source.key, image);
+        mediaTypes.insert(pictures.at(i), image.mediaType);
+
+        // PNG and JPEG data does not get smaller when deflated again.
+        ZipEntry &entry = entries[pictures.at(i)];
+        entry.flags &= kUtf8Names;
+        entry.method = kStored;
+        entry.crc = image.crc;
+        entry.size = image.data.size();
+        entry.data = image.data;
+    }
+    // Images that are no longer used are dropped.
+    images = kept;
+
+    for (int i = 0; i < entries.size(); ++i) {
+        ZipEntry &entry = entries[i];
+        if (entry.name != "META-INF/manifest.xml")
+            continue;
+        entry.data = manifest(entries, mediaTypes);
+        entry.flags &= kUtf8Names;
+        entry.method = kStored;
+        entry.crc = crc32(entry.data);
+        entry.size = entry.data.size();
+    }
+
+    QSaveFile out(fileName);
+    if (!out.open(QFile::WriteOnly) || !writeZip(&out, entries)) {
+        out.cancelWriting();
+        return false;
+    }
+    qCDebug(lcPerf) << "wrote" << fileName << "with" << reused << "of" << pictures.size()
+                    << "images reused in" << timer.elapsed() << "ms";
+    return out.commit();
+}
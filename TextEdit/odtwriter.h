@@ -0,0 +1,42 @@
+#ifndef ODTWRITER_H
+#define ODTWRITER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QSize>
+#include <QString>
+
+QT_BEGIN_NAMESPACE
+class QTextDocument;
+QT_END_NAMESPACE
+
+// Writes OpenDocument text for DocumentSaver without encoding unchanged
+// images again. QTextDocumentWriter is given a placeholder for every image
+// and the package it produces is copied to the file with the placeholders
+// replaced by image entries, which are kept and reused by the next save as
+// long as their resource has not changed; image files are not even read
+// again while their time and size stay the same. PNG and JPEG data is
+// stored as it is; other images are encoded as PNG. Used by one thread at
+// a time.
+class OdtWriter
+{
+public:
+    // May change the formats and resources of \a document, which is
+    // expected to be a snapshot.
+    bool write(const QString &fileName, QTextDocument *document);
+
+private:
+    struct ImageEntry
+    {
+        ImageEntry() : crc(0) {}
+
+        QByteArray data;
+        QByteArray mediaType;
+        QSize size;
+        quint32 crc;
+    };
+
+    QHash<QString, ImageEntry> images;
+};
+
+#endif // ODTWRITER_H
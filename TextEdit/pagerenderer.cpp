@@ -0,0 +1,67 @@
+#include "pagerenderer.h"
+#include <QAbstractTextDocumentLayout>
+#include <QFontMetricsF>
+#include <QPagedPaintDevice>
+#include <QPainter>
+#include <QTextDocument>
+#include <QTextFrame>
+
+PageSetup PageSetup::forDevice(const QPagedPaintDevice *device, const QFont &font)
+{
+    // Documents without a paint device are laid out at the resolution
+    // QPicture records at.
+    const qreal layoutDpi = QPicture().logicalDpiY();
+
+    PageSetup setup;
+    setup.font = font;
+    setup.scale = device->logicalDpiY() / layoutDpi;
+    setup.pageSize = QSizeF(device->width(), device->height()) / setup.scale;
+    setup.margin = (2 / 2.54) * layoutDpi;
+    setup.pageNumberPos = QPointF(setup.pageSize.width() - setup.margin,
+                                  setup.pageSize.height() - setup.margin
+                                  + QFontMetricsF(font).ascent() + 5 * layoutDpi / 72.0);
+    return setup;
+}
+
+void PageRenderer::prepare(QTextDocument *document, const PageSetup &setup)
+{
+    QTextFrameFormat fmt = document->rootFrame()->frameFormat();
+    fmt.setMargin(setup.margin);
+    document->rootFrame()->setFrameFormat(fmt);
+    document->setPageSize(setup.pageSize);
+}
+
+QPicture PageRenderer::render(QTextDocument *document, const PageSetup &setup, int page)
+{
+    const QRectF view(0, page * setup.pageSize.height(),
+                      setup.pageSize.width(), setup.pageSize.height());
+
+    QPicture picture;
+    QPainter painter(&picture);
+    painter.translate(0, -view.top());
+    painter.setClipRect(view);
+
+    QAbstractTextDocumentLayout::PaintContext ctx;
+    ctx.clip = view;
+    ctx.palette.setColor(QPalette::Text, Qt::black);
+    document->documentLayout()->draw(&painter, ctx);
+    painter.end();
+    return picture;
+}
+
+void PageRenderer::paint(QPainter *painter, const PageSetup &setup, const QPicture &page, int number)
+{
+    painter->save();
+    painter->scale(setup.scale, setup.scale);
+    painter->drawPicture(0, 0, page);
+    painter->restore();
+
+    // The page number is drawn in device coordinates so the font is
+    // resolved at the device resolution.
+    painter->save();
+    painter->setFont(setup.font);
+    const QString text = QString::number(number);
+    painter->drawText(qRound(setup.pageNumberPos.x() * setup.scale - painter->fontMetrics().width(text)),
+                      qRound(setup.pageNumberPos.y() * setup.scale), text);
+    painter->restore();
+}
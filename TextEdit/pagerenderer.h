@@ -0,0 +1,42 @@
+#ifndef PAGERENDERER_H
+#define PAGERENDERER_H
+
+#include <QFont>
+#include <QPicture>
+#include <QPointF>
+#include <QSizeF>
+
+QT_BEGIN_NAMESPACE
+class QPainter;
+class QPagedPaintDevice;
+class QTextDocument;
+QT_END_NAMESPACE
+
+// Page geometry for printing a document the way QTextDocument::print does:
+// laid out at screen resolution with 2 cm margins and page numbers in the
+// bottom right corner, then scaled to the device.
+struct PageSetup
+{
+    PageSetup() : margin(0), scale(1) {}
+
+    QSizeF pageSize;
+    qreal margin;
+    // Device pixels per layout unit.
+    qreal scale;
+    QPointF pageNumberPos;
+    QFont font;
+
+    static PageSetup forDevice(const QPagedPaintDevice *device, const QFont &font);
+};
+
+// Renders single pages of a paginated document into resolution independent
+// pictures that can be recorded on any thread and replayed on the device.
+class PageRenderer
+{
+public:
+    static void prepare(QTextDocument *document, const PageSetup &setup);
+    static QPicture render(QTextDocument *document, const PageSetup &setup, int page);
+    static void paint(QPainter *painter, const PageSetup &setup, const QPicture &page, int number);
+};
+
+#endif // PAGERENDERER_H
@@ -0,0 +1,212 @@
+#include "pasteimporter.h"
+#include "perflog.h"
+#include <QMimeData>
+#include <QTextDocument>
+#include <QtConcurrent>
+
+namespace {
+// Smaller clipboard contents are pasted synchronously.
+const int kAsyncPasteChars = 256 * 1024;
+// Characters handed to the HTML importer at a time.
+const int kParseChunk = 1024 * 1024;
+const int kTextChunk = 256 * 1024;
+// Time spent inserting per event loop iteration.
+const int kSliceMs = 12;
+}
+
+PasteImporter::PasteImporter(QObject *parent) :
+    QObject(parent),
+    stop(false),
+    running(false),
+    editing(false),
+    position(0),
+    htmlParsed(false),
+    segmentsInserted(0)
+{
+    insertTimer.setInterval(0);
+    connect(&insertTimer, &QTimer::timeout, this, &PasteImporter::insertSlice);
+    connect(&htmlWatcher, &QFutureWatcher<void>::finished, this, &PasteImporter::parsed);
+    connect(&textWatcher, &QFutureWatcher<QString>::finished, this, &PasteImporter::normalized);
+}
+
+PasteImporter::~PasteImporter()
+{
+    stop = true;
+    htmlWatcher.waitForFinished();
+    textWatcher.waitForFinished();
+}
+
+bool PasteImporter::start(const QTextCursor &at, const QMimeData *source, bool rich)
+{
+    cancel();
+    htmlWatcher.waitForFinished();
+    textWatcher.waitForFinished();
+
+    // The payload is fetched once, here; everything else happens on the
+    // copy.
+    QString html;
+    text.clear();
+    if (rich && source->hasHtml()) {
+        html = source->html();
+        if (html.size() < kAsyncPasteChars)
+            return false;
+    } else if (source->hasText()) {
+        text = source->text();
+        if (text.size() < kAsyncPasteChars) {
+            text.clear();
+            return false;
+        }
+    } else {
+        return false;
+    }
+
+    cursor = at;
+    stop = false;
+    running = true;
+    editing = false;
+    position = 0;
+    htmlParsed = false;
+    segmentsInserted = 0;
+    styleSheet = cursor.document()->defaultStyleSheet();
+    timer.start();
+    emit progress(0);
+    if (!html.isEmpty())
+        htmlWatcher.setFuture(QtConcurrent::run(this, &PasteImporter::parseHtml, html));
+    else
+        textWatcher.setFuture(QtConcurrent::run(&PasteImporter::normalizeText, text));
+    return true;
+}
+
+void PasteImporter::cancel()
+{
+    if (!running)
+        return;
+    stop = true;
+    insertTimer.stop();
+    {
+        QMutexLocker lock(&queueMutex);
+        queue.clear();
+        percents.clear();
+    }
+    text.clear();
+    editing = false;
+    running = false;
+    emit cancelled();
+}
+
+bool PasteImporter::isRunning() const
+{
+    return running;
+}
+
+void PasteImporter::parseHtml(const QString &html)
+{
+    HtmlStreamImporter importer(styleSheet);
+    for (int done = 0; done < html.size() && !stop; done += kParseChunk) {
+        importer.append(html.mid(done, kParseChunk));
+        const bool atEnd = done + kParseChunk >= html.size();
+        if (atEnd)
+            importer.finish();
+        // Parsing is the first half of the progress range.
+        const int percent = int(qint64(qMin(html.size(), done + kParseChunk)) * 50 / html.size());
+        QMutexLocker lock(&queueMutex);
+        while (importer.hasSegment() && !stop) {
+            queue.enqueue(importer.takeSegment());
+            percents.enqueue(percent);
+        }
+        lock.unlock();
+        QMetaObject::invokeMethod(&insertTimer, "start", Qt::QueuedConnection);
+    }
+}
+
+QString PasteImporter::normalizeText(QString text)
+{
+    // QTextCursor::insertText starts a paragraph at every \r as well.
+    text.replace(QLatin1String("\r\n"), QLatin1String("\n"));
+    text.replace(QLatin1Char('\r'), QLatin1Char('\n'));
+    return text;
+}
+
+void PasteImporter::parsed()
+{
+    if (!running || stop)
+        return;
+    htmlParsed = true;
+    qCDebug(lcPerf) << "parsed the pasted HTML in" << timer.elapsed() << "ms";
+    insertTimer.start();
+}
+
+void PasteImporter::normalized()
+{
+    if (!running || stop)
+        return;
+    text = textWatcher.result();
+    qCDebug(lcPerf) << "normalized" << text.size() << "pasted characters in" << timer.elapsed() << "ms";
+    insertTimer.start();
+}
+
+void PasteImporter::insertSlice()
+{
+    if (!running)
+        return;
+    QElapsedTimer budget;
+    budget.start();
+    // One edit block across all slices, so the paste is undone at once.
+    if (editing) {
+        cursor.joinPreviousEditBlock();
+    } else {
+        cursor.beginEditBlock();
+        cursor.removeSelectedText();
+        editing = true;
+    }
+
+    bool done = false;
+    if (!text.isEmpty()) {
+        do {
+            int size = qMin(kTextChunk, text.size() - position);
+            if (position + size < text.size() && text.at(position + size - 1).isHighSurrogate())
+                ++size;
+            cursor.insertText(text.mid(position, size));
+            position += size;
+        } while (position < text.size() && budget.elapsed() < kSliceMs);
+        emit progress(int(qint64(position) * 100 / text.size()));
+        done = position >= text.size();
+    } else {
+        bool empty = false;
+        while (budget.elapsed() < kSliceMs) {
+            HtmlSegment segment;
+            int percent = 0;
+            {
+                QMutexLocker lock(&queueMutex);
+                empty = queue.isEmpty();
+                if (empty)
+                    break;
+                segment = queue.dequeue();
+                percent = percents.dequeue();
+            }
+            // The first segment continues the paragraph at the cursor, as
+            // QTextEdit::paste() would.
+            if (segmentsInserted++ == 0 && !segment.startsWithFrame)
+                cursor.insertFragment(segment.fragment);
+            else
+                HtmlStreamImporter::insert(cursor, segment);
+            emit progress(50 + percent);
+        }
+        if (empty)
+            insertTimer.stop();
+        done = empty && htmlParsed;
+    }
+    cursor.endEditBlock();
+    if (done)
+        finish();
+}
+
+void PasteImporter::finish()
+{
+    insertTimer.stop();
+    running = false;
+    editing = false;
+    text.clear();
+    qCDebug(lcPerf) << "pasted in" << timer.elapsed() << "ms";
+    emit finished(cursor.position());
+}
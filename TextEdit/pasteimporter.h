@@ -0,0 +1,71 @@
+#ifndef PASTEIMPORTER_H
+#define PASTEIMPORTER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QMutex>
+#include <QQueue>
+#include <QTextCursor>
+#include <QTimer>
+#include <atomic>
+#include "htmlstreamimporter.h"
+
+QT_BEGIN_NAMESPACE
+class QMimeData;
+QT_END_NAMESPACE
+
+// Pastes large clipboard contents without blocking the window. HTML is cut
+// into segments and parsed on a worker thread, plain text has its line
+// breaks normalized there; the result is inserted at the cursor in slices
+// from the event loop, all in one edit block.
+class PasteImporter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PasteImporter(QObject *parent = 0);
+    ~PasteImporter();
+
+    // Returns false without doing anything if \a source is small enough
+    // to be pasted the usual way.
+    bool start(const QTextCursor &cursor, const QMimeData *source, bool rich);
+    void cancel();
+    bool isRunning() const;
+
+signals:
+    void progress(int percent);
+    // \a position is the end of the pasted text.
+    void finished(int position);
+    void cancelled();
+
+private slots:
+    void parsed();
+    void normalized();
+    void insertSlice();
+
+private:
+    void parseHtml(const QString &html);
+    static QString normalizeText(QString text);
+    void finish();
+
+    QTextCursor cursor;
+    QFutureWatcher<void> htmlWatcher;
+    QFutureWatcher<QString> textWatcher;
+    std::atomic<bool> stop;
+    bool running;
+    bool editing;
+    QTimer insertTimer;
+
+    QString text;
+    int position;
+
+    QString styleSheet;
+    QMutex queueMutex;
+    QQueue<HtmlSegment> queue;
+    QQueue<int> percents;
+    bool htmlParsed;
+    int segmentsInserted;
+    QElapsedTimer timer;
+};
+
+#endif // PASTEIMPORTER_H
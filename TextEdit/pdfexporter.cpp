@@ -0,0 +1,209 @@
+#include "pdfexporter.h"
+#include "pagerenderer.h"
+#include "perflog.h"
+#include <QFontDatabase>
+#include <QPageLayout>
+#include <QPainter>
+#include <QPdfWriter>
+#include <QSaveFile>
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <QTextDocumentFragment>
+#include <QTextFrame>
+#include <QtConcurrent>
+#include <QtPrintSupport/QPrinter>
+#include <atomic>
+
+namespace {
+QMap<QUrl, QVariant> imagesOf(QTextDocument *document)
+{
+    // Resources added with addResource() are not part of a fragment.
+    // Pixmaps cannot be used off the GUI thread and are loaded again by
+    // name.
+    QMap<QUrl, QVariant> images;
+    for (QTextBlock block = document->begin(); block.isValid(); block = block.next()) {
+        for (QTextBlock::iterator it = block.begin(); !it.atEnd(); ++it) {
+            const QTextCharFormat format = it.fragment().charFormat();
+            if (!format.isImageFormat())
+                continue;
+            const QUrl name(format.toImageFormat().name());
+            if (images.contains(name))
+                continue;
+            const QVariant image = document->resource(QTextDocument::ImageResource, name);
+            if (image.type() == QVariant::Image || image.type() == QVariant::ByteArray)
+                images.insert(name, image);
+        }
+    }
+    return images;
+}
+}
+
+// Everything the worker needs; shared so that a cancelled job can finish
+// on its own while the next one starts.
+struct PdfJob
+{
+    PdfJob() : id(0), resolution(0), stop(false) {}
+
+    int id;
+    QScopedPointer<QTextDocument> source;
+    QString fileName;
+    QPageLayout pageLayout;
+    int resolution;
+    QFont font;
+    std::atomic<bool> stop;
+};
+
+DocumentSettings DocumentSettings::of(const QTextDocument *document)
+{
+    DocumentSettings settings;
+    settings.defaultFont = document->defaultFont();
+    settings.defaultTextOption = document->defaultTextOption();
+    settings.rootFrameFormat = document->rootFrame()->frameFormat();
+    settings.indentWidth = document->indentWidth();
+    settings.useDesignMetrics = document->useDesignMetrics();
+    settings.baseUrl = document->baseUrl();
+    return settings;
+}
+
+void DocumentSettings::apply(QTextDocument *document) const
+{
+    document->setDefaultFont(defaultFont);
+    document->setDefaultTextOption(defaultTextOption);
+    document->rootFrame()->setFrameFormat(rootFrameFormat);
+    document->setIndentWidth(indentWidth);
+    document->setUseDesignMetrics(useDesignMetrics);
+    document->setBaseUrl(baseUrl);
+}
+
+PdfExporter::PdfExporter(QObject *parent) :
+    QObject(parent),
+    jobId(0),
+    running(false)
+{
+    connect(&watcher, &QFutureWatcher<bool>::finished, this, &PdfExporter::written);
+}
+
+PdfExporter::~PdfExporter()
+{
+    if (job)
+        job->stop = true;
+    foreach (QFuture<bool> future, jobs)
+        future.waitForFinished();
+}
+
+bool PdfExporter::isRunning() const
+{
+    return running;
+}
+
+void PdfExporter::start(const QTextDocument *document, const QString &fileName)
+{
+    cancel();
+    for (int i = jobs.size() - 1; i >= 0; --i) {
+        if (jobs.at(i).isFinished())
+            jobs.removeAt(i);
+    }
+
+    timer.start();
+    file = fileName;
+    running = true;
+
+    // The page size and resolution are the ones a PDF printer would use;
+    // a QPrinter cannot be used off the GUI thread.
+    QPrinter printer(QPrinter::HighResolution);
+    printer.setOutputFormat(QPrinter::PdfFormat);
+    job.reset(new PdfJob);
+    job->id = ++jobId;
+    job->source.reset(document->clone());
+    job->fileName = fileName;
+    job->pageLayout = printer.pageLayout();
+    job->resolution = printer.resolution();
+    job->font = document->defaultFont();
+    emit progress(0);
+
+    if (!QFontDatabase::supportsThreadedFontRendering()) {
+        // Text can only be laid out on the GUI thread here.
+        finish(write(job));
+        return;
+    }
+    watcher.setFuture(QtConcurrent::run(this, &PdfExporter::write, job));
+    jobs.append(watcher.future());
+}
+
+void PdfExporter::cancel()
+{
+    if (!running)
+        return;
+    // The worker stops before its next page and discards the file.
+    running = false;
+    job->stop = true;
+    job.reset();
+    emit cancelled();
+}
+
+bool PdfExporter::write(QSharedPointer<PdfJob> job)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    // The clone belongs to the GUI thread, so it is only read here; the
+    // copy is laid out and painted on this thread.
+    QTextDocument document;
+    DocumentSettings::of(job->source.data()).apply(&document);
+    const QMap<QUrl, QVariant> images = imagesOf(job->source.data());
+    for (QMap<QUrl, QVariant>::const_iterator it = images.constBegin(); it != images.constEnd(); ++it)
+        document.addResource(QTextDocument::ImageResource, it.key(), it.value());
+    QTextCursor(&document).insertFragment(QTextDocumentFragment(job->source.data()));
+    job->source.reset();
+
+    QSaveFile out(job->fileName);
+    if (job->stop || !out.open(QIODevice::WriteOnly))
+        return false;
+    QPdfWriter writer(&out);
+    writer.setResolution(job->resolution);
+    writer.setPageLayout(job->pageLayout);
+    const PageSetup setup = PageSetup::forDevice(&writer, job->font);
+    PageRenderer::prepare(&document, setup);
+    const int count = document.pageCount();
+    qCDebug(lcPerf) << "paginated" << count << "pages in" << timer.elapsed() << "ms";
+
+    QPainter painter;
+    if (!painter.begin(&writer))
+        return false;
+    for (int page = 0; page < count; ++page) {
+        if (job->stop) {
+            painter.end();
+            out.cancelWriting();
+            return false;
+        }
+        if (page > 0)
+            writer.newPage();
+        PageRenderer::paint(&painter, setup, PageRenderer::render(&document, setup, page), page + 1);
+        QMetaObject::invokeMethod(this, "pageWritten", Qt::QueuedConnection,
+                                  Q_ARG(int, job->id), Q_ARG(int, page + 1), Q_ARG(int, count));
+    }
+    painter.end();
+    return !job->stop && out.commit();
+}
+
+void PdfExporter::pageWritten(int id, int page, int count)
+{
+    if (running && id == jobId)
+        emit progress(page * 100 / qMax(1, count));
+}
+
+void PdfExporter::written()
+{
+    if (!running)
+        return;
+    finish(watcher.result());
+}
+
+void PdfExporter::finish(bool ok)
+{
+    running = false;
+    job.reset();
+    qCDebug(lcPerf) << "exported" << file << "in" << timer.elapsed() << "ms";
+    emit finished(ok, file, timer.elapsed());
+}
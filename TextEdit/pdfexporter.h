@@ -0,0 +1,74 @@
+#ifndef PDFEXPORTER_H
+#define PDFEXPORTER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QFont>
+#include <QFutureWatcher>
+#include <QList>
+#include <QSharedPointer>
+#include <QTextFrameFormat>
+#include <QTextOption>
+#include <QUrl>
+
+QT_BEGIN_NAMESPACE
+class QTextDocument;
+QT_END_NAMESPACE
+
+struct PdfJob;
+
+// Document wide settings a copy needs to lay out like the original.
+struct DocumentSettings
+{
+    QFont defaultFont;
+    QTextOption defaultTextOption;
+    QTextFrameFormat rootFrameFormat;
+    qreal indentWidth;
+    bool useDesignMetrics;
+    QUrl baseUrl;
+
+    static DocumentSettings of(const QTextDocument *document);
+    void apply(QTextDocument *document) const;
+};
+
+// Exports a document to PDF without blocking the window. A clone is taken
+// on the GUI thread; a worker copies it into a document of its own,
+// paginates that once exactly like the original and streams the pages in
+// order to a QPdfWriter, which writes to a temporary file that replaces
+// the target only when every page is written. Cancelling is noticed
+// before the next page.
+class PdfExporter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PdfExporter(QObject *parent = 0);
+    ~PdfExporter();
+
+    void start(const QTextDocument *document, const QString &fileName);
+    void cancel();
+    bool isRunning() const;
+
+signals:
+    void progress(int percent);
+    void finished(bool ok, const QString &fileName, qint64 elapsed);
+    void cancelled();
+
+private slots:
+    void pageWritten(int id, int page, int count);
+    void written();
+
+private:
+    bool write(QSharedPointer<PdfJob> job);
+    void finish(bool ok);
+
+    QString file;
+    QSharedPointer<PdfJob> job;
+    QFutureWatcher<bool> watcher;
+    // Cancelled jobs finish on their own, but report to this object.
+    QList<QFuture<bool> > jobs;
+    int jobId;
+    bool running;
+    QElapsedTimer timer;
+};
+
+#endif // PDFEXPORTER_H
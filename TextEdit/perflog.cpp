@@ -0,0 +1,25 @@
+#include "perflog.h"
+#include <QElapsedTimer>
+
+Q_LOGGING_CATEGORY(lcPerf, "textedit.perf", QtWarningMsg)
+
+namespace {
+// Started during static initialization, before main().
+struct StartupClock
+{
+    StartupClock() : last(0) { timer.start(); }
+
+    QElapsedTimer timer;
+    qint64 last;
+};
+
+StartupClock startupClock;
+}
+
+void traceStartup(const char *phase)
+{
+    const qint64 now = startupClock.timer.elapsed();
+    qCDebug(lcPerf) << "startup:" << phase << "took" << now - startupClock.last
+                    << "ms," << now << "ms since start";
+    startupClock.last = now;
+}
@@ -0,0 +1,14 @@
+#ifndef PERFLOG_H
+#define PERFLOG_H
+
+#include <QLoggingCategory>
+
+// Timings of the expensive document paths. Enable with
+// QT_LOGGING_RULES="textedit.perf.debug=true".
+Q_DECLARE_LOGGING_CATEGORY(lcPerf)
+
+// Logs the time spent in a startup phase since the previous one, and the
+// time since the process started.
+void traceStartup(const char *phase);
+
+#endif // PERFLOG_H
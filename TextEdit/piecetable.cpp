@@ -0,0 +1,375 @@
+#include "piecetable.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// A node and the control block of its shared pointer, on a 64 bit build.
+const qint64 kNodeBytes = 96;
+}
+
+PieceTable::PieceTable() :
+    forcedModified(false),
+    seed(2463534242u)
+{
+}
+
+PieceTable::PieceTable(const QString &text) :
+    forcedModified(false),
+    seed(2463534242u)
+{
+    setText(text);
+}
+
+void PieceTable::setText(const QString &text)
+{
+    original = text;
+    added.clear();
+    originalNewlines.clear();
+    addedNewlines.clear();
+
+    const QChar *data = original.constData();
+    for (int i = 0; i < original.size(); ++i) {
+        if (data[i] == QLatin1Char('\n'))
+            originalNewlines.append(i);
+    }
+
+    root.clear();
+    if (!original.isEmpty()) {
+        Piece piece = { false, 0, original.size(), originalNewlines.size() };
+        root = leaf(piece);
+    }
+    savedRoot = root;
+    forcedModified = false;
+    undoStack.clear();
+    redoStack.clear();
+}
+
+int PieceTable::length() const
+{
+    return lengthOf(root);
+}
+
+int PieceTable::lineCount() const
+{
+    return newlinesOf(root) + 1;
+}
+
+int PieceTable::pieceCount() const
+{
+    return countOf(root);
+}
+
+qint64 PieceTable::residentBytes() const
+{
+    return qint64(original.capacity() + added.capacity()) * sizeof(QChar)
+            + qint64(originalNewlines.capacity() + addedNewlines.capacity()) * sizeof(int)
+            + qint64(pieceCount()) * kNodeBytes;
+}
+
+qint64 PieceTable::historyBytes() const
+{
+    const qint64 path = 2 * qint64(std::ceil(std::log2(pieceCount() + 1.0))) + 1;
+    return qint64(undoStack.size() + redoStack.size()) * path * kNodeBytes;
+}
+
+QString PieceTable::text() const
+{
+    return text(0, length());
+}
+
+QString PieceTable::text(int position, int length) const
+{
+    QString out;
+    position = qBound(0, position, lengthOf(root));
+    length = qBound(0, length, lengthOf(root) - position);
+    out.reserve(length);
+    collect(root, position, length, out);
+    return out;
+}
+
+QChar PieceTable::at(int position) const
+{
+    const QString c = text(position, 1);
+    return c.isEmpty() ? QChar() : c.at(0);
+}
+
+void PieceTable::collect(const NodePtr &node, int position, int length, QString &out) const
+{
+    if (!node || length <= 0)
+        return;
+
+    const int pieceStart = lengthOf(node->left);
+    const int pieceEnd = pieceStart + node->piece.length;
+    if (position < pieceStart)
+        collect(node->left, position, qMin(length, pieceStart - position), out);
+
+    const int from = qMax(position, pieceStart);
+    const int to = qMin(position + length, pieceEnd);
+    if (from < to) {
+        const QString &buffer = node->piece.added ? added : original;
+        out.append(buffer.midRef(node->piece.start + from - pieceStart, to - from));
+    }
+
+    if (position + length > pieceEnd) {
+        const int rightFrom = qMax(position, pieceEnd);
+        collect(node->right, rightFrom - pieceEnd, position + length - rightFrom, out);
+    }
+}
+
+int PieceTable::newlinesIn(bool inAdded, int start, int length) const
+{
+    const QVector<int> &index = inAdded ? addedNewlines : originalNewlines;
+    QVector<int>::const_iterator first = std::lower_bound(index.constBegin(), index.constEnd(), start);
+    QVector<int>::const_iterator last = std::lower_bound(first, index.constEnd(), start + length);
+    return int(last - first);
+}
+
+// Returns the document position of the newline number \a index (1-based).
+int PieceTable::newlinePosition(int index) const
+{
+    NodePtr node = root;
+    int base = 0;
+    while (node) {
+        const int leftNewlines = newlinesOf(node->left);
+        if (index <= leftNewlines) {
+            node = node->left;
+            continue;
+        }
+        index -= leftNewlines;
+        base += lengthOf(node->left);
+
+        const Piece &piece = node->piece;
+        if (index <= piece.newlines) {
+            const QVector<int> &newlines = piece.added ? addedNewlines : originalNewlines;
+            QVector<int>::const_iterator it = std::lower_bound(newlines.constBegin(), newlines.constEnd(), piece.start);
+            return base + *(it + index - 1) - piece.start;
+        }
+        index -= piece.newlines;
+        base += piece.length;
+        node = node->right;
+    }
+    return -1;
+}
+
+int PieceTable::lineStart(int line) const
+{
+    if (line <= 0)
+        return 0;
+    if (line >= lineCount())
+        return length();
+    return newlinePosition(line) + 1;
+}
+
+int PieceTable::lineLength(int line) const
+{
+    if (line < 0 || line >= lineCount())
+        return 0;
+    const int end = line + 1 < lineCount() ? newlinePosition(line + 1) : length();
+    return end - lineStart(line);
+}
+
+int PieceTable::lineAt(int position) const
+{
+    int result = 0;
+    NodePtr node = root;
+    while (node) {
+        const int leftLength = lengthOf(node->left);
+        if (position <= leftLength) {
+            node = node->left;
+            continue;
+        }
+        result += newlinesOf(node->left);
+        position -= leftLength;
+
+        const Piece &piece = node->piece;
+        if (position <= piece.length)
+            return result + newlinesIn(piece.added, piece.start, position);
+        result += piece.newlines;
+        position -= piece.length;
+        node = node->right;
+    }
+    return result;
+}
+
+QString PieceTable::line(int line) const
+{
+    QString text = this->text(lineStart(line), lineLength(line));
+    if (text.endsWith(QLatin1Char('\r')))
+        text.chop(1);
+    return text;
+}
+
+void PieceTable::insert(int position, const QString &text, bool mergeUndo)
+{
+    if (text.isEmpty())
+        return;
+    position = qBound(0, position, length());
+    pushUndo(mergeUndo);
+
+    const int start = added.size();
+    added.append(text);
+    const QChar *data = text.constData();
+    for (int i = 0; i < text.size(); ++i) {
+        if (data[i] == QLatin1Char('\n'))
+            addedNewlines.append(start + i);
+    }
+
+    Piece piece = { true, start, text.size(), newlinesIn(true, start, text.size()) };
+    NodePtr left, right;
+    split(root, position, left, right);
+    root = merge(merge(left, leaf(piece)), right);
+}
+
+void PieceTable::remove(int position, int length, bool mergeUndo)
+{
+    position = qBound(0, position, this->length());
+    length = qBound(0, length, this->length() - position);
+    if (length == 0)
+        return;
+    pushUndo(mergeUndo);
+
+    NodePtr left, middle, removed, right;
+    split(root, position, left, middle);
+    split(middle, length, removed, right);
+    root = merge(left, right);
+}
+
+bool PieceTable::isUndoAvailable() const
+{
+    return !undoStack.isEmpty();
+}
+
+bool PieceTable::isRedoAvailable() const
+{
+    return !redoStack.isEmpty();
+}
+
+void PieceTable::undo()
+{
+    if (undoStack.isEmpty())
+        return;
+    redoStack.append(root);
+    root = undoStack.takeLast();
+}
+
+void PieceTable::redo()
+{
+    if (redoStack.isEmpty())
+        return;
+    undoStack.append(root);
+    root = redoStack.takeLast();
+}
+
+void PieceTable::clearUndoRedoStacks()
+{
+    undoStack.clear();
+    redoStack.clear();
+}
+
+bool PieceTable::isModified() const
+{
+    return forcedModified || root != savedRoot;
+}
+
+void PieceTable::setModified(bool modified)
+{
+    savedRoot = root;
+    forcedModified = modified;
+}
+
+void PieceTable::setSavedState(const PieceTable &snapshot)
+{
+    savedRoot = snapshot.root;
+    forcedModified = false;
+}
+
+void PieceTable::pushUndo(bool mergeUndo)
+{
+    if (!mergeUndo || undoStack.isEmpty())
+        undoStack.append(root);
+    redoStack.clear();
+}
+
+quint32 PieceTable::nextPriority()
+{
+    // xorshift32
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+PieceTable::Piece PieceTable::subPiece(const Piece &piece, int offset, int length) const
+{
+    Piece part = { piece.added, piece.start + offset, length,
+                   newlinesIn(piece.added, piece.start + offset, length) };
+    return part;
+}
+
+PieceTable::NodePtr PieceTable::leaf(const Piece &piece)
+{
+    Node *node = new Node;
+    node->piece = piece;
+    node->priority = nextPriority();
+    node->length = piece.length;
+    node->newlines = piece.newlines;
+    node->count = 1;
+    return NodePtr(node);
+}
+
+PieceTable::NodePtr PieceTable::withChildren(const NodePtr &node, const NodePtr &left, const NodePtr &right) const
+{
+    Node *copy = new Node;
+    copy->left = left;
+    copy->right = right;
+    copy->piece = node->piece;
+    copy->priority = node->priority;
+    copy->length = lengthOf(left) + node->piece.length + lengthOf(right);
+    copy->newlines = newlinesOf(left) + node->piece.newlines + newlinesOf(right);
+    copy->count = countOf(left) + 1 + countOf(right);
+    return NodePtr(copy);
+}
+
+// Nodes are never modified in place; every change copies the path from
+// the root, which keeps older roots intact for undo.
+void PieceTable::split(const NodePtr &node, int position, NodePtr &left, NodePtr &right)
+{
+    if (!node) {
+        left.clear();
+        right.clear();
+        return;
+    }
+
+    const int pieceStart = lengthOf(node->left);
+    const int pieceEnd = pieceStart + node->piece.length;
+    NodePtr a, b;
+    if (position <= pieceStart) {
+        split(node->left, position, a, b);
+        right = withChildren(node, b, node->right);
+        left = a;
+    } else if (position >= pieceEnd) {
+        split(node->right, position - pieceEnd, a, b);
+        left = withChildren(node, node->left, a);
+        right = b;
+    } else {
+        const int offset = position - pieceStart;
+        const Piece &piece = node->piece;
+        const NodePtr first = leaf(subPiece(piece, 0, offset));
+        const NodePtr second = leaf(subPiece(piece, offset, piece.length - offset));
+        const NodePtr nodeLeft = node->left;
+        const NodePtr nodeRight = node->right;
+        left = merge(nodeLeft, first);
+        right = merge(second, nodeRight);
+    }
+}
+
+PieceTable::NodePtr PieceTable::merge(const NodePtr &left, const NodePtr &right) const
+{
+    if (!left)
+        return right;
+    if (!right)
+        return left;
+    if (left->priority > right->priority)
+        return withChildren(left, left->left, merge(left->right, right));
+    return withChildren(right, merge(left, right->left), right->right);
+}
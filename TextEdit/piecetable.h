@@ -0,0 +1,104 @@
+#ifndef PIECETABLE_H
+#define PIECETABLE_H
+
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+// Plain text storage as a sequence of pieces that point into two buffers:
+// the original text, which is shared and never copied, and an append-only
+// buffer holding everything typed since. The pieces live in an immutable
+// treap, so insert and remove are O(log n) and every old root is still a
+// valid document; undo and redo just swap roots.
+class PieceTable
+{
+public:
+    PieceTable();
+    explicit PieceTable(const QString &text);
+
+    void setText(const QString &text);
+
+    int length() const;
+    int lineCount() const;
+    QString text() const;
+    QString text(int position, int length) const;
+    QChar at(int position) const;
+
+    // Position of the first character of \a line.
+    int lineStart(int line) const;
+    int lineLength(int line) const;
+    int lineAt(int position) const;
+    QString line(int line) const;
+
+    // With \a mergeUndo the edit extends the previous undo step.
+    void insert(int position, const QString &text, bool mergeUndo = false);
+    void remove(int position, int length, bool mergeUndo = false);
+
+    bool isUndoAvailable() const;
+    bool isRedoAvailable() const;
+    void undo();
+    void redo();
+    void clearUndoRedoStacks();
+
+    bool isModified() const;
+    void setModified(bool modified);
+    // Marks the state of \a snapshot, a copy of this table, as saved.
+    void setSavedState(const PieceTable &snapshot);
+
+    int pieceCount() const;
+    // Bytes held by the buffers and the current tree.
+    qint64 residentBytes() const;
+    // Undo and redo states share all but the path to their edit with the
+    // current tree; this estimates those paths.
+    qint64 historyBytes() const;
+
+private:
+    struct Piece
+    {
+        bool added;
+        int start;
+        int length;
+        int newlines;
+    };
+    struct Node;
+    typedef QSharedPointer<const Node> NodePtr;
+    struct Node
+    {
+        NodePtr left;
+        NodePtr right;
+        Piece piece;
+        quint32 priority;
+        int length;
+        int newlines;
+        int count;
+    };
+
+    NodePtr leaf(const Piece &piece);
+    NodePtr withChildren(const NodePtr &node, const NodePtr &left, const NodePtr &right) const;
+    void split(const NodePtr &node, int position, NodePtr &left, NodePtr &right);
+    NodePtr merge(const NodePtr &left, const NodePtr &right) const;
+    Piece subPiece(const Piece &piece, int offset, int length) const;
+    int newlinesIn(bool inAdded, int start, int length) const;
+    int newlinePosition(int index) const;
+    void collect(const NodePtr &node, int position, int length, QString &out) const;
+    void pushUndo(bool mergeUndo);
+    quint32 nextPriority();
+
+    static int lengthOf(const NodePtr &node) { return node ? node->length : 0; }
+    static int newlinesOf(const NodePtr &node) { return node ? node->newlines : 0; }
+    static int countOf(const NodePtr &node) { return node ? node->count : 0; }
+
+    QString original;
+    QString added;
+    QVector<int> originalNewlines;
+    QVector<int> addedNewlines;
+
+    NodePtr root;
+    NodePtr savedRoot;
+    QVector<NodePtr> undoStack;
+    QVector<NodePtr> redoStack;
+    bool forcedModified;
+    quint32 seed;
+};
+
+#endif // PIECETABLE_H
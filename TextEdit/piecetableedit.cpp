@@ -0,0 +1,583 @@
+#include "piecetableedit.h"
+#include <QApplication>
+#include <QClipboard>
+#include <QFontDatabase>
+#include <QInputMethodEvent>
+#include <QKeyEvent>
+#include <QMimeData>
+#include <QPainter>
+#include <QScrollBar>
+#include <QTextBoundaryFinder>
+
+namespace {
+QString expandTabs(const QString &text)
+{
+    if (!text.contains(QLatin1Char('\t')))
+        return text;
+    QString expanded = text;
+    return expanded.replace(QLatin1Char('\t'), QLatin1String("    "));
+}
+}
+
+PieceTableEdit::PieceTableEdit(QWidget *parent) :
+    QAbstractScrollArea(parent),
+    preeditCursor(0),
+    cursor(0),
+    anchor(0),
+    preferredColumn(-1),
+    typingEnd(-1),
+    widestLine(0),
+    wasModified(false),
+    hadUndo(false),
+    hadRedo(false),
+    hadSelection(false)
+{
+    setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    setFocusPolicy(Qt::StrongFocus);
+    setAttribute(Qt::WA_InputMethodEnabled);
+    viewport()->setCursor(Qt::IBeamCursor);
+    viewport()->setBackgroundRole(QPalette::Base);
+    viewport()->setAutoFillBackground(true);
+}
+
+PieceTableEdit::~PieceTableEdit()
+{
+}
+
+void PieceTableEdit::setPlainText(const QString &text)
+{
+    table.setText(text);
+    preedit.clear();
+    cursor = anchor = 0;
+    preferredColumn = typingEnd = -1;
+    widestLine = 0;
+    verticalScrollBar()->setValue(0);
+    horizontalScrollBar()->setValue(0);
+    contentsChanged();
+}
+
+QString PieceTableEdit::toPlainText() const
+{
+    return table.text();
+}
+
+const PieceTable &PieceTableEdit::pieceTable() const
+{
+    return table;
+}
+
+bool PieceTableEdit::isModified() const
+{
+    return table.isModified();
+}
+
+void PieceTableEdit::setModified(bool modified)
+{
+    table.setModified(modified);
+    contentsChanged();
+}
+
+void PieceTableEdit::setSavedState(const PieceTable &snapshot)
+{
+    table.setSavedState(snapshot);
+    contentsChanged();
+}
+
+bool PieceTableEdit::isUndoAvailable() const
+{
+    return table.isUndoAvailable();
+}
+
+bool PieceTableEdit::isRedoAvailable() const
+{
+    return table.isRedoAvailable();
+}
+
+bool PieceTableEdit::hasSelection() const
+{
+    return cursor != anchor;
+}
+
+int PieceTableEdit::selectionStart() const
+{
+    return qMin(cursor, anchor);
+}
+
+int PieceTableEdit::selectionEnd() const
+{
+    return qMax(cursor, anchor);
+}
+
+void PieceTableEdit::undo()
+{
+    table.undo();
+    cursor = anchor = qMin(cursor, table.length());
+    typingEnd = -1;
+    contentsChanged();
+}
+
+void PieceTableEdit::redo()
+{
+    table.redo();
+    cursor = anchor = qMin(cursor, table.length());
+    typingEnd = -1;
+    contentsChanged();
+}
+
+void PieceTableEdit::copy()
+{
+#ifndef QT_NO_CLIPBOARD
+    if (hasSelection())
+        QApplication::clipboard()->setText(table.text(selectionStart(), selectionEnd() - selectionStart()));
+#endif
+}
+
+void PieceTableEdit::cut()
+{
+    copy();
+    removeSelection();
+    contentsChanged();
+}
+
+void PieceTableEdit::paste()
+{
+#ifndef QT_NO_CLIPBOARD
+    const QString text = QApplication::clipboard()->text();
+    if (!text.isEmpty())
+        insertText(text);
+#endif
+}
+
+void PieceTableEdit::selectAll()
+{
+    anchor = 0;
+    cursor = table.length();
+    viewport()->update();
+    contentsChanged();
+}
+
+void PieceTableEdit::clear()
+{
+    setPlainText(QString());
+}
+
+void PieceTableEdit::removeSelection()
+{
+    if (!hasSelection())
+        return;
+    const int start = selectionStart();
+    table.remove(start, selectionEnd() - start);
+    cursor = anchor = start;
+    typingEnd = -1;
+}
+
+void PieceTableEdit::insertText(const QString &text, bool typing)
+{
+    // Consecutive keystrokes are one undo step, like in QTextEdit.
+    const bool merge = typing && !hasSelection() && cursor == typingEnd;
+    removeSelection();
+    QString normalized = text;
+    normalized.replace(QLatin1String("\r\n"), QLatin1String("\n"));
+    table.insert(cursor, normalized, merge);
+    cursor = anchor = cursor + normalized.size();
+    typingEnd = typing ? cursor : -1;
+    preferredColumn = -1;
+    contentsChanged();
+}
+
+void PieceTableEdit::moveCursor(int position, bool keepAnchor)
+{
+    cursor = qBound(0, position, table.length());
+    if (!keepAnchor)
+        anchor = cursor;
+    typingEnd = -1;
+    ensureCursorVisible();
+    viewport()->update();
+    if (hadSelection != hasSelection()) {
+        hadSelection = hasSelection();
+        emit copyAvailable(hadSelection);
+    }
+    updateMicroFocus();
+    emit cursorPositionChanged();
+}
+
+void PieceTableEdit::moveVertically(int lines, bool keepAnchor)
+{
+    const int line = table.lineAt(cursor);
+    if (preferredColumn < 0)
+        preferredColumn = cursor - table.lineStart(line);
+    const int target = qBound(0, line + lines, table.lineCount() - 1);
+    const int column = qMin(preferredColumn, table.line(target).size());
+    const int keep = preferredColumn;
+    moveCursor(table.lineStart(target) + column, keepAnchor);
+    preferredColumn = keep;
+}
+
+int PieceTableEdit::previousPosition(int position) const
+{
+    // Whole graphemes, so that surrogate pairs and combining marks are
+    // never split.
+    const int line = table.lineAt(position);
+    const int start = table.lineStart(line);
+    if (position <= start)
+        return qMax(0, position - 1);
+    QTextBoundaryFinder finder(QTextBoundaryFinder::Grapheme, table.line(line));
+    finder.setPosition(position - start);
+    const int previous = finder.toPreviousBoundary();
+    return previous < 0 ? position - 1 : start + previous;
+}
+
+int PieceTableEdit::nextPosition(int position) const
+{
+    const int line = table.lineAt(position);
+    const int start = table.lineStart(line);
+    const QString text = table.line(line);
+    if (position >= start + text.size())
+        return qMin(table.length(), position + 1);
+    QTextBoundaryFinder finder(QTextBoundaryFinder::Grapheme, text);
+    finder.setPosition(position - start);
+    const int next = finder.toNextBoundary();
+    return next < 0 ? position + 1 : start + next;
+}
+
+QRect PieceTableEdit::cursorRect() const
+{
+    const int line = table.lineAt(cursor);
+    const int lineSpacing = fontMetrics().lineSpacing();
+    const int x = 4 - horizontalScrollBar()->value()
+            + xForColumn(table.line(line), cursor - table.lineStart(line));
+    const int y = (line - verticalScrollBar()->value()) * lineSpacing;
+    return QRect(viewport()->pos() + QPoint(x, y), QSize(1, lineSpacing));
+}
+
+void PieceTableEdit::contentsChanged()
+{
+    updateScrollBars();
+    ensureCursorVisible();
+    viewport()->update();
+
+    if (wasModified != table.isModified()) {
+        wasModified = table.isModified();
+        emit modificationChanged(wasModified);
+    }
+    if (hadUndo != table.isUndoAvailable()) {
+        hadUndo = table.isUndoAvailable();
+        emit undoAvailable(hadUndo);
+    }
+    if (hadRedo != table.isRedoAvailable()) {
+        hadRedo = table.isRedoAvailable();
+        emit redoAvailable(hadRedo);
+    }
+    if (hadSelection != hasSelection()) {
+        hadSelection = hasSelection();
+        emit copyAvailable(hadSelection);
+    }
+    updateMicroFocus();
+    emit textChanged();
+    emit cursorPositionChanged();
+}
+
+int PieceTableEdit::visibleLines() const
+{
+    return qMax(1, viewport()->height() / fontMetrics().lineSpacing());
+}
+
+void PieceTableEdit::updateScrollBars()
+{
+    const int page = visibleLines();
+    verticalScrollBar()->setPageStep(page);
+    verticalScrollBar()->setRange(0, qMax(0, table.lineCount() - page));
+    horizontalScrollBar()->setPageStep(viewport()->width());
+    horizontalScrollBar()->setSingleStep(fontMetrics().averageCharWidth());
+    horizontalScrollBar()->setRange(0, qMax(0, widestLine - viewport()->width()));
+}
+
+void PieceTableEdit::ensureCursorVisible()
+{
+    const int line = table.lineAt(cursor);
+    const int first = verticalScrollBar()->value();
+    const int page = visibleLines();
+    if (line < first)
+        verticalScrollBar()->setValue(line);
+    else if (line >= first + page)
+        verticalScrollBar()->setValue(line - page + 1);
+
+    const QString text = table.line(line);
+    const int x = xForColumn(text, cursor - table.lineStart(line));
+    QScrollBar *h = horizontalScrollBar();
+    if (x > widestLine) {
+        widestLine = x + 8;
+        h->setRange(0, qMax(0, widestLine - viewport()->width()));
+    }
+    if (x < h->value())
+        h->setValue(x);
+    else if (x > h->value() + viewport()->width() - 8)
+        h->setValue(x - viewport()->width() + 8);
+}
+
+int PieceTableEdit::xForColumn(const QString &line, int column) const
+{
+    return fontMetrics().width(expandTabs(line.left(column)));
+}
+
+int PieceTableEdit::columnForX(const QString &line, int x) const
+{
+    const QFontMetrics fm = fontMetrics();
+    QTextBoundaryFinder finder(QTextBoundaryFinder::Grapheme, line);
+    int column = 0;
+    int left = 0;
+    while (column < line.size()) {
+        const int next = finder.toNextBoundary();
+        if (next < 0)
+            break;
+        const int right = fm.width(expandTabs(line.left(next)));
+        if (x < (left + right) / 2)
+            return column;
+        left = right;
+        column = next;
+    }
+    return line.size();
+}
+
+int PieceTableEdit::positionAt(const QPoint &point) const
+{
+    const int line = qBound(0, verticalScrollBar()->value() + point.y() / fontMetrics().lineSpacing(),
+                            table.lineCount() - 1);
+    const int x = point.x() - 4 + horizontalScrollBar()->value();
+    return table.lineStart(line) + columnForX(table.line(line), x);
+}
+
+void PieceTableEdit::resizeEvent(QResizeEvent *e)
+{
+    QAbstractScrollArea::resizeEvent(e);
+    updateScrollBars();
+}
+
+void PieceTableEdit::focusInEvent(QFocusEvent *e)
+{
+    QAbstractScrollArea::focusInEvent(e);
+    viewport()->update();
+}
+
+void PieceTableEdit::focusOutEvent(QFocusEvent *e)
+{
+    QAbstractScrollArea::focusOutEvent(e);
+    viewport()->update();
+}
+
+void PieceTableEdit::paintEvent(QPaintEvent *)
+{
+    QPainter painter(viewport());
+    const QFontMetrics fm = fontMetrics();
+    const int lineSpacing = fm.lineSpacing();
+    const int x = 4 - horizontalScrollBar()->value();
+    const int first = verticalScrollBar()->value();
+    const int last = qMin(table.lineCount(), first + visibleLines() + 1);
+    const int selStart = selectionStart();
+    const int selEnd = selectionEnd();
+
+    int y = 0;
+    int widest = widestLine;
+    for (int i = first; i < last; ++i) {
+        const QString text = table.line(i);
+        const int start = table.lineStart(i);
+        const int end = start + text.size();
+
+        if (selStart != selEnd && selStart <= end && selEnd > start) {
+            const int from = xForColumn(text, qMax(selStart, start) - start);
+            const int to = selEnd > end ? fm.width(expandTabs(text)) + fm.averageCharWidth()
+                                        : xForColumn(text, selEnd - start);
+            painter.fillRect(x + from, y, to - from, lineSpacing, palette().highlight());
+        }
+
+        // Text being composed by an input method is shown underlined at
+        // the cursor until it is committed.
+        const bool cursorLine = cursor >= start && cursor <= end;
+        const int column = cursor - start;
+        QString composed = text;
+        if (cursorLine && !preedit.isEmpty())
+            composed.insert(column, preedit);
+
+        painter.setPen(palette().text().color());
+        const QString shown = expandTabs(composed);
+        painter.drawText(x, y + fm.ascent(), shown);
+        widest = qMax(widest, fm.width(shown) + 8);
+
+        if (cursorLine && !preedit.isEmpty()) {
+            const int from = x + xForColumn(composed, column);
+            const int to = x + xForColumn(composed, column + preedit.size());
+            const int underline = y + fm.ascent() + fm.underlinePos();
+            painter.drawLine(from, underline, to, underline);
+        }
+        if (hasFocus() && cursorLine && preeditCursor >= 0) {
+            const int offset = preedit.isEmpty() ? 0 : preeditCursor;
+            const int cx = x + xForColumn(composed, column + offset);
+            painter.fillRect(cx, y, 1, lineSpacing, palette().text());
+        }
+        y += lineSpacing;
+    }
+
+    if (widest != widestLine) {
+        widestLine = widest;
+        horizontalScrollBar()->setRange(0, qMax(0, widestLine - viewport()->width()));
+    }
+}
+
+void PieceTableEdit::mousePressEvent(QMouseEvent *e)
+{
+    if (e->button() != Qt::LeftButton)
+        return;
+    if (!preedit.isEmpty())
+        QApplication::inputMethod()->commit();
+    preferredColumn = -1;
+    moveCursor(positionAt(e->pos()), e->modifiers() & Qt::ShiftModifier);
+}
+
+void PieceTableEdit::mouseMoveEvent(QMouseEvent *e)
+{
+    if (e->buttons() & Qt::LeftButton) {
+        preferredColumn = -1;
+        moveCursor(positionAt(e->pos()), true);
+    }
+}
+
+void PieceTableEdit::keyPressEvent(QKeyEvent *e)
+{
+    const bool shift = e->modifiers() & Qt::ShiftModifier;
+    const bool ctrl = e->modifiers() & Qt::ControlModifier;
+    const int line = table.lineAt(cursor);
+
+    if (e == QKeySequence::Copy) {
+        copy();
+    } else if (e == QKeySequence::Cut) {
+        cut();
+    } else if (e == QKeySequence::Paste) {
+        paste();
+    } else if (e == QKeySequence::Undo) {
+        undo();
+    } else if (e == QKeySequence::Redo) {
+        redo();
+    } else if (e == QKeySequence::SelectAll) {
+        selectAll();
+    } else {
+        switch (e->key()) {
+        case Qt::Key_Left:
+            preferredColumn = -1;
+            moveCursor(!shift && hasSelection() ? selectionStart() : previousPosition(cursor), shift);
+            break;
+        case Qt::Key_Right:
+            preferredColumn = -1;
+            moveCursor(!shift && hasSelection() ? selectionEnd() : nextPosition(cursor), shift);
+            break;
+        case Qt::Key_Up:
+            moveVertically(-1, shift);
+            break;
+        case Qt::Key_Down:
+            moveVertically(1, shift);
+            break;
+        case Qt::Key_PageUp:
+            moveVertically(-visibleLines(), shift);
+            break;
+        case Qt::Key_PageDown:
+            moveVertically(visibleLines(), shift);
+            break;
+        case Qt::Key_Home:
+            preferredColumn = -1;
+            moveCursor(ctrl ? 0 : table.lineStart(line), shift);
+            break;
+        case Qt::Key_End:
+            preferredColumn = -1;
+            moveCursor(ctrl ? table.length() : table.lineStart(line) + table.line(line).size(), shift);
+            break;
+        case Qt::Key_Backspace:
+            if (!hasSelection() && cursor > 0) {
+                // One code point, so that a combining mark comes off alone,
+                // but never half of a surrogate pair.
+                const QString before = table.text(qMax(0, cursor - 2), qMin(cursor, 2));
+                const bool pair = before.size() == 2 && before.at(0).isHighSurrogate()
+                        && before.at(1).isLowSurrogate();
+                anchor = cursor - (pair ? 2 : 1);
+            }
+            removeSelection();
+            contentsChanged();
+            break;
+        case Qt::Key_Delete:
+            if (!hasSelection() && cursor < table.length())
+                anchor = nextPosition(cursor);
+            removeSelection();
+            contentsChanged();
+            break;
+        case Qt::Key_Return:
+        case Qt::Key_Enter:
+            insertText(QStringLiteral("\n"));
+            break;
+        default: {
+            const QString text = e->text();
+            if (!text.isEmpty() && !ctrl && (text.at(0).isPrint() || text.at(0) == QLatin1Char('\t'))) {
+                insertText(text, true);
+            } else {
+                QAbstractScrollArea::keyPressEvent(e);
+                return;
+            }
+        }
+        }
+    }
+    e->accept();
+}
+
+void PieceTableEdit::inputMethodEvent(QInputMethodEvent *e)
+{
+    bool changed = false;
+    if (hasSelection() && (!e->preeditString().isEmpty() || !e->commitString().isEmpty())) {
+        removeSelection();
+        changed = true;
+    }
+    if (e->replacementLength() > 0) {
+        const int from = qBound(0, cursor + e->replacementStart(), table.length());
+        anchor = from;
+        cursor = qMin(table.length(), from + e->replacementLength());
+        removeSelection();
+        changed = true;
+    }
+    if (!e->commitString().isEmpty())
+        insertText(e->commitString(), true);
+    else if (changed)
+        contentsChanged();
+
+    preedit = e->preeditString();
+    preeditCursor = preedit.size();
+    foreach (const QInputMethodEvent::Attribute &attribute, e->attributes()) {
+        if (attribute.type == QInputMethodEvent::Cursor)
+            preeditCursor = attribute.length ? attribute.start : -1;
+    }
+    ensureCursorVisible();
+    viewport()->update();
+    updateMicroFocus();
+    e->accept();
+}
+
+QVariant PieceTableEdit::inputMethodQuery(Qt::InputMethodQuery query) const
+{
+    // Positions are relative to the cursor's line, like QPlainTextEdit's
+    // are to its block.
+    const int line = table.lineAt(cursor);
+    const int start = table.lineStart(line);
+    switch (query) {
+    case Qt::ImEnabled:
+        return true;
+    case Qt::ImCursorRectangle:
+        return cursorRect();
+    case Qt::ImFont:
+        return font();
+    case Qt::ImCursorPosition:
+        return cursor - start;
+    case Qt::ImAnchorPosition:
+        return qBound(0, anchor - start, table.line(line).size());
+    case Qt::ImSurroundingText:
+        return table.line(line);
+    case Qt::ImCurrentSelection:
+        return table.text(selectionStart(), selectionEnd() - selectionStart());
+    default:
+        return QAbstractScrollArea::inputMethodQuery(query);
+    }
+}
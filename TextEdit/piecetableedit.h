@@ -0,0 +1,87 @@
+#ifndef PIECETABLEEDIT_H
+#define PIECETABLEEDIT_H
+
+#include <QAbstractScrollArea>
+#include "piecetable.h"
+
+// Plain text editor on top of PieceTable. Only the lines in the viewport
+// are fetched and painted; edits cost O(log n) in the number of pieces.
+class PieceTableEdit : public QAbstractScrollArea
+{
+    Q_OBJECT
+public:
+    explicit PieceTableEdit(QWidget *parent = 0);
+    ~PieceTableEdit();
+
+    void setPlainText(const QString &text);
+    QString toPlainText() const;
+    const PieceTable &pieceTable() const;
+
+    bool isModified() const;
+    void setModified(bool modified);
+    void setSavedState(const PieceTable &snapshot);
+    bool isUndoAvailable() const;
+    bool isRedoAvailable() const;
+    bool hasSelection() const;
+
+public slots:
+    void undo();
+    void redo();
+    void copy();
+    void cut();
+    void paste();
+    void selectAll();
+    void clear();
+
+signals:
+    void textChanged();
+    void modificationChanged(bool changed);
+    void undoAvailable(bool available);
+    void redoAvailable(bool available);
+    void copyAvailable(bool available);
+    void cursorPositionChanged();
+
+protected:
+    void paintEvent(QPaintEvent *e) Q_DECL_OVERRIDE;
+    void resizeEvent(QResizeEvent *e) Q_DECL_OVERRIDE;
+    void keyPressEvent(QKeyEvent *e) Q_DECL_OVERRIDE;
+    void mousePressEvent(QMouseEvent *e) Q_DECL_OVERRIDE;
+    void mouseMoveEvent(QMouseEvent *e) Q_DECL_OVERRIDE;
+    void focusInEvent(QFocusEvent *e) Q_DECL_OVERRIDE;
+    void focusOutEvent(QFocusEvent *e) Q_DECL_OVERRIDE;
+    void inputMethodEvent(QInputMethodEvent *e) Q_DECL_OVERRIDE;
+    QVariant inputMethodQuery(Qt::InputMethodQuery query) const Q_DECL_OVERRIDE;
+
+private:
+    void insertText(const QString &text, bool typing = false);
+    void removeSelection();
+    void moveCursor(int position, bool keepAnchor);
+    void moveVertically(int lines, bool keepAnchor);
+    int previousPosition(int position) const;
+    int nextPosition(int position) const;
+    QRect cursorRect() const;
+    void ensureCursorVisible();
+    void updateScrollBars();
+    void contentsChanged();
+    int visibleLines() const;
+    int positionAt(const QPoint &point) const;
+    int xForColumn(const QString &line, int column) const;
+    int columnForX(const QString &line, int x) const;
+    int selectionStart() const;
+    int selectionEnd() const;
+
+    PieceTable table;
+    QString preedit;
+    int preeditCursor;
+    int cursor;
+    int anchor;
+    int preferredColumn;
+    int typingEnd;
+    int widestLine;
+    bool wasModified;
+    bool hadUndo;
+    bool hadRedo;
+    bool hadSelection;
+};
+
+#endif // PIECETABLEEDIT_H
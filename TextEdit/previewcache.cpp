@@ -0,0 +1,112 @@
+#include "previewcache.h"
+#include "perflog.h"
+#include <QAbstractTextDocumentLayout>
+#include <QElapsedTimer>
+#include <QPainter>
+#include <QScopedPointer>
+#include <QTextBlock>
+#include <QTextDocument>
+#include <QtPrintSupport/QPrinter>
+
+namespace {
+const int kMaxEntries = 4;
+}
+
+PreviewCache::PreviewCache()
+{
+}
+
+void PreviewCache::clear()
+{
+    entries.clear();
+}
+
+bool PreviewCache::sameSetup(const PageSetup &a, const PageSetup &b)
+{
+    return a.pageSize == b.pageSize && qFuzzyCompare(a.scale, b.scale)
+            && qFuzzyCompare(a.margin, b.margin) && a.font == b.font;
+}
+
+uint PreviewCache::blockHash(const QTextBlock &block)
+{
+    uint hash = qHash(block.revision()) ^ qHash(block.blockFormatIndex());
+    for (QTextBlock::iterator it = block.begin(); !it.atEnd(); ++it) {
+        const QTextFragment fragment = it.fragment();
+        hash = hash * 31 + qHash(fragment.length());
+        hash = hash * 31 + qHash(fragment.charFormatIndex());
+    }
+    return hash;
+}
+
+void PreviewCache::update(Entry &entry, const QTextDocument *document)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QScopedPointer<QTextDocument> clone(document->clone());
+    PageRenderer::prepare(clone.data(), entry.setup);
+    const int pageCount = clone->pageCount();
+    const qreal pageHeight = entry.setup.pageSize.height();
+    QAbstractTextDocumentLayout *layout = clone->documentLayout();
+
+    // Block revisions only exist in the original document, so the clone
+    // is walked in step with it for the positions.
+    QVector<uint> fingerprints(pageCount, 0);
+    for (QTextBlock source = document->begin(), block = clone->begin();
+         source.isValid() && block.isValid(); source = source.next(), block = block.next()) {
+        const QRectF rect = layout->blockBoundingRect(block);
+        const int first = qBound(0, int(rect.top() / pageHeight), pageCount - 1);
+        const int last = qBound(first, int((rect.bottom() - 1) / pageHeight), pageCount - 1);
+        for (int page = first; page <= last; ++page) {
+            const uint offset = qHash(qRound(rect.top() - page * pageHeight));
+            fingerprints[page] = fingerprints[page] * 31 + (blockHash(source) ^ offset);
+        }
+    }
+
+    QVector<QPicture> pages(pageCount);
+    int rendered = 0;
+    for (int page = 0; page < pageCount; ++page) {
+        if (page < entry.pages.size() && entry.fingerprints.at(page) == fingerprints.at(page)) {
+            pages[page] = entry.pages.at(page);
+        } else {
+            pages[page] = PageRenderer::render(clone.data(), entry.setup, page);
+            ++rendered;
+        }
+    }
+
+    entry.revision = document->revision();
+    entry.fingerprints = fingerprints;
+    entry.pages = pages;
+    qCDebug(lcPerf) << "preview: rendered" << rendered << "of" << pageCount
+                    << "pages in" << timer.elapsed() << "ms";
+}
+
+void PreviewCache::paint(const QTextDocument *document, QPrinter *printer)
+{
+    const PageSetup setup = PageSetup::forDevice(printer, document->defaultFont());
+
+    int index = 0;
+    while (index < entries.size() && !sameSetup(entries.at(index).setup, setup))
+        ++index;
+    if (index == entries.size()) {
+        Entry entry;
+        entry.setup = setup;
+        entry.revision = -1;
+        entries.prepend(entry);
+        while (entries.size() > kMaxEntries)
+            entries.removeLast();
+    } else {
+        entries.move(index, 0);
+    }
+
+    Entry &entry = entries.first();
+    if (entry.revision != document->revision())
+        update(entry, document);
+
+    QPainter painter(printer);
+    for (int page = 0; page < entry.pages.size(); ++page) {
+        if (page > 0)
+            printer->newPage();
+        PageRenderer::paint(&painter, entry.setup, entry.pages.at(page), page + 1);
+    }
+}
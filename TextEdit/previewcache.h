@@ -0,0 +1,44 @@
+#ifndef PREVIEWCACHE_H
+#define PREVIEWCACHE_H
+
+#include <QList>
+#include <QPicture>
+#include <QVector>
+#include "pagerenderer.h"
+
+QT_BEGIN_NAMESPACE
+class QPrinter;
+class QTextBlock;
+class QTextDocument;
+QT_END_NAMESPACE
+
+// Recorded print preview pages, keyed on page setup and document revision.
+// Each page also carries a fingerprint of the blocks on it, so after an
+// edit only the pages whose content or position changed are drawn again.
+class PreviewCache
+{
+public:
+    PreviewCache();
+
+    void paint(const QTextDocument *document, QPrinter *printer);
+    void clear();
+
+private:
+    struct Entry
+    {
+        PageSetup setup;
+        int revision;
+        QVector<uint> fingerprints;
+        QVector<QPicture> pages;
+    };
+
+    static bool sameSetup(const PageSetup &a, const PageSetup &b);
+    static uint blockHash(const QTextBlock &block);
+    void update(Entry &entry, const QTextDocument *document);
+
+    // A few setups are kept so switching orientation back and forth in
+    // the preview does not lay out the document again.
+    QList<Entry> entries;
+};
+
+#endif // PREVIEWCACHE_H
@@ -0,0 +1,121 @@
+#include "textdecoder.h"
+#include <QTextCodec>
+#include <QTextDocument>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TEXTDECODER_SSE2
+#endif
+
+namespace {
+// Qt::mightBeRichText only looks at the first line or tag.
+const int kSniffBytes = 4096;
+const int kUtf8Mib = 106;
+
+// Widens the ASCII run at the start of \a src into \a dst and returns its
+// length in bytes.
+int copyAscii(const uchar *src, int size, ushort *dst)
+{
+    int i = 0;
+#ifdef TEXTDECODER_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= size; i += 16) {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        if (_mm_movemask_epi8(chunk))
+            break;
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_unpacklo_epi8(chunk, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 8), _mm_unpackhi_epi8(chunk, zero));
+    }
+#endif
+    for (; i < size && src[i] < 0x80; ++i)
+        dst[i] = src[i];
+    return i;
+}
+
+inline bool isContinuation(uchar c)
+{
+    return (c & 0xc0) == 0x80;
+}
+}
+
+bool TextDecoder::decodeUtf8(const char *data, int size, QString *text)
+{
+    const uchar *src = reinterpret_cast<const uchar *>(data);
+    int i = 0;
+    // A BOM is dropped, like QTextCodec does.
+    if (size >= 3 && src[0] == 0xef && src[1] == 0xbb && src[2] == 0xbf)
+        i = 3;
+
+    // UTF-16 never needs more code units than UTF-8 needs bytes.
+    text->resize(size - i);
+    ushort *begin = reinterpret_cast<ushort *>(text->data());
+    ushort *out = begin;
+    while (i < size) {
+        const int run = copyAscii(src + i, size - i, out);
+        i += run;
+        out += run;
+        if (i >= size)
+            break;
+
+        const uchar c = src[i];
+        const int left = size - i;
+        if (c >= 0xc2 && c <= 0xdf) {
+            if (left < 2 || !isContinuation(src[i + 1]))
+                return false;
+            *out++ = ushort(((c & 0x1f) << 6) | (src[i + 1] & 0x3f));
+            i += 2;
+        } else if (c >= 0xe0 && c <= 0xef) {
+            if (left < 3 || !isContinuation(src[i + 1]) || !isContinuation(src[i + 2]))
+                return false;
+            // Overlong forms and surrogates.
+            if ((c == 0xe0 && src[i + 1] < 0xa0) || (c == 0xed && src[i + 1] > 0x9f))
+                return false;
+            *out++ = ushort(((c & 0x0f) << 12) | ((src[i + 1] & 0x3f) << 6) | (src[i + 2] & 0x3f));
+            i += 3;
+        } else if (c >= 0xf0 && c <= 0xf4) {
+            if (left < 4 || !isContinuation(src[i + 1]) || !isContinuation(src[i + 2])
+                    || !isContinuation(src[i + 3]))
+                return false;
+            // Overlong forms and code points above U+10FFFF.
+            if ((c == 0xf0 && src[i + 1] < 0x90) || (c == 0xf4 && src[i + 1] > 0x8f))
+                return false;
+            const uint ucs4 = ((c & 0x07) << 18) | ((src[i + 1] & 0x3f) << 12)
+                    | ((src[i + 2] & 0x3f) << 6) | (src[i + 3] & 0x3f);
+            *out++ = QChar::highSurrogate(ucs4);
+            *out++ = QChar::lowSurrogate(ucs4);
+            i += 4;
+        } else {
+            return false;
+        }
+    }
+    text->resize(int(out - begin));
+    return true;
+}
+
+QTextCodec *TextDecoder::codecForRichText(const QByteArray &data)
+{
+    // codecForHtml() only looks at the BOM and the first 512 bytes.
+    QTextCodec *codec = Qt::codecForHtml(data);
+    if (Qt::mightBeRichText(codec->toUnicode(data.constData(), qMin(data.size(), kSniffBytes))))
+        return codec;
+    return 0;
+}
+
+QString TextDecoder::decode(const QByteArray &data, bool *rich)
+{
+    QTextCodec *codec = codecForRichText(data);
+    *rich = codec != 0;
+    return codec ? codec->toUnicode(data) : decodePlain(data);
+}
+
+QString TextDecoder::decodePlain(const QByteArray &data)
+{
+    // A BOM wins over the locale.
+    QTextCodec *codec = QTextCodec::codecForUtfText(data, QTextCodec::codecForLocale());
+    if (codec->mibEnum() == kUtf8Mib) {
+        QString text;
+        if (decodeUtf8(data.constData(), data.size(), &text))
+            return text;
+        // Invalid input is rare; let the codec pick the replacement characters.
+    }
+    return codec->toUnicode(data);
+}
@@ -0,0 +1,29 @@
+#ifndef TEXTDECODER_H
+#define TEXTDECODER_H
+
+#include <QByteArray>
+#include <QString>
+
+QT_BEGIN_NAMESPACE
+class QTextCodec;
+QT_END_NAMESPACE
+
+// Decodes file contents the way the editor always has: HTML in the codec
+// named by its BOM or meta tag, everything else in the UTF-8, UTF-16 or
+// UTF-32 encoding named by its BOM, or else the locale encoding.
+// Only a short prefix is decoded to sniff for HTML, and ASCII and UTF-8
+// are validated and decoded in one pass straight into the result.
+class TextDecoder
+{
+public:
+    static QString decode(const QByteArray &data, bool *rich);
+    static QString decodePlain(const QByteArray &data);
+    // Returns the codec for \a data if it looks like HTML, otherwise 0.
+    // Only the first few kilobytes are looked at.
+    static QTextCodec *codecForRichText(const QByteArray &data);
+
+    // Returns false if \a data is not valid UTF-8; \a text is undefined then.
+    static bool decodeUtf8(const char *data, int size, QString *text);
+};
+
+#endif // TEXTDECODER_H
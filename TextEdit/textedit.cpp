@@ -1,5 +1,25 @@
 #include "textedit.h"
 #include "ui_textedit.h"
+#include "documentlimits.h"
+#include "documentloader.h"
+#include "documentsaver.h"
+#include "documentstatistics.h"
+#include "editjournal.h"
+#include "findbar.h"
+#include "formatbatcher.h"
+#include "hibernateddocument.h"
+#include "imagedocument.h"
+#include "pasteimporter.h"
+#include "pdfexporter.h"
+#include "previewcache.h"
+#include "undohistory.h"
+#include "largefileview.h"
+#include "lazydocumentlayout.h"
+#include "listformatter.h"
+#include "mappedfile.h"
+#include "memorydialog.h"
+#include "piecetableedit.h"
+#include "perflog.h"
 #include <QtDebug>
 #include <QMessageBox>
 #include <QFile>
@@ -16,29 +36,211 @@
 #include <QComboBox>
 #include <QFontComboBox>
 #include <QTextEdit>
+#include <QPlainTextEdit>
 #include <QTextList>
 #include <QTextCharFormat>
 #include <QClipboard>
+#include <QMimeData>
 #include <QActionGroup>
 #include <QAbstractTextDocumentLayout>
+#include <QStackedWidget>
+#include <QScrollBar>
+#include <QTabBar>
+#include <QProgressBar>
+#include <QLabel>
+#include <QVBoxLayout>
+#include <QKeyEvent>
+#include <QSettings>
 #ifndef QT_NO_PRINTER
 #include <QtPrintSupport/QPrintDialog>
 #include <QtPrintSupport/QPrinter>
 #include <QtPrintSupport/QPrintPreviewDialog>
 #endif
 
+// Edits and selection changes within this time update the counts once.
+static const int kStatisticsDelayMs = 150;
+// The toolbar follows the cursor at most once per frame.
+static const int kToolbarSyncMs = 16;
+static const int kMaxSwatches = 64;
+// Memory the undo history may use before it spills to disk, unless set
+// with the undo/memoryBudgetMB setting.
+static const int kUndoBudgetMB = 32;
+
 TextEdit::TextEdit(QWidget *parent) :
     QMainWindow(parent),
-    ui(new Ui::TextEdit)
+    ui(new Ui::TextEdit),
+    comboFont(0),
+    editorMode(RichTextMode),
+    pasteRevision(-1),
+    saveRevision(-1),
+    previewCache(new PreviewCache),
+    memoryDialog(0),
+    shownPointSize(-1)
 {
     ui->setupUi(this);
+    traceStartup("setupUi");
+    // QIcon only reads the images from image.qrc when they are first
+    // painted; reading them here shows their cost in the startup trace.
+    foreach (QAction *action, ui->toolBar->actions())
+        action->icon().pixmap(ui->toolBar->iconSize());
+    traceStartup("toolbar icons");
+
     setWindowTitle(QCoreApplication::applicationName());
     textEdit = new QTextEdit(this);
+    // Images are decoded off the GUI thread, at the size they are shown.
+    images = new ImageDocument(textEdit);
+    textEdit->setDocument(images);
     connect(textEdit, &QTextEdit::currentCharFormatChanged,
             this, &TextEdit::currentCharFormatChanged);
     connect(textEdit, &QTextEdit::cursorPositionChanged,
             this, &TextEdit::cursorPositionChanged);
-    setCentralWidget(textEdit);
+    formatBatcher = new FormatBatcher(textEdit, this);
+    toolbarTimer = new QTimer(this);
+    toolbarTimer->setSingleShot(true);
+    toolbarTimer->setInterval(kToolbarSyncMs);
+    connect(toolbarTimer, &QTimer::timeout, this, &TextEdit::syncToolbar);
+
+    largeView = new LargeFileView(this);
+    connect(largeView, &LargeFileView::indexProgress, this, [this](qint64 lines, qint64 bytes) {
+        const MappedFile *file = largeView->file();
+        statusBar()->showMessage(tr("Indexing \"%1\": %2 lines (%3%)")
+                                 .arg(QDir::toNativeSeparators(file->fileName()))
+                                 .arg(lines)
+                                 .arg(file->size() ? bytes * 100 / file->size() : 100));
+    });
+    connect(largeView, &LargeFileView::indexFinished, this, [this]() {
+        const MappedFile *file = largeView->file();
+        statusBar()->showMessage(tr("Opened \"%1\" read-only, %2 lines")
+                                 .arg(QDir::toNativeSeparators(file->fileName()))
+                                 .arg(file->lineCount()));
+    });
+
+    pieceEdit = new PieceTableEdit(this);
+    connect(pieceEdit, &PieceTableEdit::modificationChanged,
+            ui->actionSave, &QAction::setEnabled);
+    connect(pieceEdit, &PieceTableEdit::modificationChanged,
+            this, &QWidget::setWindowModified);
+    connect(pieceEdit, &PieceTableEdit::undoAvailable,
+            ui->actionUndo, &QAction::setEnabled);
+    connect(pieceEdit, &PieceTableEdit::redoAvailable,
+            ui->actionRedo, &QAction::setEnabled);
+
+    // Plain files never pay for character formats or the rich layout.
+    plainEdit = new QPlainTextEdit(this);
+    plainEdit->setLineWrapMode(QPlainTextEdit::NoWrap);
+    plainEdit->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    connect(plainEdit, &QPlainTextEdit::modificationChanged,
+            ui->actionSave, &QAction::setEnabled);
+    connect(plainEdit, &QPlainTextEdit::modificationChanged,
+            this, &QWidget::setWindowModified);
+
+    loader = new DocumentLoader(this);
+    // Smaller plain text is inserted into the plain text editor slice by
+    // slice, like rich text; larger text goes to the piece table at once.
+    loader->setPlainTextThreshold(DocumentLimits::pieceTableCharacters());
+    loader->setPlainTextDocument(plainEdit->document());
+    connect(loader, &DocumentLoader::plainTextStarted, this, [this]() {
+        setEditorMode(PlainTextMode);
+    });
+    connect(loader, &DocumentLoader::plainTextDecoded, this, [this](const QString &text) {
+        pieceEdit->setPlainText(text);
+        setEditorMode(PieceTableMode);
+    });
+    connect(loader, &DocumentLoader::finished, this, &TextEdit::loadFinished);
+    connect(loader, &DocumentLoader::cancelled, this, &TextEdit::loadCancelled);
+
+    paster = new PasteImporter(this);
+    connect(paster, &PasteImporter::finished, this, [this](int position) {
+        setBusy(false);
+        currentUndoHistory()->endGroup();
+        restoreCursor(position);
+        statusBar()->showMessage(tr("Pasted"), 2000);
+    });
+    connect(paster, &PasteImporter::cancelled, this, [this]() {
+        // Whatever was inserted already is taken out again.
+        setBusy(false);
+        UndoHistory *history = currentUndoHistory();
+        history->endGroup();
+        const QTextDocument *document = editorMode == PlainTextMode ? plainEdit->document() : textEdit->document();
+        if (document->revision() != pasteRevision)
+            restoreCursor(history->undo());
+        statusBar()->showMessage(tr("Cancelled paste"));
+    });
+
+    saver = new DocumentSaver(this);
+    connect(saver, &DocumentSaver::finished, this, &TextEdit::saveFinished);
+
+    journal = new EditJournal(textEdit->document(), this);
+    undoHistory = new UndoHistory(textEdit->document(), this);
+    plainJournal = new EditJournal(plainEdit->document(), this);
+    plainUndoHistory = new UndoHistory(plainEdit->document(), this);
+    statistics = new DocumentStatistics(textEdit->document(), this);
+    plainStatistics = new DocumentStatistics(plainEdit->document(), this);
+    const qint64 undoBudget = QSettings().value("undo/memoryBudgetMB", kUndoBudgetMB).toLongLong() * 1024 * 1024;
+    undoHistory->setMemoryBudget(undoBudget);
+    plainUndoHistory->setMemoryBudget(undoBudget);
+
+#ifndef QT_NO_PRINTER
+    exporter = new PdfExporter(this);
+    connect(exporter, &PdfExporter::finished, this, &TextEdit::exportFinished);
+    connect(exporter, &PdfExporter::cancelled, this, [this]() {
+        setProgressVisible(false);
+        statusBar()->showMessage(tr("Cancelled export"));
+    });
+#endif
+
+    progressBar = new QProgressBar(this);
+    progressBar->setRange(0, 100);
+    progressBar->setMaximumWidth(160);
+    progressBar->hide();
+    statusBar()->addPermanentWidget(progressBar);
+
+    statisticsLabel = new QLabel(this);
+    statusBar()->addPermanentWidget(statisticsLabel);
+    statisticsTimer = new QTimer(this);
+    statisticsTimer->setSingleShot(true);
+    statisticsTimer->setInterval(kStatisticsDelayMs);
+    connect(statisticsTimer, &QTimer::timeout, this, &TextEdit::showStatistics);
+    connect(statistics, &DocumentStatistics::changed, statisticsTimer, static_cast<void (QTimer::*)()>(&QTimer::start));
+    connect(textEdit, &QTextEdit::selectionChanged, statisticsTimer, static_cast<void (QTimer::*)()>(&QTimer::start));
+    connect(plainStatistics, &DocumentStatistics::changed, statisticsTimer, static_cast<void (QTimer::*)()>(&QTimer::start));
+    connect(plainEdit, &QPlainTextEdit::selectionChanged, statisticsTimer, static_cast<void (QTimer::*)()>(&QTimer::start));
+    connect(loader, &DocumentLoader::progress, progressBar, &QProgressBar::setValue);
+    connect(paster, &PasteImporter::progress, progressBar, &QProgressBar::setValue);
+#ifndef QT_NO_PRINTER
+    connect(exporter, &PdfExporter::progress, progressBar, &QProgressBar::setValue);
+#endif
+
+    editorStack = new QStackedWidget(this);
+    editorStack->addWidget(textEdit);
+    editorStack->addWidget(pieceEdit);
+    editorStack->addWidget(largeView);
+    editorStack->addWidget(plainEdit);
+    findBar = new FindBar(textEdit, plainEdit, this);
+    QWidget *central = new QWidget(this);
+    QVBoxLayout *centralLayout = new QVBoxLayout(central);
+    centralLayout->setContentsMargins(0, 0, 0, 0);
+    centralLayout->setSpacing(0);
+    // One editor serves all tabs; the documents of the other tabs are
+    // hibernated.
+    tabBar = new QTabBar(central);
+    tabBar->setDocumentMode(true);
+    tabBar->setTabsClosable(true);
+    tabBar->setMovable(true);
+    tabBar->setExpanding(false);
+    tabs.append(HibernatedDocument());
+    tabBar->addTab(QString());
+    activeTab = 0;
+    connect(tabBar, &QTabBar::currentChanged, this, &TextEdit::tabChanged);
+    connect(tabBar, &QTabBar::tabCloseRequested, this, &TextEdit::closeTab);
+    connect(tabBar, &QTabBar::tabMoved, this, [this](int from, int to) {
+        tabs.move(from, to);
+        activeTab = tabBar->currentIndex();
+    });
+    centralLayout->addWidget(tabBar);
+    centralLayout->addWidget(editorStack);
+    centralLayout->addWidget(findBar);
+    setCentralWidget(central);
 
     connect(ui->actionAbout, &QAction::triggered,
             this, &TextEdit::about);
@@ -47,16 +249,46 @@ TextEdit::TextEdit(QWidget *parent) :
     connect(ui->actionQuit, &QAction::triggered,
             this, &QWidget::close);
 
-    connect(ui->actionUndo, &QAction::triggered,
-            textEdit, &QTextEdit::undo);
-    connect(ui->actionRedo, &QAction::triggered,
-            textEdit, &QTextEdit::redo);
-    connect(ui->actionCopy, &QAction::triggered,
-            textEdit, &QTextEdit::copy);
-    connect(ui->actionCut, &QAction::triggered,
-            textEdit, &QTextEdit::cut);
-    connect(ui->actionPaste, &QAction::triggered,
-            textEdit, &QTextEdit::paste);
+    connect(ui->actionUndo, &QAction::triggered, this, [this]() {
+        if (editorMode == PieceTableMode)
+            pieceEdit->undo();
+        else
+            restoreCursor(currentUndoHistory()->undo());
+    });
+    connect(ui->actionRedo, &QAction::triggered, this, [this]() {
+        if (editorMode == PieceTableMode)
+            pieceEdit->redo();
+        else
+            restoreCursor(currentUndoHistory()->redo());
+    });
+    connect(ui->actionCopy, &QAction::triggered, this, [this]() {
+        if (editorMode == PieceTableMode)
+            pieceEdit->copy();
+        else if (editorMode == PlainTextMode)
+            plainEdit->copy();
+        else
+            textEdit->copy();
+    });
+    connect(ui->actionCut, &QAction::triggered, this, [this]() {
+        if (editorMode == PieceTableMode)
+            pieceEdit->cut();
+        else if (editorMode == PlainTextMode)
+            plainEdit->cut();
+        else
+            textEdit->cut();
+    });
+    connect(ui->actionPaste, &QAction::triggered, this, [this]() {
+        if (loader->isRunning() || paster->isRunning())
+            return;
+        if (editorMode == PieceTableMode)
+            pieceEdit->paste();
+        else if (pasteInBackground())
+            return;
+        else if (editorMode == PlainTextMode)
+            plainEdit->paste();
+        else
+            textEdit->paste();
+    });
 
 #ifndef QT_NO_CLIPBOARD
     connect(QApplication::clipboard(), &QClipboard::dataChanged, this, &TextEdit::clipboardDataChanged);
@@ -84,32 +316,44 @@ TextEdit::TextEdit(QWidget *parent) :
     typedef void (QComboBox::*QComboIntSignal)(int);
     connect(comboStyle, static_cast<QComboIntSignal>(&QComboBox::activated), this, &TextEdit::textStyle);
 
+    // The font combo enumerates every installed font, so it is only created
+    // after the first paint, together with the list of standard sizes.
     typedef void (QComboBox::*QComboStringSignal)(const QString &);
-    comboFont = new QFontComboBox(ui->toolBar);
-    ui->toolBar->addWidget(comboFont);
-    connect(comboFont, static_cast<QComboStringSignal>(&QComboBox::activated), this, &TextEdit::textFamily);
-
     comboSize = new QComboBox(ui->toolBar);
     comboSize->setObjectName("comboSize");
-    ui->toolBar->addWidget(comboSize);
+    comboSizeAction = ui->toolBar->addWidget(comboSize);
     comboSize->setEditable(true);
-
-    const QList<int> standardSizes = QFontDatabase::standardSizes();
-    foreach (int size, standardSizes)
-        comboSize->addItem(QString::number(size));
-    comboSize->setCurrentIndex(standardSizes.indexOf(QApplication::font().pointSize()));
+    comboSize->addItem(QString::number(QApplication::font().pointSize()));
 
     connect(comboSize, static_cast<QComboStringSignal>(&QComboBox::activated), this, &TextEdit::textSize);
+    traceStartup("toolbar combos");
 
 
     connect(textEdit->document(), &QTextDocument::modificationChanged,
             ui->actionSave, &QAction::setEnabled);
     connect(textEdit->document(), &QTextDocument::modificationChanged,
             this, &QWidget::setWindowModified);
-    connect(textEdit->document(), &QTextDocument::undoAvailable,
-            ui->actionUndo, &QAction::setEnabled);
-    connect(textEdit->document(), &QTextDocument::redoAvailable,
-            ui->actionRedo, &QAction::setEnabled);
+    connect(undoHistory, &UndoHistory::undoAvailable, this, [this](bool available) {
+        if (editorMode == RichTextMode)
+            ui->actionUndo->setEnabled(available);
+    });
+    connect(undoHistory, &UndoHistory::redoAvailable, this, [this](bool available) {
+        if (editorMode == RichTextMode)
+            ui->actionRedo->setEnabled(available);
+    });
+    connect(plainUndoHistory, &UndoHistory::undoAvailable, this, [this](bool available) {
+        if (editorMode == PlainTextMode)
+            ui->actionUndo->setEnabled(available);
+    });
+    connect(plainUndoHistory, &UndoHistory::redoAvailable, this, [this](bool available) {
+        if (editorMode == PlainTextMode)
+            ui->actionRedo->setEnabled(available);
+    });
+    foreach (UndoHistory *history, QList<UndoHistory *>() << undoHistory << plainUndoHistory) {
+        connect(history, &UndoHistory::historyDropped, this, [this]() {
+            statusBar()->showMessage(tr("The undo history could not be kept and was cleared"));
+        });
+    }
 
     QActionGroup *alignGroup = new QActionGroup(this);
     if (QApplication::isLeftToRight()) {
@@ -125,28 +369,316 @@ TextEdit::TextEdit(QWidget *parent) :
 
     setWindowModified(textEdit->document()->isModified());
     ui->actionSave->setEnabled(textEdit->document()->isModified());
-    ui->actionUndo->setEnabled(textEdit->document()->isUndoAvailable());
-    ui->actionRedo->setEnabled(textEdit->document()->isRedoAvailable());
+    ui->actionUndo->setEnabled(undoHistory->isUndoAvailable());
+    ui->actionRedo->setEnabled(undoHistory->isRedoAvailable());
 
     setCurrentFileName(QString());
+    QTimer::singleShot(0, this, &TextEdit::recoverJournal);
+    textEdit->viewport()->installEventFilter(this);
+    textEdit->installEventFilter(this);
+    plainEdit->installEventFilter(this);
+    traceStartup("TextEdit constructor");
+}
+
+bool TextEdit::eventFilter(QObject *watched, QEvent *event)
+{
+    if (watched == textEdit->viewport() && event->type() == QEvent::Paint) {
+        // Runs once the first paint is done.
+        textEdit->viewport()->removeEventFilter(this);
+        QTimer::singleShot(0, this, &TextEdit::populateToolbarCombos);
+    }
+    if ((watched == textEdit || watched == plainEdit)
+            && (event->type() == QEvent::ShortcutOverride || event->type() == QEvent::KeyPress)) {
+        // Undo and redo go through the history instead of the document's
+        // own stack, and large pastes are inserted in the background.
+        // Left alone, the shortcut override lets the actions' shortcuts
+        // fire; other key sequences trigger them here.
+        QKeyEvent *key = static_cast<QKeyEvent *>(event);
+        QAction *action = 0;
+        if (key->matches(QKeySequence::Paste))
+            action = ui->actionPaste;
+        else if (key->matches(QKeySequence::Undo))
+            action = ui->actionUndo;
+        else if (key->matches(QKeySequence::Redo))
+            action = ui->actionRedo;
+        if (action) {
+            if (event->type() == QEvent::KeyPress)
+                action->trigger();
+            return true;
+        }
+    }
+    return QMainWindow::eventFilter(watched, event);
+}
+
+void TextEdit::populateToolbarCombos()
+{
+    traceStartup("first paint");
+    typedef void (QComboBox::*QComboStringSignal)(const QString &);
+    comboFont = new QFontComboBox(ui->toolBar);
+    ui->toolBar->insertWidget(comboSizeAction, comboFont);
+    comboFont->setEnabled(editorMode == RichTextMode);
+    connect(comboFont, static_cast<QComboStringSignal>(&QComboBox::activated), this, &TextEdit::textFamily);
+
+    const QString size = comboSize->currentText();
+    comboSize->clear();
+    foreach (int standardSize, QFontDatabase::standardSizes())
+        comboSize->addItem(QString::number(standardSize));
+    comboSize->setCurrentIndex(comboSize->findText(size));
+
+    shownFamily.clear();
+    shownPointSize = -1;
+    syncToolbar();
+    traceStartup("font combos");
 }
 
 TextEdit::~TextEdit()
 {
+    delete previewCache;
     delete ui;
 }
 
 void TextEdit::closeEvent(QCloseEvent *e)
 {
-    if (maybeSave())
-        e->accept();
-    else
-        e->ignore();
+    saver->waitForFinished();
+    // Every modified document is offered for saving, the active one first.
+    QVector<bool> asked(tabs.size(), false);
+    for (int i = -1; i < tabs.size(); ++i) {
+        if (i >= 0 && (asked.at(i) || (i != activeTab && !tabs.at(i).modified)))
+            continue;
+        if (i >= 0)
+            tabBar->setCurrentIndex(i);
+        if (!maybeSave()) {
+            e->ignore();
+            return;
+        }
+        asked[activeTab] = true;
+    }
+    journal->reset(QString());
+    plainJournal->reset(QString());
+    for (int i = 0; i < tabs.size(); ++i)
+        tabs[i].journal.discard();
+    e->accept();
+}
+
+bool TextEdit::isBlank() const
+{
+    return fileName.isEmpty() && editorMode == RichTextMode && !loader->isRunning()
+            && !textEdit->document()->isModified() && textEdit->document()->isEmpty();
+}
+
+void TextEdit::newTab()
+{
+    tabs.append(HibernatedDocument());
+    tabBar->addTab(QString());
+    tabBar->setCurrentIndex(tabs.size() - 1);
+}
+
+void TextEdit::closeTab(int index)
+{
+    tabBar->setCurrentIndex(index);
+    if (activeTab != index || !maybeSave())
+        return;
+    if (tabs.size() == 1) {
+        loader->cancel();
+        setEditorMode(RichTextMode);
+        textEdit->clear();
+        setLazyLayout(false);
+        setCurrentFileName(QString());
+        return;
+    }
+    // The closed document is dropped instead of hibernated.
+    journal->reset(QString());
+    plainJournal->reset(QString());
+    tabs.removeAt(index);
+    activeTab = -1;
+    tabBar->removeTab(index);
+}
+
+void TextEdit::tabChanged(int index)
+{
+    if (index < 0 || index == activeTab)
+        return;
+    if (activeTab >= 0)
+        hibernate(&tabs[activeTab]);
+    activeTab = index;
+    const HibernatedDocument document = tabs.at(index);
+    // The active document lives in the editor only.
+    tabs[index] = HibernatedDocument();
+    restore(document);
+}
+
+void TextEdit::hibernate(HibernatedDocument *document)
+{
+    QElapsedTimer timer;
+    timer.start();
+    saver->waitForFinished();
+    paster->cancel();
+    findBar->hide();
+    document->fileName = fileName;
+    document->mode = editorMode;
+    document->modified = isModified();
+    if (loader->isRunning()) {
+        // A document that is still loading is read again when it is shown.
+        document->fileName = loader->fileName();
+        document->mode = RichTextMode;
+        document->modified = false;
+        loader->cancel();
+    } else switch (editorMode) {
+    case PieceTableMode:
+        document->pack(pieceEdit->toPlainText());
+        break;
+    case PlainTextMode:
+        document->pack(plainEdit->toPlainText());
+        document->cursorPosition = plainEdit->textCursor().position();
+        document->scrollPosition = plainEdit->verticalScrollBar()->value();
+        break;
+    case LargeFileMode:
+        document->data.clear();
+        document->scrollPosition = largeView->verticalScrollBar()->value();
+        break;
+    default:
+        document->pack(textEdit->document()->toHtml("utf-8"));
+        document->cursorPosition = textEdit->textCursor().position();
+        document->scrollPosition = textEdit->verticalScrollBar()->value();
+        break;
+    }
+
+    // Only unsaved text in a QTextDocument has a journal worth keeping;
+    // the others are read again or kept in full.
+    EditJournal *tabJournal = editorMode == PlainTextMode ? plainJournal : journal;
+    if (!document->modified || (document->mode != RichTextMode && document->mode != PlainTextMode))
+        tabJournal->reset(QString());
+    document->journal = tabJournal->suspend();
+
+    setEditorMode(RichTextMode);
+    textEdit->clear();
+    images->releaseImages();
+    setLazyLayout(false);
+    qCDebug(lcPerf) << "hibernated" << document->fileName << "into" << document->data.size()
+                    << "bytes in" << timer.elapsed() << "ms";
+}
+
+void TextEdit::restore(const HibernatedDocument &document)
+{
+    QElapsedTimer timer;
+    timer.start();
+    switch (document.mode) {
+    case PieceTableMode:
+        pieceEdit->setPlainText(document.unpack());
+        setEditorMode(PieceTableMode);
+        setCurrentFileName(document.fileName);
+        pieceEdit->setModified(document.modified);
+        break;
+    case PlainTextMode: {
+        // Restoring is neither journaled nor undoable.
+        plainEdit->document()->setUndoRedoEnabled(false);
+        plainEdit->setPlainText(document.unpack());
+        plainEdit->document()->setUndoRedoEnabled(true);
+        setEditorMode(PlainTextMode);
+        setCurrentFileName(document.fileName);
+        plainJournal->resume(document.journal);
+        plainEdit->document()->setModified(document.modified);
+        if (document.modified && document.journal.generation == 0)
+            plainJournal->checkpoint();
+        plainUndoHistory->reset();
+        plainStatistics->recount();
+        QTextCursor cursor = plainEdit->textCursor();
+        cursor.setPosition(qMin(document.cursorPosition, plainEdit->document()->characterCount() - 1));
+        plainEdit->setTextCursor(cursor);
+        plainEdit->verticalScrollBar()->setValue(document.scrollPosition);
+        break;
+    }
+    case LargeFileMode:
+        if (loadLargeFile(document.fileName)) {
+            largeView->verticalScrollBar()->setValue(document.scrollPosition);
+            break;
+        }
+        setCurrentFileName(QString());
+        statusBar()->showMessage(tr("Could not open \"%1\"").arg(QDir::toNativeSeparators(document.fileName)));
+        break;
+    default: {
+        setEditorMode(RichTextMode);
+        const QString html = document.unpack();
+        if (html.isEmpty() && !document.fileName.isEmpty() && !document.modified) {
+            if (!load(document.fileName))
+                setCurrentFileName(QString());
+            break;
+        }
+        if (!html.isEmpty()) {
+            if (!document.fileName.isEmpty())
+                textEdit->document()->setBaseUrl(QUrl::fromLocalFile(QFileInfo(document.fileName).absolutePath() + QLatin1Char('/')));
+            setLazyLayout(DocumentLimits::loadsLazily(html.size()));
+            // setHtml() does not go through clear().
+            images->releaseImages();
+            textEdit->document()->setHtml(html);
+            updateLazyLayout();
+        }
+        setCurrentFileName(document.fileName);
+        // The journal goes on from where it was when the tab was switched
+        // out, rather than starting over with a new snapshot.
+        journal->resume(document.journal);
+        if (document.modified) {
+            textEdit->document()->setModified(true);
+            if (document.journal.generation == 0)
+                journal->checkpoint();
+        }
+        undoHistory->reset();
+        statistics->recount();
+        restoreCursor(qMin(document.cursorPosition, textEdit->document()->characterCount() - 1));
+        textEdit->verticalScrollBar()->setValue(document.scrollPosition);
+        break;
+    }
+    }
+    qCDebug(lcPerf) << "restored" << document.fileName << "in" << timer.elapsed() << "ms";
+}
+
+bool TextEdit::isModified() const
+{
+    switch (editorMode) {
+    case PieceTableMode:
+        return pieceEdit->isModified();
+    case PlainTextMode:
+        return plainEdit->document()->isModified();
+    case LargeFileMode:
+        return false;
+    default:
+        return textEdit->document()->isModified();
+    }
+}
+
+QList<MemoryUsage> TextEdit::memoryUsage() const
+{
+    QList<MemoryUsage> result;
+    for (int i = 0; i < tabs.size(); ++i) {
+        MemoryUsage usage;
+        if (i != activeTab) {
+            usage = MemoryStats::measure(tabs.at(i));
+        } else switch (editorMode) {
+        case PieceTableMode:
+            usage = MemoryStats::measure(pieceEdit->pieceTable());
+            break;
+        case PlainTextMode:
+            usage = MemoryStats::measure(plainEdit->document());
+            usage.undo = plainUndoHistory->residentBytes() + plainUndoHistory->shadowBytes();
+            break;
+        case LargeFileMode:
+            if (largeView->file())
+                usage = MemoryStats::measure(*largeView->file());
+            break;
+        default:
+            usage = MemoryStats::measure(textEdit->document());
+            usage.undo = undoHistory->residentBytes() + undoHistory->shadowBytes();
+            break;
+        }
+        usage.document = tabBar->tabText(i);
+        result.append(usage);
+    }
+    return result;
 }
 
 bool TextEdit::maybeSave()
 {
-    if(!textEdit->document()->isModified())
+    if(!isModified())
         return true;
 
     const QMessageBox::StandardButton ret =
@@ -155,7 +687,7 @@ bool TextEdit::maybeSave()
                                 "Do you want to save your changes?"),
                              QMessageBox::Save | QMessageBox::Discard | QMessageBox::Cancel);
     if (ret == QMessageBox::Save)
-        return on_actionSave_triggered();
+        return on_actionSave_triggered() && saver->waitForFinished();
     else if (ret == QMessageBox::Cancel)
         return false;
     return true;
@@ -165,8 +697,20 @@ bool TextEdit::maybeSave()
 void TextEdit::setCurrentFileName(const QString &fileName)
 {
     this->fileName = fileName;
+    previewCache->clear();
+    journal->reset(fileName);
+    plainJournal->reset(fileName);
     textEdit->document()->setModified(false);
+    undoHistory->setClean(true);
+    pieceEdit->setModified(false);
+    plainEdit->document()->setModified(false);
+    plainUndoHistory->setClean(true);
+    setWindowModified(false);
+    showFileName();
+}
 
+void TextEdit::showFileName()
+{
     QString shownName;
     if (fileName.isEmpty())
         shownName = "untitled.txt";
@@ -174,38 +718,263 @@ void TextEdit::setCurrentFileName(const QString &fileName)
         shownName = QFileInfo(fileName).fileName();
 
     setWindowTitle(tr("%1[*] - %2").arg(shownName, QCoreApplication::applicationName()));
-    setWindowModified(false);
+    if (activeTab >= 0) {
+        tabBar->setTabText(activeTab, shownName);
+        tabBar->setTabToolTip(activeTab, QDir::toNativeSeparators(fileName));
+    }
 }
 
 bool TextEdit::load(const QString &f)
 {
     if (!QFile::exists(f))
         return false;
-    QFile file(f);
-    if (!file.open(QFile::ReadOnly))
+    if (DocumentLimits::opensMapped(QFileInfo(f).size())) {
+        loader->cancel();
+        return loadLargeFile(f);
+    }
+    if (!QFileInfo(f).isReadable())
         return false;
 
-    QByteArray data = file.readAll();
-    QTextCodec *codec = Qt::codecForHtml(data);
-    QString str = codec->toUnicode(data);
-    if (Qt::mightBeRichText(str)) {
-        textEdit->setHtml(str);
+    // The file name is only taken over once the document is complete, so
+    // a cancelled load never leaves a partial document that could be
+    // saved over the original.
+    setEditorMode(RichTextMode);
+    textEdit->clear();
+    images->releaseImages();
+    textEdit->document()->setBaseUrl(QUrl::fromLocalFile(QFileInfo(f).absolutePath() + QLatin1Char('/')));
+    setLazyLayout(DocumentLimits::loadsLazily(QFileInfo(f).size()));
+    setCurrentFileName(QString());
+    setBusy(true);
+    statusBar()->showMessage(tr("Loading \"%1\"...").arg(QDir::toNativeSeparators(f)));
+    loader->start(f, textEdit->document());
+    return true;
+}
+
+void TextEdit::loadFinished(bool ok)
+{
+    setBusy(false);
+    const QString f = loader->fileName();
+    if (ok) {
+        updateLazyLayout();
+        if (editorMode == RichTextMode)
+            statistics->recount();
+        else if (editorMode == PlainTextMode)
+            plainStatistics->recount();
+        setCurrentFileName(f);
+        undoHistory->reset();
+        plainUndoHistory->reset();
+        statusBar()->showMessage(tr("Opened \"%1\"").arg(QDir::toNativeSeparators(f)));
     } else {
-        str = QString::fromLocal8Bit(data);
-        textEdit->setPlainText(str);
+        setEditorMode(RichTextMode);
+        textEdit->clear();
+        setLazyLayout(false);
+        setCurrentFileName(QString());
+        statusBar()->showMessage(tr("Could not open \"%1\"").arg(QDir::toNativeSeparators(f)));
     }
+}
+
+void TextEdit::loadCancelled()
+{
+    setBusy(false);
+    // Plain text that was partly inserted goes, too.
+    setEditorMode(RichTextMode);
+    textEdit->clear();
+    setLazyLayout(false);
+    setCurrentFileName(QString());
+    statusBar()->showMessage(tr("Cancelled loading \"%1\"")
+                             .arg(QDir::toNativeSeparators(loader->fileName())));
+}
+
+void TextEdit::on_actionCancel_triggered()
+{
+    loader->cancel();
+    paster->cancel();
+#ifndef QT_NO_PRINTER
+    exporter->cancel();
+#endif
+}
+
+void TextEdit::setBusy(bool busy)
+{
+    textEdit->setReadOnly(busy);
+    plainEdit->setReadOnly(busy);
+    tabBar->setEnabled(!busy);
+    setProgressVisible(busy);
+}
+
+void TextEdit::setProgressVisible(bool visible)
+{
+    ui->actionCancel->setEnabled(visible);
+    progressBar->setValue(0);
+    progressBar->setVisible(visible);
+}
 
+bool TextEdit::loadLargeFile(const QString &f)
+{
+    // The mapped view decodes lines on demand, so the editor never holds
+    // a copy of the file.
+    if (!largeView->openFile(f))
+        return false;
+    textEdit->clear();
+    setEditorMode(LargeFileMode);
     setCurrentFileName(f);
     return true;
 }
 
+void TextEdit::setLazyLayout(bool lazy)
+{
+    QTextDocument *document = textEdit->document();
+    if (lazy == (qobject_cast<LazyDocumentLayout *>(document->documentLayout()) != 0))
+        return;
+    if (lazy) {
+        LazyDocumentLayout *layout = new LazyDocumentLayout(document);
+        connect(layout, &LazyDocumentLayout::unsupportedContent, this, [this]() {
+            setLazyLayout(false);
+        }, Qt::QueuedConnection);
+        document->setDocumentLayout(layout);
+    } else {
+        // The standard layout is created again on demand.
+        document->setDocumentLayout(0);
+        document->documentLayout();
+    }
+}
+
+void TextEdit::updateLazyLayout()
+{
+    const QTextDocument *document = textEdit->document();
+    setLazyLayout(editorMode == RichTextMode && DocumentLimits::keepsLazyLayout(document));
+}
+
+bool TextEdit::pasteInBackground()
+{
+#ifndef QT_NO_CLIPBOARD
+    const QMimeData *md = QApplication::clipboard()->mimeData();
+    if (!md)
+        return false;
+    const bool plain = editorMode == PlainTextMode;
+    const QTextDocument *document = plain ? plainEdit->document() : textEdit->document();
+    if (!paster->start(plain ? plainEdit->textCursor() : textEdit->textCursor(), md,
+                       !plain && textEdit->acceptRichText()))
+        return false;
+    pasteRevision = document->revision();
+    currentUndoHistory()->beginGroup();
+    setBusy(true);
+    statusBar()->showMessage(tr("Pasting..."));
+    return true;
+#else
+    return false;
+#endif
+}
+
+void TextEdit::showStatistics()
+{
+    // The piece table and the mapped file are too large to keep counted.
+    if (editorMode != RichTextMode && editorMode != PlainTextMode) {
+        statisticsLabel->clear();
+        return;
+    }
+    const bool plain = editorMode == PlainTextMode;
+    const DocumentStatistics *shown = plain ? plainStatistics : statistics;
+    if (shown->isCounting()) {
+        statisticsLabel->setText(tr("Counting words..."));
+        return;
+    }
+    const TextCounts counts = shown->counts();
+    QString text = tr("%1 words, %2 characters, %3 paragraphs, %4 min read")
+            .arg(counts.words).arg(counts.characters).arg(counts.paragraphs).arg(counts.readingMinutes());
+    const QTextCursor cursor = plain ? plainEdit->textCursor() : textEdit->textCursor();
+    if (cursor.hasSelection()) {
+        const TextCounts selected = shown->count(cursor);
+        text = tr("Selected %1 words, %2 characters of %3")
+                .arg(selected.words).arg(selected.characters).arg(text);
+    }
+    statisticsLabel->setText(text);
+}
+
+void TextEdit::restoreCursor(int position)
+{
+    if (position < 0)
+        return;
+    if (editorMode == PlainTextMode) {
+        QTextCursor cursor = plainEdit->textCursor();
+        cursor.setPosition(position);
+        plainEdit->setTextCursor(cursor);
+        return;
+    }
+    QTextCursor cursor = textEdit->textCursor();
+    cursor.setPosition(position);
+    textEdit->setTextCursor(cursor);
+}
+
+UndoHistory *TextEdit::currentUndoHistory() const
+{
+    return editorMode == PlainTextMode ? plainUndoHistory : undoHistory;
+}
+
+void TextEdit::setEditorMode(EditorMode mode)
+{
+    if (mode != LargeFileMode)
+        largeView->closeFile();
+    if (mode != PieceTableMode)
+        pieceEdit->clear();
+    if (mode != PlainTextMode && !plainEdit->document()->isEmpty()) {
+        plainEdit->clear();
+        plainUndoHistory->reset();
+    }
+    editorMode = mode;
+
+    QWidget *editors[] = { textEdit, pieceEdit, largeView, plainEdit };
+    editorStack->setCurrentWidget(editors[mode]);
+    statisticsTimer->start();
+
+    const bool rich = mode == RichTextMode;
+    const bool editable = mode != LargeFileMode;
+    const QList<QAction *> richActions = QList<QAction *>()
+            << ui->actionBold << ui->actionItalic << ui->actionUnderline
+            << ui->actionLeft << ui->actionCenter << ui->actionRight
+            << ui->actionJustify << ui->actionColor;
+    foreach (QAction *action, richActions)
+        action->setEnabled(rich);
+    // Both QTextDocument editors can be searched, printed and exported.
+    const bool textDocument = rich || mode == PlainTextMode;
+    const QList<QAction *> documentActions = QList<QAction *>()
+            << ui->actionPrint << ui->actionPrint_Preview << ui->actionExport_PDF
+            << ui->actionFind << ui->actionFind_Next << ui->actionFind_Previous << ui->actionReplace;
+    foreach (QAction *action, documentActions)
+        action->setEnabled(textDocument);
+    findBar->setPlainText(mode == PlainTextMode);
+    if (!textDocument)
+        findBar->hide();
+    comboStyle->setEnabled(rich);
+    if (comboFont)
+        comboFont->setEnabled(rich);
+    comboSize->setEnabled(rich);
+
+    ui->actionSave_As->setEnabled(editable);
+    ui->actionCopy->setEnabled(editable);
+    ui->actionCut->setEnabled(editable);
+    ui->actionSave->setEnabled(isModified());
+    if (mode == PieceTableMode) {
+        ui->actionUndo->setEnabled(pieceEdit->isUndoAvailable());
+        ui->actionRedo->setEnabled(pieceEdit->isRedoAvailable());
+    } else if (mode == PlainTextMode) {
+        ui->actionUndo->setEnabled(plainUndoHistory->isUndoAvailable());
+        ui->actionRedo->setEnabled(plainUndoHistory->isRedoAvailable());
+    } else {
+        ui->actionUndo->setEnabled(rich && undoHistory->isUndoAvailable());
+        ui->actionRedo->setEnabled(rich && undoHistory->isRedoAvailable());
+    }
+    if (editable)
+        clipboardDataChanged();
+    else
+        ui->actionPaste->setEnabled(false);
+}
+
 void TextEdit::on_actionNew_triggered()
 {
     //New File, name was deault untitled.txt.
-    if(maybeSave()){
-        textEdit->clear();
-        setCurrentFileName(QString());
-    }
+    if (!isBlank())
+        newTab();
 }
 
 void TextEdit::on_actionOpen_triggered()
@@ -218,9 +987,17 @@ void TextEdit::on_actionOpen_triggered()
     if (fileDialog.exec() != QDialog::Accepted)
         return;
     const QString fn = fileDialog.selectedFiles().first();
-    if (load(fn))
-        statusBar()->showMessage(tr("Opened \"%1\"").arg(QDir::toNativeSeparators(fn)));
-    else
+    const QString path = QFileInfo(fn).absoluteFilePath();
+    for (int i = 0; i < tabs.size(); ++i) {
+        const QString open = i == activeTab ? fileName : tabs.at(i).fileName;
+        if (!open.isEmpty() && QFileInfo(open).absoluteFilePath() == path) {
+            tabBar->setCurrentIndex(i);
+            return;
+        }
+    }
+    if (!isBlank())
+        newTab();
+    if (!load(fn))
         statusBar()->showMessage(tr("Could not open \"%1\"").arg(QDir::toNativeSeparators(fn)));
 }
 
@@ -232,18 +1009,69 @@ bool TextEdit::on_actionSave_triggered()
     if(fileName.startsWith(QStringLiteral(":/"))){
         return on_actionSave_As_triggered();
     }
+    return saveTo(fileName);
+}
 
-    QTextDocumentWriter writer(fileName);
-    bool success = writer.write(textEdit->document());
-    if(success){
-        textEdit->document()->setModified(false);
-        statusBar()->showMessage(tr("Wrote \"%1\"").arg(QDir::toNativeSeparators(fileName)));
+bool TextEdit::saveTo(const QString &f)
+{
+    // The document stays editable while the snapshot is written; it is
+    // only marked unmodified if nothing changed in the meantime.
+    statusBar()->showMessage(tr("Saving \"%1\"...").arg(QDir::toNativeSeparators(f)));
+    if (editorMode == PieceTableMode) {
+        saver->save(f, pieceEdit->pieceTable());
+    } else if (editorMode == PlainTextMode) {
+        // Whatever the suffix, plain text files are written as text.
+        saveRevision = plainEdit->document()->revision();
+        saver->saveText(f, plainEdit->document());
     } else {
-        statusBar()->showMessage(tr("Could not write to file \"%1\"")
-                                 .arg(QDir::toNativeSeparators(fileName)));
+        saveRevision = textEdit->document()->revision();
+        saver->save(f, textEdit->document());
     }
+    return true;
+}
 
-    return success;
+void TextEdit::saveFinished(bool ok, const QString &f, qint64 elapsed)
+{
+    // A new name is only taken over once the file has been written, so
+    // a failed Save As keeps the document modified and its journal.
+    const bool renamed = ok && f == savingAs;
+    if (f == savingAs)
+        savingAs.clear();
+    if(ok){
+        if (renamed)
+            fileName = f;
+        if (f == fileName) {
+            if (editorMode == PieceTableMode)
+                pieceEdit->setSavedState(saver->pieceSnapshot());
+            else if (editorMode == PlainTextMode) {
+                if (plainEdit->document()->revision() == saveRevision) {
+                    plainEdit->document()->setModified(false);
+                    plainUndoHistory->setClean(true);
+                    plainJournal->reset(fileName);
+                }
+            } else if (textEdit->document()->revision() == saveRevision) {
+                textEdit->document()->setModified(false);
+                undoHistory->setClean(true);
+                journal->reset(fileName);
+            }
+        }
+        if (renamed) {
+            // Changes made while saving are journaled under the new name.
+            if (isModified()) {
+                EditJournal *active = editorMode == PlainTextMode ? plainJournal : journal;
+                active->reset(fileName);
+                if (editorMode == RichTextMode || editorMode == PlainTextMode)
+                    active->checkpoint();
+            }
+            previewCache->clear();
+            showFileName();
+        }
+        statusBar()->showMessage(tr("Wrote \"%1\" in %2 ms")
+                                 .arg(QDir::toNativeSeparators(f)).arg(elapsed));
+    } else {
+        statusBar()->showMessage(tr("Could not write to file \"%1\"")
+                                 .arg(QDir::toNativeSeparators(f)));
+    }
 }
 
 bool TextEdit::on_actionSave_As_triggered()
@@ -251,14 +1079,83 @@ bool TextEdit::on_actionSave_As_triggered()
     QFileDialog fileDialog(this, tr("Save as..."));
     fileDialog.setAcceptMode(QFileDialog::AcceptSave);
     QStringList mimeTypes;
-    mimeTypes << "application/vnd.oasis.opendocument.text" << "text/html" << "text/plain";
+    if (editorMode == PieceTableMode || editorMode == PlainTextMode) {
+        mimeTypes << "text/plain";
+        fileDialog.setDefaultSuffix("txt");
+    } else {
+        mimeTypes << "application/vnd.oasis.opendocument.text" << "text/html" << "text/plain";
+        fileDialog.setDefaultSuffix("odt");
+    }
     fileDialog.setMimeTypeFilters(mimeTypes);
-    fileDialog.setDefaultSuffix("odt");
     if (fileDialog.exec() != QDialog::Accepted)
         return false;
     const QString fn = fileDialog.selectedFiles().first();
-    setCurrentFileName(fn);
-    return on_actionSave_triggered();
+    savingAs = fn;
+    return saveTo(fn);
+}
+
+void TextEdit::on_actionFind_triggered()
+{
+    findBar->showFind();
+}
+
+void TextEdit::on_actionFind_Next_triggered()
+{
+    findBar->findNext();
+}
+
+void TextEdit::on_actionFind_Previous_triggered()
+{
+    findBar->findPrevious();
+}
+
+void TextEdit::on_actionReplace_triggered()
+{
+    findBar->showReplace();
+}
+
+void TextEdit::on_actionMemory_Usage_triggered()
+{
+    if (!memoryDialog)
+        memoryDialog = new MemoryDialog([this]() { return memoryUsage(); }, this);
+    memoryDialog->show();
+    memoryDialog->raise();
+    memoryDialog->activateWindow();
+}
+
+void TextEdit::recoverJournal()
+{
+    foreach (const QString &path, EditJournal::pendingRecoveries()) {
+        const QString f = EditJournal::recoveredFileName(path);
+        const QString shownName = f.isEmpty() ? QString("untitled.txt") : QFileInfo(f).fileName();
+        const QMessageBox::StandardButton ret =
+            QMessageBox::question(this, QCoreApplication::applicationName(),
+                                  tr("Unsaved changes to \"%1\" were left by an earlier session.\n"
+                                     "Do you want to recover them?").arg(shownName),
+                                  QMessageBox::Yes | QMessageBox::No);
+        if (ret != QMessageBox::Yes) {
+            EditJournal::discard(path);
+            continue;
+        }
+
+        // Any other journals are offered again on the next start.
+        if (!isBlank())
+            newTab();
+        loader->cancel();
+        setEditorMode(RichTextMode);
+        if (EditJournal::recover(path, textEdit->document())) {
+            setCurrentFileName(f);
+            textEdit->document()->setModified(true);
+            undoHistory->reset();
+            statistics->recount();
+            journal->checkpoint();
+            EditJournal::discard(path);
+            statusBar()->showMessage(tr("Recovered unsaved changes to \"%1\"").arg(shownName));
+        } else {
+            statusBar()->showMessage(tr("Could not recover changes to \"%1\"").arg(shownName));
+        }
+        break;
+    }
 }
 
 void TextEdit::on_actionExport_PDF_triggered()
@@ -272,16 +1169,27 @@ void TextEdit::on_actionExport_PDF_triggered()
     if (fileDialog.exec() != QDialog::Accepted)
         return;
     QString fileName = fileDialog.selectedFiles().first();
-    QPrinter printer(QPrinter::HighResolution);
-    printer.setOutputFormat(QPrinter::PdfFormat);
-    printer.setOutputFileName(fileName);
-    textEdit->document()->print(&printer);
-    statusBar()->showMessage(tr("Exported \"%1\"")
+    // Pages are laid out and recorded on the thread pool from a clone, so
+    // the document stays editable during the export.
+    setProgressVisible(true);
+    statusBar()->showMessage(tr("Exporting \"%1\"...")
                              .arg(QDir::toNativeSeparators(fileName)));
+    exporter->start(editorMode == PlainTextMode ? plainEdit->document() : textEdit->document(), fileName);
 //! [0]
 #endif
 }
 
+void TextEdit::exportFinished(bool ok, const QString &f, qint64 elapsed)
+{
+    setProgressVisible(false);
+    if (ok)
+        statusBar()->showMessage(tr("Exported \"%1\" in %2 ms")
+                                 .arg(QDir::toNativeSeparators(f)).arg(elapsed));
+    else
+        statusBar()->showMessage(tr("Could not export \"%1\"")
+                                 .arg(QDir::toNativeSeparators(f)));
+}
+
 void TextEdit::about()
 {
     QMessageBox::about(this, tr("About"), tr("This application demonstrates Qt's "
@@ -292,18 +1200,26 @@ void TextEdit::about()
 void TextEdit::clipboardDataChanged()
 {
 #ifndef QT_NO_CLIPBOARD
-    if (const QMimeData *md = QApplication::clipboard()->mimeData())
-        ui->actionPaste->setEnabled(md->hasText());
+    // Only the offered formats are looked at; the contents are fetched
+    // when they are pasted.
+    if (const QMimeData *md = QApplication::clipboard()->mimeData()) {
+        bool pastable = false;
+        foreach (const QString &format, md->formats()) {
+            if (format.startsWith(QLatin1String("text/plain")) || format == QLatin1String("text/html")
+                    || format == QLatin1String("application/x-qrichtext")) {
+                pastable = true;
+                break;
+            }
+        }
+        ui->actionPaste->setEnabled(pastable);
+    }
 #endif
 }
 
 void TextEdit::mergeFormatOnWordOrSelection(const QTextCharFormat &format)
 {
-    QTextCursor cursor = textEdit->textCursor();
-    if (!cursor.hasSelection())
-        cursor.select(QTextCursor::WordUnderCursor);
-    cursor.mergeCharFormat(format);
-    textEdit->mergeCurrentCharFormat(format);
+    // Changes made together, e.g. family and size, are applied in one pass.
+    formatBatcher->merge(format);
 }
 
 void TextEdit::on_actionBold_triggered()
@@ -380,44 +1296,41 @@ void TextEdit::textStyle(int styleIndex)
                 break;
         }
 
-        cursor.beginEditBlock();
-
-        QTextBlockFormat blockFmt = cursor.blockFormat();
-
-        QTextListFormat listFmt;
-
-        if (cursor.currentList()) {
-            listFmt = cursor.currentList()->format();
-        } else {
-            listFmt.setIndent(blockFmt.indent() + 1);
-            blockFmt.setIndent(0);
-            cursor.setBlockFormat(blockFmt);
-        }
-
-        listFmt.setStyle(style);
-
-        cursor.createList(listFmt);
-
-        cursor.endEditBlock();
+        ListFormatter::apply(cursor, style);
     } else {
-        // ####
-        QTextBlockFormat bfmt;
-        bfmt.setObjectIndex(-1);
-        cursor.mergeBlockFormat(bfmt);
+        ListFormatter::remove(cursor);
     }
 }
 
 void TextEdit::colorChanged(const QColor &c)
 {
-    QPixmap pix(16, 16);
-    pix.fill(c);
-    ui->actionColor->setIcon(pix);
+    if (c == swatchColor)
+        return;
+    swatchColor = c;
+    QIcon icon = swatches.value(c.rgba());
+    if (icon.isNull()) {
+        if (swatches.size() >= kMaxSwatches)
+            swatches.clear();
+        QPixmap pix(16, 16);
+        pix.fill(c);
+        icon = QIcon(pix);
+        swatches.insert(c.rgba(), icon);
+    }
+    ui->actionColor->setIcon(icon);
 }
 
 void TextEdit::fontChanged(const QFont &f)
 {
-    comboFont->setCurrentIndex(comboFont->findText(QFontInfo(f).family()));
-    comboSize->setCurrentIndex(comboSize->findText(QString::number(f.pointSize())));
+    // Resolving the family and searching the combos is only worth it when
+    // they actually change.
+    if (comboFont && f.family() != shownFamily) {
+        shownFamily = f.family();
+        comboFont->setCurrentIndex(comboFont->findText(QFontInfo(f).family()));
+    }
+    if (f.pointSize() != shownPointSize) {
+        shownPointSize = f.pointSize();
+        comboSize->setCurrentIndex(comboSize->findText(QString::number(f.pointSize())));
+    }
     ui->actionBold->setChecked(f.bold());
     ui->actionItalic->setChecked(f.italic());
     ui->actionUnderline->setChecked(f.underline());
@@ -462,11 +1375,16 @@ void TextEdit::on_actionPrint_triggered()
 #if !defined(QT_NO_PRINTER) && !defined(QT_NO_PRINTDIALOG)
     QPrinter printer(QPrinter::HighResolution);
     QPrintDialog *dlg = new QPrintDialog(&printer, this);
-    if (textEdit->textCursor().hasSelection())
+    const bool plain = editorMode == PlainTextMode;
+    if (plain ? plainEdit->textCursor().hasSelection() : textEdit->textCursor().hasSelection())
         dlg->addEnabledOption(QAbstractPrintDialog::PrintSelection);
     dlg->setWindowTitle(tr("Print Document"));
-    if (dlg->exec() == QDialog::Accepted)
-        textEdit->print(&printer);
+    if (dlg->exec() == QDialog::Accepted) {
+        if (plain)
+            plainEdit->print(&printer);
+        else
+            textEdit->print(&printer);
+    }
     delete dlg;
 #endif
 }
@@ -486,17 +1404,28 @@ void TextEdit::printPreview(QPrinter *printer)
 #ifdef QT_NO_PRINTER
     Q_UNUSED(printer);
 #else
-    textEdit->print(printer);
+    previewCache->paint(editorMode == PlainTextMode ? plainEdit->document() : textEdit->document(), printer);
 #endif
 }
 
 void TextEdit::currentCharFormatChanged(const QTextCharFormat &format)
 {
-    colorChanged(format.foreground().color());
+    Q_UNUSED(format);
+    if (!toolbarTimer->isActive())
+        toolbarTimer->start();
 }
 
 void TextEdit::cursorPositionChanged()
 {
+    if (!toolbarTimer->isActive())
+        toolbarTimer->start();
+}
+
+void TextEdit::syncToolbar()
+{
+    const QTextCharFormat format = textEdit->currentCharFormat();
+    colorChanged(format.foreground().color());
+    fontChanged(format.font());
     alignmentChanged(textEdit->alignment());
 }
 
@@ -3,17 +3,44 @@
 
 #include <QMainWindow>
 #include <QWidget>
+#include <QColor>
+#include <QHash>
+#include <QIcon>
+#include <QList>
+#include "hibernateddocument.h"
+#include "memorystats.h"
 
 QT_BEGIN_NAMESPACE
 class QAction;
 class QComboBox;
+class QLabel;
 class QFontComboBox;
 class QTextEdit;
 class QTextCharFormat;
 class QMenu;
 class QPrinter;
+class QProgressBar;
+class QPlainTextEdit;
+class QStackedWidget;
+class QTabBar;
+class QTimer;
 QT_END_NAMESPACE
 
+class DocumentLoader;
+class DocumentStatistics;
+class PasteImporter;
+class DocumentSaver;
+class EditJournal;
+class FindBar;
+class FormatBatcher;
+class ImageDocument;
+class LargeFileView;
+class MemoryDialog;
+class PdfExporter;
+class PreviewCache;
+class PieceTableEdit;
+class UndoHistory;
+
 namespace Ui {
 class TextEdit;
 }
@@ -24,18 +51,25 @@ class TextEdit : public QMainWindow
 
 public:
     explicit TextEdit(QWidget *parent = 0);
-    bool TextEdit::load(const QString &f);
+    bool load(const QString &f);
     ~TextEdit();
 
 protected:
     virtual void closeEvent(QCloseEvent *e) Q_DECL_OVERRIDE;
+    bool eventFilter(QObject *watched, QEvent *event) Q_DECL_OVERRIDE;
 
 private slots:
     void on_actionNew_triggered();
     void on_actionOpen_triggered();
+    void on_actionCancel_triggered();
     bool on_actionSave_triggered();
     bool on_actionSave_As_triggered();
     void on_actionExport_PDF_triggered();
+    void on_actionFind_triggered();
+    void on_actionFind_Next_triggered();
+    void on_actionFind_Previous_triggered();
+    void on_actionReplace_triggered();
+    void on_actionMemory_Usage_triggered();
     void on_actionBold_triggered();
     void on_actionItalic_triggered();
     void on_actionUnderline_triggered();
@@ -48,9 +82,43 @@ private slots:
     void on_actionPrint_Preview_triggered();
     void currentCharFormatChanged(const QTextCharFormat &format);
     void cursorPositionChanged();
+    void loadFinished(bool ok);
+    void loadCancelled();
+    void saveFinished(bool ok, const QString &f, qint64 elapsed);
+    void exportFinished(bool ok, const QString &f, qint64 elapsed);
+    void recoverJournal();
+    void syncToolbar();
+    void populateToolbarCombos();
+    void showStatistics();
+    void tabChanged(int index);
+    void closeTab(int index);
 
 private:
+    enum EditorMode {
+        RichTextMode,
+        PieceTableMode,
+        LargeFileMode,
+        PlainTextMode
+    };
+
     void setCurrentFileName(const QString &fileName);
+    void showFileName();
+    bool saveTo(const QString &f);
+    bool loadLargeFile(const QString &f);
+    bool pasteInBackground();
+    void setEditorMode(EditorMode mode);
+    void setLazyLayout(bool lazy);
+    void updateLazyLayout();
+    void restoreCursor(int position);
+    UndoHistory *currentUndoHistory() const;
+    bool isBlank() const;
+    void newTab();
+    void hibernate(HibernatedDocument *document);
+    void restore(const HibernatedDocument &document);
+    bool isModified() const;
+    QList<MemoryUsage> memoryUsage() const;
+    void setBusy(bool busy);
+    void setProgressVisible(bool visible);
     bool maybeSave();
     void about();
     void mergeFormatOnWordOrSelection(const QTextCharFormat &format);
@@ -69,9 +137,46 @@ private:
     QComboBox *comboStyle;
     QFontComboBox *comboFont;
     QComboBox *comboSize;
+    QAction *comboSizeAction;
 
+    QTabBar *tabBar;
+    QList<HibernatedDocument> tabs;
+    int activeTab;
+    QStackedWidget *editorStack;
     QTextEdit *textEdit;
+    ImageDocument *images;
+    FindBar *findBar;
+    FormatBatcher *formatBatcher;
+    LargeFileView *largeView;
+    PieceTableEdit *pieceEdit;
+    QPlainTextEdit *plainEdit;
+    EditorMode editorMode;
+    DocumentLoader *loader;
+    PasteImporter *paster;
+    int pasteRevision;
+    DocumentSaver *saver;
+    PdfExporter *exporter;
+    int saveRevision;
+    // Taken over as the file name once it has been written.
+    QString savingAs;
+    PreviewCache *previewCache;
+    EditJournal *journal;
+    UndoHistory *undoHistory;
+    EditJournal *plainJournal;
+    UndoHistory *plainUndoHistory;
+    DocumentStatistics *statistics;
+    DocumentStatistics *plainStatistics;
+    QLabel *statisticsLabel;
+    QTimer *statisticsTimer;
+    MemoryDialog *memoryDialog;
+    QProgressBar *progressBar;
     QString fileName;
+
+    QTimer *toolbarTimer;
+    QColor swatchColor;
+    QHash<QRgb, QIcon> swatches;
+    QString shownFamily;
+    int shownPointSize;
 };
 
 #endif // TEXTEDIT_H
@@ -0,0 +1,78 @@
+# Everything but main(), shared by the application and the benchmarks.
+
+QT += core gui
+QT += printsupport
+QT += concurrent
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+CONFIG += c++11
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+    $$PWD/textedit.cpp \
+    $$PWD/perflog.cpp \
+    $$PWD/mappedfile.cpp \
+    $$PWD/largefileview.cpp \
+    $$PWD/documentlimits.cpp \
+    $$PWD/documentloader.cpp \
+    $$PWD/piecetable.cpp \
+    $$PWD/piecetableedit.cpp \
+    $$PWD/documentsaver.cpp \
+    $$PWD/pagerenderer.cpp \
+    $$PWD/pdfexporter.cpp \
+    $$PWD/previewcache.cpp \
+    $$PWD/textdecoder.cpp \
+    $$PWD/htmlstreamimporter.cpp \
+    $$PWD/editjournal.cpp \
+    $$PWD/textsearch.cpp \
+    $$PWD/findbar.cpp \
+    $$PWD/formatbatcher.cpp \
+    $$PWD/lazydocumentlayout.cpp \
+    $$PWD/batchconverter.cpp \
+    $$PWD/undohistory.cpp \
+    $$PWD/hibernateddocument.cpp \
+    $$PWD/listformatter.cpp \
+    $$PWD/odtwriter.cpp \
+    $$PWD/pasteimporter.cpp \
+    $$PWD/documentstatistics.cpp \
+    $$PWD/imagecache.cpp \
+    $$PWD/imagedocument.cpp \
+    $$PWD/memorystats.cpp \
+    $$PWD/memorydialog.cpp
+
+HEADERS += \
+    $$PWD/textedit.h \
+    $$PWD/perflog.h \
+    $$PWD/mappedfile.h \
+    $$PWD/largefileview.h \
+    $$PWD/documentlimits.h \
+    $$PWD/documentloader.h \
+    $$PWD/piecetable.h \
+    $$PWD/piecetableedit.h \
+    $$PWD/documentsaver.h \
+    $$PWD/pagerenderer.h \
+    $$PWD/pdfexporter.h \
+    $$PWD/previewcache.h \
+    $$PWD/textdecoder.h \
+    $$PWD/htmlstreamimporter.h \
+    $$PWD/editjournal.h \
+    $$PWD/textsearch.h \
+    $$PWD/findbar.h \
+    $$PWD/formatbatcher.h \
+    $$PWD/lazydocumentlayout.h \
+    $$PWD/batchconverter.h \
+    $$PWD/undohistory.h \
+    $$PWD/hibernateddocument.h \
+    $$PWD/listformatter.h \
+    $$PWD/odtwriter.h \
+    $$PWD/pasteimporter.h \
+    $$PWD/documentstatistics.h \
+    $$PWD/imagecache.h \
+    $$PWD/imagedocument.h \
+    $$PWD/memorystats.h \
+    $$PWD/memorydialog.h
+
+FORMS += $$PWD/textedit.ui
+
+RESOURCES += \
+    $$PWD/image.qrc
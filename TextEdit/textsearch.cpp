@@ -0,0 +1,293 @@
+#include "textsearch.h"
+#include "perflog.h"
+#include <QThread>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cstring>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TEXTSEARCH_SSE2
+#endif
+
+namespace {
+const int kMinChunk = 64 * 1024;
+// Characters rescanned at a time after a match that ran into the next
+// chunk.
+const int kRescanWindow = 4096;
+// Larger edits are searched again on the thread pool.
+const int kMaxEdit = 64 * 1024;
+
+// Returns the first occurrence of \a needle that starts in the first
+// \a starts positions of \a haystack, or -1. The haystack must extend
+// needleSize - 1 characters past the last start.
+int findString(const ushort *haystack, int starts, const ushort *needle, int needleSize)
+{
+    int i = 0;
+#ifdef TEXTSEARCH_SSE2
+    // Compare the first and last character of the needle at eight
+    // positions at once and only check the full needle where both match.
+    const __m128i first = _mm_set1_epi16(short(needle[0]));
+    const __m128i last = _mm_set1_epi16(short(needle[needleSize - 1]));
+    for (; i + 8 <= starts; i += 8) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(haystack + i));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(haystack + i + needleSize - 1));
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi16(a, first), _mm_cmpeq_epi16(b, last)));
+        for (int k = i; mask; ++k, mask >>= 2) {
+            if ((mask & 1) && std::memcmp(haystack + k, needle, needleSize * sizeof(ushort)) == 0)
+                return k;
+        }
+    }
+#endif
+    for (; i < starts; ++i) {
+        if (haystack[i] == needle[0] && std::memcmp(haystack + i, needle, needleSize * sizeof(ushort)) == 0)
+            return i;
+    }
+    return -1;
+}
+}
+
+QVector<SearchHit> SearchChunkMatcher::operator()(const SearchChunk &chunk) const
+{
+    QVector<SearchHit> hits;
+    if (useRegex) {
+        // Matching runs on the whole text so anchors and lookbehinds see
+        // the context around the chunk.
+        QRegularExpressionMatchIterator it = regex.globalMatch(text, chunk.from);
+        while (it.hasNext()) {
+            const QRegularExpressionMatch match = it.next();
+            if (match.capturedStart() >= chunk.to)
+                break;
+            if (match.capturedLength() > 0) {
+                const SearchHit hit = { match.capturedStart(), match.capturedLength() };
+                hits.append(hit);
+            }
+        }
+        return hits;
+    }
+
+    const int size = pattern.size();
+    const int end = qMin(chunk.to + size - 1, text.size());
+    if (end - chunk.from < size)
+        return hits;
+    // Case folding keeps the length, so positions stay the same.
+    const QString haystack = caseSensitive ? text.mid(chunk.from, end - chunk.from)
+                                           : text.mid(chunk.from, end - chunk.from).toCaseFolded();
+    const ushort *data = haystack.utf16();
+    const int starts = haystack.size() - size + 1;
+    int offset = 0;
+    while (offset < starts) {
+        const int found = findString(data + offset, starts - offset, pattern.utf16(), size);
+        if (found < 0)
+            break;
+        const SearchHit hit = { chunk.from + offset + found, size };
+        hits.append(hit);
+        offset += found + size;
+    }
+    return hits;
+}
+
+TextSearch::TextSearch(QObject *parent) :
+    QObject(parent),
+    nextChunk(0),
+    running(false)
+{
+    connect(&watcher, &QFutureWatcher<QVector<SearchHit> >::resultReadyAt, this, &TextSearch::chunkReady);
+    connect(&watcher, &QFutureWatcher<QVector<SearchHit> >::finished, this, &TextSearch::complete);
+}
+
+TextSearch::~TextSearch()
+{
+    watcher.cancel();
+    watcher.waitForFinished();
+}
+
+bool TextSearch::start(const QString &text, const QString &pattern, Options options)
+{
+    cancel();
+    found.clear();
+    pending.clear();
+    error.clear();
+    nextChunk = 0;
+
+    matcher.text = text;
+    matcher.caseSensitive = options.testFlag(CaseSensitive);
+    matcher.useRegex = options.testFlag(RegularExpression);
+    matcher.pattern = matcher.caseSensitive ? pattern : pattern.toCaseFolded();
+    if (matcher.useRegex) {
+        QRegularExpression::PatternOptions patternOptions = QRegularExpression::MultilineOption;
+        if (!matcher.caseSensitive)
+            patternOptions |= QRegularExpression::CaseInsensitiveOption;
+        matcher.regex = QRegularExpression(pattern, patternOptions);
+        if (!matcher.regex.isValid()) {
+            error = matcher.regex.errorString();
+            return false;
+        }
+        matcher.regex.optimize();
+    }
+    if (pattern.isEmpty())
+        return true;
+
+    // A few chunks per thread keeps all cores busy until the end.
+    const int threads = QThread::idealThreadCount();
+    const int chunkSize = qMax(kMinChunk, text.size() / qMax(1, threads * 4));
+    chunks.clear();
+    for (int from = 0; from < text.size(); from += chunkSize) {
+        const SearchChunk chunk = { from, qMin(from + chunkSize, text.size()) };
+        chunks.append(chunk);
+    }
+
+    timer.start();
+    running = true;
+    watcher.setFuture(QtConcurrent::mapped(chunks, matcher));
+    return true;
+}
+
+bool TextSearch::edit(const QString &text, int position, int removed, int added)
+{
+    if (running || !error.isEmpty() || added > kMaxEdit)
+        return false;
+    matcher.text = text;
+    if (matcher.pattern.isEmpty())
+        return true;
+
+    // Hits are sorted and do not overlap, so their ends are sorted too.
+    // Those that end before the window stay, those past it only move.
+    const int from = qMax(0, position - kRescanWindow);
+    const int to = qMin(text.size(), position + added + kRescanWindow);
+    const int first = std::lower_bound(found.constBegin(), found.constEnd(), from,
+                                       [](const SearchHit &hit, int at) { return hit.position + hit.length <= at; })
+            - found.constBegin();
+    const int last = std::lower_bound(found.constBegin() + first, found.constEnd(), position + removed,
+                                      [](const SearchHit &hit, int at) { return hit.position < at; })
+            - found.constBegin();
+    QVector<SearchHit> tail;
+    for (int i = last; i < found.size(); ++i) {
+        const SearchHit hit = { found.at(i).position + added - removed, found.at(i).length };
+        if (hit.position >= to)
+            tail.append(hit);
+    }
+    const SearchChunk window = { first < found.size() ? qMin(from, found.at(first).position) : from, to };
+    found.resize(first);
+    append(window, matcher(window));
+    const SearchChunk rest = { to, text.size() };
+    append(rest, tail);
+    return true;
+}
+
+void TextSearch::cancel()
+{
+    if (!running)
+        return;
+    running = false;
+    watcher.cancel();
+    watcher.waitForFinished();
+}
+
+bool TextSearch::isRunning() const
+{
+    return running;
+}
+
+QString TextSearch::errorString() const
+{
+    return error;
+}
+
+const QVector<SearchHit> &TextSearch::hits() const
+{
+    return found;
+}
+
+QString TextSearch::replacement(const SearchHit &hit, const QString &after) const
+{
+    if (!matcher.useRegex)
+        return after;
+    const QRegularExpressionMatch match = matcher.regex.match(matcher.text, hit.position,
+                                                              QRegularExpression::NormalMatch,
+                                                              QRegularExpression::AnchoredMatchOption);
+    QString result;
+    for (int i = 0; i < after.size(); ++i) {
+        const QChar c = after.at(i);
+        if (c == QLatin1Char('\\') && i + 1 < after.size()) {
+            const QChar next = after.at(++i);
+            if (next.isDigit())
+                result += match.captured(next.digitValue());
+            else
+                result += next;
+        } else {
+            result += c;
+        }
+    }
+    return result;
+}
+
+void TextSearch::chunkReady(int index)
+{
+    // Results of a search that was restarted may still be queued.
+    if (!running || index < nextChunk || pending.contains(index)
+            || !watcher.future().isResultReadyAt(index))
+        return;
+    pending.insert(index, watcher.resultAt(index));
+    while (pending.contains(nextChunk)) {
+        merge(nextChunk, pending.take(nextChunk));
+        ++nextChunk;
+    }
+}
+
+void TextSearch::complete()
+{
+    if (!running)
+        return;
+    const QFuture<QVector<SearchHit> > future = watcher.future();
+    for (int i = nextChunk; i < chunks.size(); ++i) {
+        if (!pending.contains(i) && future.isResultReadyAt(i))
+            pending.insert(i, future.resultAt(i));
+    }
+    while (pending.contains(nextChunk)) {
+        merge(nextChunk, pending.take(nextChunk));
+        ++nextChunk;
+    }
+    running = false;
+    qCDebug(lcPerf) << "found" << found.size() << "hits in" << timer.elapsed() << "ms";
+    emit finished();
+}
+
+void TextSearch::merge(int index, const QVector<SearchHit> &chunkHits)
+{
+    const int from = found.size();
+    append(chunks.at(index), chunkHits);
+    if (found.size() > from)
+        emit hitsFound(from, found.size() - from);
+}
+
+// Appends the hits of \a chunk, which starts where the hits so far end.
+void TextSearch::append(const SearchChunk &chunk, const QVector<SearchHit> &chunkHits)
+{
+    int end = found.isEmpty() ? 0 : found.last().position + found.last().length;
+    int next = 0;
+    if (end > chunk.from) {
+        // The last match ran into this chunk, whose hits may then be out
+        // of step with a scan that goes on from its end. Rescan from there
+        // until a hit lines up with one of the chunk's again.
+        bool inStep = false;
+        while (!inStep && end < chunk.to) {
+            const SearchChunk window = { end, qMin(end + kRescanWindow, chunk.to) };
+            end = window.to;
+            foreach (const SearchHit &hit, matcher(window)) {
+                while (next < chunkHits.size() && chunkHits.at(next).position < hit.position)
+                    ++next;
+                if (next < chunkHits.size() && chunkHits.at(next).position == hit.position
+                        && chunkHits.at(next).length == hit.length) {
+                    inStep = true;
+                    break;
+                }
+                found.append(hit);
+                end = qMax(end, hit.position + hit.length);
+            }
+        }
+        if (!inStep)
+            next = chunkHits.size();
+    }
+    for (; next < chunkHits.size(); ++next)
+        found.append(chunkHits.at(next));
+}
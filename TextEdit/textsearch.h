@@ -0,0 +1,98 @@
+#ifndef TEXTSEARCH_H
+#define TEXTSEARCH_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QMap>
+#include <QRegularExpression>
+#include <QVector>
+
+struct SearchHit
+{
+    int position;
+    int length;
+};
+Q_DECLARE_TYPEINFO(SearchHit, Q_PRIMITIVE_TYPE);
+
+// Start positions [from, to) of the text one worker scans.
+struct SearchChunk
+{
+    int from;
+    int to;
+};
+Q_DECLARE_TYPEINFO(SearchChunk, Q_PRIMITIVE_TYPE);
+
+struct SearchChunkMatcher
+{
+    typedef QVector<SearchHit> result_type;
+
+    QString text;
+    QString pattern;
+    QRegularExpression regex;
+    bool caseSensitive;
+    bool useRegex;
+
+    QVector<SearchHit> operator()(const SearchChunk &chunk) const;
+};
+
+// Searches a plain text snapshot of a document on the thread pool. The
+// text is cut into chunks that are matched in parallel; hits are handed
+// out in document order as soon as all chunks before them are done.
+class TextSearch : public QObject
+{
+    Q_OBJECT
+public:
+    enum Option {
+        CaseSensitive = 0x1,
+        RegularExpression = 0x2
+    };
+    Q_DECLARE_FLAGS(Options, Option)
+
+    explicit TextSearch(QObject *parent = 0);
+    ~TextSearch();
+
+    // Positions in \a text must match the document, as with
+    // QTextDocument::toPlainText().
+    bool start(const QString &text, const QString &pattern, Options options);
+    // Brings the hits of a finished search up to date with an edit that
+    // replaced \a removed characters at \a position with \a added ones;
+    // \a text is the edited snapshot. Only the text around the edit is
+    // matched again, on the calling thread. Returns false if the edit is
+    // too large for that and the search has to be started again.
+    bool edit(const QString &text, int position, int removed, int added);
+    void cancel();
+    bool isRunning() const;
+    QString errorString() const;
+
+    const QVector<SearchHit> &hits() const;
+    // The text \a after with regular expression back references to the
+    // captures of \a hit expanded.
+    QString replacement(const SearchHit &hit, const QString &after) const;
+
+signals:
+    void hitsFound(int from, int count);
+    void finished();
+
+private slots:
+    void chunkReady(int index);
+    void complete();
+
+private:
+    void merge(int index, const QVector<SearchHit> &chunkHits);
+    void append(const SearchChunk &chunk, const QVector<SearchHit> &chunkHits);
+
+    SearchChunkMatcher matcher;
+    QVector<SearchChunk> chunks;
+    QFutureWatcher<QVector<SearchHit> > watcher;
+    QMap<int, QVector<SearchHit> > pending;
+    QVector<SearchHit> found;
+    QString error;
+    int nextChunk;
+    bool running;
+    QElapsedTimer timer;
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(TextSearch::Options)
+
+#endif // TEXTSEARCH_H
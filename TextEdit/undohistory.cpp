@@ -0,0 +1,515 @@
+#include "undohistory.h"
+#include "memorystats.h"
+#include "perflog.h"
+#include <QTextBlock>
+#include <QTextCursor>
+
+namespace {
+const qint64 kDefaultBudget = 32 * 1024 * 1024;
+// The newest steps of each stack stay unpacked for fast undo.
+const int kUnpackedSteps = 16;
+// Idle compaction runs at most this often, for at most kCompactMs.
+const int kCompactDelayMs = 500;
+const int kCompactMs = 8;
+// Typing and deleting within this time merge into one step.
+const int kMergeMs = 1000;
+const int kMaxMergedChars = 512;
+// Rough memory use of a step without its text, and per unpacked character.
+const qint64 kStepBytes = 96;
+const qint64 kBytesPerChar = 8;
+
+// Inserts the range [start, end) of \a from at \a cursor.
+void copyRange(QTextCursor &cursor, QTextDocument *from, int start, int end)
+{
+    if (end <= start)
+        return;
+    const QTextBlock block = from->findBlock(start);
+    if (end < block.position() + block.length()) {
+        // Runs of text within one block are copied without building a
+        // fragment, which is the common case while typing.
+        for (QTextBlock::iterator it = block.begin(); !it.atEnd(); ++it) {
+            const QTextFragment fragment = it.fragment();
+            const int runStart = qMax(start, fragment.position());
+            const int runEnd = qMin(end, fragment.position() + fragment.length());
+            if (runStart < runEnd)
+                cursor.insertText(fragment.text().mid(runStart - fragment.position(), runEnd - runStart),
+                                  fragment.charFormat());
+        }
+        return;
+    }
+    QTextCursor selection(from);
+    selection.setPosition(start);
+    selection.setPosition(end, QTextCursor::KeepAnchor);
+    cursor.insertFragment(selection.selection());
+}
+
+QTextDocumentFragment concat(const QTextDocumentFragment &first, const QTextDocumentFragment &second)
+{
+    QTextDocument document;
+    QTextCursor cursor(&document);
+    cursor.insertFragment(first);
+    cursor.insertFragment(second);
+    return QTextDocumentFragment(&document);
+}
+
+bool withinBlock(const QTextDocumentFragment &fragment)
+{
+    return !fragment.toPlainText().contains(QLatin1Char('\n'));
+}
+}
+
+UndoHistory::UndoHistory(QTextDocument *document, QObject *parent) :
+    QObject(parent),
+    document(document),
+    cleanIndex(0),
+    budget(kDefaultBudget),
+    resident(0),
+    shadowCost(0),
+    spilledSteps(0),
+    applying(false),
+    grouping(false),
+    groupStarted(false),
+    bulk(false),
+    stale(false),
+    relayout(false),
+    canUndo(false),
+    canRedo(false)
+{
+    compactTimer.setSingleShot(true);
+    compactTimer.setInterval(kCompactDelayMs);
+    connect(&compactTimer, &QTimer::timeout, this, &UndoHistory::compact);
+    connect(document, &QTextDocument::contentsChange, this, &UndoHistory::contentsChange);
+    connect(document, &QTextDocument::contentsChanged, this, &UndoHistory::contentsChanged);
+    connect(document, &QTextDocument::documentLayoutChanged, this, &UndoHistory::layoutChanged);
+    reset();
+}
+
+UndoHistory::~UndoHistory()
+{
+}
+
+void UndoHistory::setMemoryBudget(qint64 bytes)
+{
+    budget = bytes;
+    if (overBudget())
+        compactTimer.start();
+}
+
+qint64 UndoHistory::memoryBudget() const
+{
+    return budget;
+}
+
+qint64 UndoHistory::residentBytes() const
+{
+    return resident;
+}
+
+qint64 UndoHistory::shadowBytes() const
+{
+    return MemoryStats::textBytes(shadow.data()) + MemoryStats::formatBytes(shadow.data());
+}
+
+void UndoHistory::reset()
+{
+    clearSteps();
+    // A shadow that followed the document is not copied again.
+    if (stale || !shadow || shadow->characterCount() != document->characterCount())
+        rebuildShadow();
+    bulk = false;
+    cleanIndex = document->isModified() ? -1 : 0;
+    emitAvailability();
+}
+
+void UndoHistory::setClean(bool clean)
+{
+    cleanIndex = clean ? undoStack.size() : -1;
+}
+
+void UndoHistory::beginGroup()
+{
+    grouping = true;
+    groupStarted = false;
+}
+
+void UndoHistory::endGroup()
+{
+    grouping = false;
+    groupStarted = false;
+    // Typing right after the group starts a step of its own.
+    lastEdit.invalidate();
+}
+
+bool UndoHistory::isUndoAvailable() const
+{
+    return !undoStack.isEmpty();
+}
+
+bool UndoHistory::isRedoAvailable() const
+{
+    return !redoStack.isEmpty();
+}
+
+int UndoHistory::undo()
+{
+    return apply(undoStack, redoStack);
+}
+
+int UndoHistory::redo()
+{
+    return apply(redoStack, undoStack);
+}
+
+void UndoHistory::layoutChanged()
+{
+    relayout = true;
+}
+
+void UndoHistory::contentsChange(int position, int removed, int added)
+{
+    // A new layout reports the whole document as inserted right after it
+    // is installed.
+    if (relayout) {
+        relayout = false;
+        return;
+    }
+    // Bulk changes while loading or recovering run with undo disabled.
+    // They cannot be undone, but the shadow follows them, a slice at a
+    // time, rather than being copied in full by reset() afterwards.
+    if (!document->isUndoRedoEnabled()) {
+        if (!bulk) {
+            bulk = true;
+            clearSteps();
+            emitAvailability();
+        }
+        if (!stale && !syncShadow(position, removed, added))
+            stale = true;
+        return;
+    }
+    // QTextDocument::clear() removes the final paragraph separator too.
+    if (bulk || removed >= shadow->characterCount()) {
+        reset();
+        return;
+    }
+    if (position > shadow->characterCount() - 1) {
+        // The change cannot be read back, so neither can the ones before.
+        dropHistory();
+        return;
+    }
+    if (applying) {
+        if (!syncShadow(position, removed, added))
+            rebuildShadow();
+        return;
+    }
+
+    Step step;
+    step.position = position;
+    step.length = qMax(0, qMin(position + added, document->characterCount() - 1) - position);
+    const int end = qMin(position + removed, shadow->characterCount() - 1);
+    step.inserted = qMax(0, end - position);
+    if (step.inserted > 0) {
+        QTextCursor cursor(shadow.data());
+        cursor.setPosition(position);
+        cursor.setPosition(end, QTextCursor::KeepAnchor);
+        step.fragment = cursor.selection();
+    }
+    step.first = shadow->findBlock(position).blockFormat();
+    step.last = shadow->findBlock(end).blockFormat();
+    // The step was read before the shadow went wrong, so it is kept.
+    if (!syncShadow(position, removed, added))
+        rebuildShadow();
+
+    if (!merge(step))
+        push(step);
+    groupStarted = grouping;
+    lastEdit.start();
+}
+
+void UndoHistory::contentsChanged()
+{
+    // Runs after the document has updated its modified state, which is
+    // derived from its own stack.
+    if (document->isUndoRedoEnabled() && (document->isUndoAvailable() || document->isRedoAvailable()))
+        document->clearUndoRedoStacks();
+}
+
+bool UndoHistory::syncShadow(int position, int removed, int added)
+{
+    if (position > shadow->characterCount() - 1)
+        return false;
+    QTextCursor cursor(shadow.data());
+    cursor.setPosition(position);
+    cursor.setPosition(qMin(position + removed, shadow->characterCount() - 1), QTextCursor::KeepAnchor);
+    cursor.removeSelectedText();
+    const int end = qMin(position + added, document->characterCount() - 1);
+    copyRange(cursor, document, position, end);
+    QTextCursor(shadow->findBlock(position)).setBlockFormat(document->findBlock(position).blockFormat());
+    QTextCursor(shadow->findBlock(end)).setBlockFormat(document->findBlock(end).blockFormat());
+
+    if (shadow->characterCount() != document->characterCount()) {
+        qCWarning(lcPerf) << "undo history lost track of the document";
+        return false;
+    }
+    return true;
+}
+
+void UndoHistory::rebuildShadow()
+{
+    QElapsedTimer timer;
+    timer.start();
+    shadow.reset(document->clone());
+    shadow->setUndoRedoEnabled(false);
+    shadowCost = shadowBytes();
+    stale = false;
+    qCDebug(lcPerf) << "copied the document for the undo history in" << timer.elapsed() << "ms";
+}
+
+void UndoHistory::dropHistory()
+{
+    qCWarning(lcPerf) << "undo history could not be kept, starting over";
+    const bool hadSteps = !undoStack.isEmpty() || !redoStack.isEmpty();
+    clearSteps();
+    rebuildShadow();
+    emitAvailability();
+    if (hadSteps)
+        emit historyDropped();
+}
+
+bool UndoHistory::overBudget() const
+{
+    return resident + shadowCost > budget;
+}
+
+void UndoHistory::clearSteps()
+{
+    undoStack.clear();
+    redoStack.clear();
+    cleanIndex = -1;
+    resident = 0;
+    spilledSteps = 0;
+    if (spillFile.isOpen())
+        spillFile.resize(0);
+    lastEdit.invalidate();
+}
+
+bool UndoHistory::merge(const Step &step)
+{
+    if (grouping) {
+        // Changes within or right after the text the group has put in
+        // place so far are covered by its first step.
+        if (!groupStarted || undoStack.isEmpty() || undoStack.last().storage != Resident)
+            return false;
+        Step &top = undoStack.last();
+        if (step.position < top.position || step.position + step.inserted > top.position + top.length)
+            return false;
+        const qint64 before = cost(top);
+        top.length += step.length - step.inserted;
+        resident += cost(top) - before;
+        return true;
+    }
+    if (undoStack.isEmpty() || cleanIndex == undoStack.size()
+            || !lastEdit.isValid() || lastEdit.elapsed() > kMergeMs)
+        return false;
+    Step &top = undoStack.last();
+    if (top.storage != Resident)
+        return false;
+    const qint64 before = cost(top);
+
+    if (step.inserted == 0 && top.inserted == 0) {
+        // Typing: insertions that follow each other within one block.
+        if (step.position != top.position + top.length || top.length + step.length > kMaxMergedChars
+                || document->findBlock(top.position) != document->findBlock(step.position + step.length))
+            return false;
+        top.length += step.length;
+    } else if (step.length == 0 && top.length == 0 && step.inserted > 0 && top.inserted > 0) {
+        // Backspace and Delete: removals next to each other within one block.
+        if (top.inserted + step.inserted > kMaxMergedChars
+                || !withinBlock(step.fragment) || !withinBlock(top.fragment))
+            return false;
+        if (step.position + step.inserted == top.position) {
+            top.fragment = concat(step.fragment, top.fragment);
+            top.position = step.position;
+        } else if (step.position == top.position) {
+            top.fragment = concat(top.fragment, step.fragment);
+        } else {
+            return false;
+        }
+        top.inserted += step.inserted;
+    } else {
+        return false;
+    }
+    resident += cost(top) - before;
+    return true;
+}
+
+void UndoHistory::push(const Step &step)
+{
+    // A new edit drops whatever could have been redone.
+    foreach (const Step &dropped, redoStack) {
+        resident -= cost(dropped);
+        if (dropped.storage == Spilled)
+            --spilledSteps;
+    }
+    redoStack.clear();
+    if (cleanIndex > undoStack.size())
+        cleanIndex = -1;
+    if (spilledSteps == 0 && spillFile.isOpen())
+        spillFile.resize(0);
+
+    undoStack.append(step);
+    resident += cost(step);
+    if ((undoStack.size() > kUnpackedSteps || overBudget()) && !compactTimer.isActive())
+        compactTimer.start();
+    emitAvailability();
+}
+
+int UndoHistory::apply(QList<Step> &from, QList<Step> &to)
+{
+    if (from.isEmpty())
+        return -1;
+    Step step = from.takeLast();
+    resident -= cost(step);
+    if (!load(step) || step.position > document->characterCount() - 1) {
+        qCWarning(lcPerf) << "could not read back an undo step";
+        dropHistory();
+        return -1;
+    }
+
+    // The inverse is taken from the document before it changes.
+    const int end = qMin(step.position + step.length, document->characterCount() - 1);
+    Step inverse;
+    inverse.position = step.position;
+    inverse.length = step.inserted;
+    inverse.inserted = end - step.position;
+    QTextCursor cursor(document);
+    cursor.setPosition(step.position);
+    cursor.setPosition(end, QTextCursor::KeepAnchor);
+    if (inverse.inserted > 0)
+        inverse.fragment = cursor.selection();
+    inverse.first = document->findBlock(step.position).blockFormat();
+    inverse.last = document->findBlock(end).blockFormat();
+
+    applying = true;
+    cursor.beginEditBlock();
+    cursor.removeSelectedText();
+    if (step.inserted > 0)
+        cursor.insertFragment(step.fragment);
+    QTextCursor(document->findBlock(step.position)).setBlockFormat(step.first);
+    QTextCursor(document->findBlock(step.position + step.inserted)).setBlockFormat(step.last);
+    cursor.endEditBlock();
+    applying = false;
+
+    to.append(inverse);
+    resident += cost(inverse);
+    lastEdit.invalidate();
+    updateModified();
+    if (!compactTimer.isActive())
+        compactTimer.start();
+    emitAvailability();
+    return step.position + step.inserted;
+}
+
+void UndoHistory::compact()
+{
+    QElapsedTimer slice;
+    slice.start();
+    shadowCost = shadowBytes();
+    QList<Step> *stacks[] = { &undoStack, &redoStack };
+    for (int s = 0; s < 2; ++s) {
+        QList<Step> &stack = *stacks[s];
+        for (int i = 0; i < stack.size() && slice.elapsed() < kCompactMs; ++i) {
+            if (i < stack.size() - kUnpackedSteps || overBudget())
+                pack(stack[i]);
+        }
+    }
+    // The steps furthest from the current state go to disk first.
+    for (int s = 0; s < 2; ++s) {
+        QList<Step> &stack = *stacks[s];
+        for (int i = 0; i < stack.size() && overBudget() && slice.elapsed() < kCompactMs; ++i)
+            spill(stack[i]);
+    }
+    if (slice.elapsed() >= kCompactMs)
+        compactTimer.start();
+    qCDebug(lcPerf) << "undo history:" << undoStack.size() + redoStack.size() << "steps," << resident
+                    << "bytes resident," << shadowCost << "in the shadow," << spilledSteps << "on disk";
+}
+
+void UndoHistory::pack(Step &step)
+{
+    if (step.storage != Resident)
+        return;
+    resident -= cost(step);
+    const QByteArray html = step.inserted > 0 ? step.fragment.toHtml("utf-8").toUtf8() : QByteArray();
+    step.packed = qCompress(html);
+    step.fragment = QTextDocumentFragment();
+    step.storage = Packed;
+    resident += cost(step);
+}
+
+void UndoHistory::spill(Step &step)
+{
+    if (step.storage != Packed)
+        return;
+    if (!spillFile.isOpen() && !spillFile.open())
+        return;
+    const qint64 offset = spillFile.size();
+    if (!spillFile.seek(offset) || spillFile.write(step.packed) != step.packed.size())
+        return;
+    resident -= cost(step);
+    step.offset = offset;
+    step.size = step.packed.size();
+    step.packed = QByteArray();
+    step.storage = Spilled;
+    resident += cost(step);
+    ++spilledSteps;
+}
+
+bool UndoHistory::load(Step &step)
+{
+    if (step.storage == Spilled) {
+        if (!spillFile.seek(step.offset))
+            return false;
+        step.packed = spillFile.read(step.size);
+        if (step.packed.size() != step.size)
+            return false;
+        step.storage = Packed;
+        --spilledSteps;
+    }
+    if (step.storage == Packed) {
+        const QByteArray html = qUncompress(step.packed);
+        step.packed = QByteArray();
+        if (step.inserted > 0)
+            step.fragment = QTextDocumentFragment::fromHtml(QString::fromUtf8(html));
+        step.storage = Resident;
+    }
+    return true;
+}
+
+qint64 UndoHistory::cost(const Step &step)
+{
+    switch (step.storage) {
+    case Resident:
+        return kStepBytes + step.inserted * kBytesPerChar;
+    case Packed:
+        return kStepBytes + step.packed.size();
+    default:
+        return kStepBytes;
+    }
+}
+
+void UndoHistory::updateModified()
+{
+    document->setModified(cleanIndex != undoStack.size());
+}
+
+void UndoHistory::emitAvailability()
+{
+    if (canUndo != !undoStack.isEmpty()) {
+        canUndo = !undoStack.isEmpty();
+        emit undoAvailable(canUndo);
+    }
+    if (canRedo != !redoStack.isEmpty()) {
+        canRedo = !redoStack.isEmpty();
+        emit redoAvailable(canRedo);
+    }
+}
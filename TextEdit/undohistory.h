@@ -0,0 +1,127 @@
+#ifndef UNDOHISTORY_H
+#define UNDOHISTORY_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QList>
+#include <QScopedPointer>
+#include <QTemporaryFile>
+#include <QTextBlockFormat>
+#include <QTextDocument>
+#include <QTextDocumentFragment>
+#include <QTimer>
+
+// Undo history of a document that stays within a memory budget. The
+// document's own stack is emptied after every edit; instead each change is
+// recorded as the steps that revert it, taken from a shadow copy that
+// still holds the contents from before the change. The newest steps are
+// kept as fragments. Older ones are compressed in idle time, and once the
+// budget, which the shadow counts against, is exceeded the oldest
+// compressed steps are moved to a temporary file, so the whole history
+// stays available. The shadow follows bulk changes such as a document
+// being loaded in slices, so starting over after them copies nothing.
+class UndoHistory : public QObject
+{
+    Q_OBJECT
+public:
+    explicit UndoHistory(QTextDocument *document, QObject *parent = 0);
+    ~UndoHistory();
+
+    void setMemoryBudget(qint64 bytes);
+    qint64 memoryBudget() const;
+    // Bytes held in memory by the undo and redo steps.
+    qint64 residentBytes() const;
+    // Bytes held by the copy of the document that changes are read from.
+    qint64 shadowBytes() const;
+
+    // Starts a new history at the current contents of the document.
+    void reset();
+    // The current contents match the file on disk, or no longer do.
+    void setClean(bool clean);
+    // Changes made in between that continue each other, such as a paste
+    // inserted in slices, become one step.
+    void beginGroup();
+    void endGroup();
+
+    bool isUndoAvailable() const;
+    bool isRedoAvailable() const;
+    // Return the position after the restored text, or -1.
+    int undo();
+    int redo();
+
+signals:
+    void undoAvailable(bool available);
+    void redoAvailable(bool available);
+    // The recorded steps could not be kept and were thrown away.
+    void historyDropped();
+
+private slots:
+    void contentsChange(int position, int removed, int added);
+    void contentsChanged();
+    void layoutChanged();
+    void compact();
+
+private:
+    enum Storage { Resident, Packed, Spilled };
+
+    // Replaces the \a length characters at \a position with \a fragment,
+    // \a inserted characters long, then sets the formats of the first and
+    // last block of the range.
+    struct Step
+    {
+        Step() : position(0), length(0), inserted(0), storage(Resident), offset(0), size(0) {}
+
+        int position;
+        int length;
+        int inserted;
+        QTextDocumentFragment fragment;
+        QTextBlockFormat first;
+        QTextBlockFormat last;
+        Storage storage;
+        QByteArray packed;
+        qint64 offset;
+        int size;
+    };
+
+    bool merge(const Step &step);
+    void push(const Step &step);
+    int apply(QList<Step> &from, QList<Step> &to);
+    bool syncShadow(int position, int removed, int added);
+    void rebuildShadow();
+    void clearSteps();
+    void dropHistory();
+    bool overBudget() const;
+    void pack(Step &step);
+    void spill(Step &step);
+    bool load(Step &step);
+    static qint64 cost(const Step &step);
+    void updateModified();
+    void emitAvailability();
+
+    QTextDocument *document;
+    QScopedPointer<QTextDocument> shadow;
+    QList<Step> undoStack;
+    QList<Step> redoStack;
+    // Undo steps at the clean state, or -1 if it cannot be reached.
+    int cleanIndex;
+    qint64 budget;
+    qint64 resident;
+    // shadowBytes() as of the last copy or compaction.
+    qint64 shadowCost;
+    QTemporaryFile spillFile;
+    int spilledSteps;
+    QTimer compactTimer;
+    QElapsedTimer lastEdit;
+    bool applying;
+    bool grouping;
+    bool groupStarted;
+    // Changes were made with undo disabled since the last reset().
+    bool bulk;
+    // The shadow no longer matches the document.
+    bool stale;
+    bool relayout;
+    bool canUndo;
+    bool canRedo;
+};
+
+#endif // UNDOHISTORY_H